@@ -0,0 +1,119 @@
+--
+-- Fetch benchmarks over the synthetic result sets of bench/oci_stub.c.
+-- For every column mix and fetch mode, print the rows fetched per
+-- second and the bytes allocated on the Lua heap per row.
+-- Run by `make bench`; BENCH_ROWS sets the rows of each result set and
+-- BENCH_ONLY a pattern of the mixes or modes to run.
+--
+
+local driver = require "luasql.oci8"
+
+local ROWS = tonumber (os.getenv "BENCH_ROWS") or 200000
+local ONLY = os.getenv "BENCH_ONLY"
+local BATCH = 100
+
+-- rows fetched with the collector stopped to count allocations
+local ALLOC_ROWS = math.min (ROWS, 20000)
+
+-- the first column is never NULL: positional fetch stops on nil
+local mixes = {
+    { "numbers", "int,int,number,number?,float" },
+    { "strings", "int,varchar(30),char(10),varchar(100)?" },
+    { "dates", "int,date,timestamp,timestamp?" },
+    { "mixed", "int,number?,varchar(40),date,timestamp,raw(16)" },
+    { "lobs", "int,clob(200),blob(64)?" },
+}
+
+local modes = {
+    { "positional", function (cur)
+        local n = 0
+        while cur:fetch () do
+            n = n + 1
+        end
+        return n
+    end },
+    { "numeric", function (cur)
+        local n, row = 0, {}
+        while cur:fetch (row, "n") do
+            n = n + 1
+        end
+        return n
+    end },
+    { "named", function (cur)
+        local n, row = 0, {}
+        while cur:fetch (row, "a") do
+            n = n + 1
+        end
+        return n
+    end },
+    { "named-new", function (cur)
+        local n = 0
+        while cur:fetch ("a") do
+            n = n + 1
+        end
+        return n
+    end },
+    { "batch", function (cur)
+        local n = 0
+        local rows = cur:fetchmany (BATCH)
+        while rows do
+            n = n + #rows
+            rows = cur:fetchmany (BATCH)
+        end
+        return n
+    end },
+    { "columns", function (cur)
+        local n = 0
+        local cols, count = cur:fetchcolumns (BATCH)
+        while cols do
+            n = n + count
+            cols, count = cur:fetchcolumns (BATCH)
+        end
+        return n
+    end },
+}
+
+local env = assert (driver.oci8 ())
+local conn = assert (env:connect ("bench", "bench", "bench",
+    { arraysize = BATCH }))
+
+local function run (spec, rows, fetch)
+    local cur = assert (conn:execute ("bench:" .. rows .. ":" .. spec))
+    local n = fetch (cur)
+    assert (n == rows, "fetched " .. n .. " of " .. rows .. " rows")
+end
+
+local function measure (spec, fetch)
+    -- rows per second, with the collector running
+    run (spec, BATCH, fetch)
+    collectgarbage "collect"
+    local t0 = os.clock ()
+    run (spec, ROWS, fetch)
+    local elapsed = os.clock () - t0
+
+    -- bytes allocated per row
+    collectgarbage "collect"
+    collectgarbage "stop"
+    local kb = collectgarbage "count"
+    run (spec, ALLOC_ROWS, fetch)
+    local bytes = (collectgarbage "count" - kb) * 1024 / ALLOC_ROWS
+    collectgarbage "restart"
+
+    return ROWS / elapsed, bytes
+end
+
+print (string.format ("%s, %d rows per result set", driver._VERSION or
+    "luasql.oci8", ROWS))
+print (string.format ("%-8s %-11s %14s %12s", "mix", "mode", "rows/s", "bytes/row"))
+for _, mix in ipairs (mixes) do
+    for _, mode in ipairs (modes) do
+        if not ONLY or mix[1]:match (ONLY) or mode[1]:match (ONLY) then
+            local rate, bytes = measure (mix[2], mode[2])
+            print (string.format ("%-8s %-11s %14.0f %12.1f", mix[1], mode[1],
+                rate, bytes))
+        end
+    end
+end
+
+conn:close ()
+env:close ()
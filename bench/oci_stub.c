@@ -0,0 +1,1607 @@
+/*
+** LuaSQL, Oracle driver
+** Stand-in for libclntsh serving synthetic result sets from memory, so
+** that the fetch paths of the driver can be measured without a server.
+** See Copyright Notice in license.html
+**
+** It is built against the OCI headers of an Instant Client SDK and
+** implements the entry points used by the driver. A query is described
+** by its text instead of being sent to a server:
+**
+**   bench:<rows>:<column>,<column>,...
+**
+** where a column is one of int, number, float, varchar(n), char(n),
+** raw(n), longraw(n), date, timestamp, timestamptz, timestampltz,
+** clob(n) or blob(n) of up to 16 MB, followed by '?' for a column with a
+** NULL every 7 rows. The columns are named C1, C2, ...
+** Any other statement is executed as DML affecting one row and opens a
+** transaction of the session unless committed on success. Binds succeed
+** without effect. A session pool hands out up to its maximum of sessions
+** and fails instead of waiting beyond it. A LOB read in pieces holds its
+** session: other roundtrips fail until the last piece is read.
+**
+** Direct path loads keep the values of their rows as text, in column
+** arrays of STUB_LOADROWS rows; the query
+**
+**   stub:loaded
+**
+** returns the rows of the last finished load as VARCHAR2 columns,
+**
+**   stub:executes
+**
+** a single NUMBER with the count of the DML statements executed so far
+** and
+**
+**   stub:dropped
+**
+** the count of the statements released with OCI_STRLS_CACHE_DELETE and
+**
+**   stub:snapshots
+**
+** the count of the executes reading at the read point of an earlier
+** one; an execute given a snapshot without a read point fails.
+** The statement stub:fail fails when executed.
+**
+** Roundtrips (logons, executes, fetches, commits and rollbacks) are
+** delayed and made to fail as set by the environment:
+**
+**   OCI_STUB_LATENCY   microseconds of a roundtrip, 0 by default
+**   OCI_STUB_JITTER    random microseconds added to each roundtrip
+**   OCI_STUB_CONNECT   microseconds of a logon, OCI_STUB_LATENCY by default
+**   OCI_STUB_FAILURES  probability of a failed roundtrip, 0 by default
+**
+** The delay is slept in blocking mode; in non-blocking mode the calls
+** return OCI_STILL_EXECUTING until it is over.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "oci.h"
+
+#define STUB_MAXCOLS    64
+
+/* rows of the column array of a direct path load */
+#define STUB_LOADROWS   3
+
+/* synthetic column kinds */
+enum {
+    COL_INT = 1, COL_NUMBER, COL_FLOAT, COL_VARCHAR, COL_CHAR, COL_RAW,
+    COL_DATE, COL_TIMESTAMP, COL_CLOB, COL_BLOB, COL_LOADED, COL_EXECUTES,
+    COL_LONGRAW, COL_TIMESTAMP_TZ, COL_TIMESTAMP_LTZ, COL_DROPPED,
+    COL_SNAPSHOTS
+};
+
+
+typedef struct {
+    ub4           type;               /* OCI_HTYPE_* */
+} stub_handle;
+
+
+typedef struct {
+    stub_handle   h;
+    sb4           code;
+    char          msg[256];
+} stub_error;
+
+
+typedef struct {
+    stub_handle   h;
+    int           nonblocking;
+    uint64_t      until;              /* end of the pending roundtrip */
+    int           lobread;            /* a polling LOB read is unfinished */
+} stub_server;
+
+
+typedef struct {
+    stub_handle   h;
+    int           txn;                /* a transaction is in progress */
+} stub_session;
+
+
+typedef struct {
+    stub_handle   h;
+    OraText       name[8];            /* pool name, locates the pool */
+    ub4           max;
+    ub4           busy;               /* sessions handed out */
+} stub_spool;
+
+
+typedef struct {
+    stub_handle   h;
+    stub_server  *server;
+    stub_server   own;                /* server of OCILogon2 and pools */
+    stub_session *session;
+    stub_session  own_session;
+    stub_spool   *spool;              /* pool of the session */
+} stub_svcctx;
+
+
+typedef struct {
+    int           kind;
+    ub2           type;               /* described SQLT_* */
+    ub2           size;               /* described data size */
+    ub4           lobsize;            /* bytes of a LOB value */
+    int           nulls;              /* a NULL every 7 rows */
+    ub4           pos;                /* index of the column */
+    char          name[8];
+} stub_column;
+
+
+typedef struct {
+    void         *buf;
+    sb4           size;
+    ub2           dty;
+    sb2          *ind;
+    ub2          *rlen;
+} stub_define;
+
+
+typedef struct {
+    stub_handle   h;
+    stub_svcctx  *svc;
+    ub2           stmt_type;
+    uint64_t      rows;               /* rows of the result set */
+    uint64_t      next;               /* next row to fetch, changed rows of DML */
+    ub4           fetched;            /* rows of the last fetch */
+    ub4           ncols;
+    int           fail;               /* the execute fails */
+    stub_column   cols[STUB_MAXCOLS];
+    stub_define   defs[STUB_MAXCOLS];
+} stub_stmt;
+
+
+/* a descriptor: a date and time or a LOB locator */
+typedef struct {
+    ub4           type;               /* OCI_DTYPE_* */
+    sb2           year;
+    ub1           month, day, hour, min, sec;
+    ub4           fsec;
+    sb1           tz_hour, tz_min;    /* offset of a time zone */
+    ub4           len;                /* bytes of a LOB */
+    ub4           seed;
+    ub4           pos;                /* read offset of a LOB */
+    int           taken;              /* a snapshot holds a read point */
+} stub_desc;
+
+
+/* descriptors allocated by OCIArrayDescriptorAlloc */
+typedef struct {
+    ub4           count;
+    stub_desc     descs[1];
+} stub_descarray;
+
+
+/* rows of values as text, NULL for NULL values */
+typedef struct {
+    ub4           ncols;
+    ub4           nrows;
+    char        **values;
+} stub_rows;
+
+
+/* a direct path load: the column array, the converted rows and the
+** loaded rows */
+typedef struct {
+    stub_handle   h;
+    ub4           ncols;
+    char        **array;              /* STUB_LOADROWS rows */
+    stub_rows     stream;
+    stub_rows     loaded;
+    ub4           converted;          /* rows of the last conversion */
+} stub_dirpath;
+
+
+/* column array or stream of a direct path load */
+typedef struct {
+    stub_handle   h;
+    stub_dirpath *ctx;
+} stub_dirpart;
+
+
+/* rows of the last finished load */
+static stub_rows loaded;
+static pthread_mutex_t loaded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* DML statements executed */
+static uint64_t executes;
+
+/* statements dropped from the statement cache */
+static uint64_t dropped;
+
+/* executes at the read point of an earlier one */
+static uint64_t snapshots;
+
+
+/* injected delays and failures */
+static struct {
+    uint64_t      latency;
+    uint64_t      jitter;
+    uint64_t      connect;
+    double        failures;
+} config;
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+
+
+static void
+stub_configure (void) {
+    const char *v;
+    if ((v = getenv ("OCI_STUB_LATENCY")) != NULL)
+        config.latency = strtoull (v, NULL, 10);
+    if ((v = getenv ("OCI_STUB_JITTER")) != NULL)
+        config.jitter = strtoull (v, NULL, 10);
+    config.connect = config.latency;
+    if ((v = getenv ("OCI_STUB_CONNECT")) != NULL)
+        config.connect = strtoull (v, NULL, 10);
+    if ((v = getenv ("OCI_STUB_FAILURES")) != NULL)
+        config.failures = strtod (v, NULL);
+}
+
+
+static sword
+stub_error_code (OCIError *errhp, sb4 code, const char *msg) {
+    stub_error *err = (stub_error *) errhp;
+    if (err) {
+        err->code = code;
+        snprintf (err->msg, sizeof(err->msg), "ORA-%05d: %s", (int) code, msg);
+    }
+    return OCI_ERROR;
+}
+
+
+static sword
+stub_fail (OCIError *errhp, const char *msg) {
+    return stub_error_code (errhp, 20000, msg);
+}
+
+
+static uint64_t
+stub_now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+/*
+** Random numbers of the calling thread (xorshift64).
+*/
+static uint64_t
+stub_random (void) {
+    static __thread uint64_t seed;
+    if (seed == 0)
+        seed = stub_now () ^ (uint64_t) (uintptr_t) &seed ^ 0x9e3779b97f4a7c15ull;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+
+/*
+** Cost of a roundtrip of latency microseconds on the server: slept in
+** blocking mode, polled for in non-blocking mode, then maybe a failure.
+** Return OCI_SUCCESS when the call may complete.
+*/
+static sword
+stub_roundtrip (stub_server *srv, OCIError *errhp, uint64_t latency) {
+    uint64_t delay;
+
+    pthread_once (&config_once, stub_configure);
+    if (srv && srv->lobread)
+        return stub_error_code (errhp, 3127,
+            "no new operations allowed until the active operation ends");
+    delay = latency;
+    if (delay && config.jitter)
+        delay += stub_random () % (config.jitter + 1);
+
+    if (srv && srv->nonblocking) {
+        uint64_t now = stub_now ();
+        if (srv->until == 0 && delay) {
+            srv->until = now + delay;
+            return OCI_STILL_EXECUTING;
+        }
+        if (now < srv->until)
+            return OCI_STILL_EXECUTING;
+        srv->until = 0;
+    }
+    else if (delay) {
+        struct timespec ts;
+        ts.tv_sec = (time_t) (delay / 1000000);
+        ts.tv_nsec = (long) (delay % 1000000) * 1000;
+        while (nanosleep (&ts, &ts) != 0)
+            ;
+    }
+
+    if (config.failures > 0
+            && (stub_random () >> 11) * (1.0 / 9007199254740992.0) < config.failures)
+        return stub_error_code (errhp, 3113, "end-of-file on communication channel");
+    return OCI_SUCCESS;
+}
+
+
+static stub_server *
+stub_server_of (stub_svcctx *svc) {
+    return svc->server ? svc->server : &svc->own;
+}
+
+
+static stub_session *
+stub_session_of (stub_svcctx *svc) {
+    return svc->session ? svc->session : &svc->own_session;
+}
+
+
+/*
+** Encode m / 10^scale as an Oracle NUMBER in the variable length format
+** of SQLT_VNU: length byte, sign and exponent byte, base-100 digits.
+*/
+static void
+stub_number (int64_t m, int scale, ub1 *out) {
+    char d[48];
+    int n, ip, first, last, i, k = 0, neg = m < 0, e;
+    uint64_t u = neg ? (uint64_t) 0 - (uint64_t) m : (uint64_t) m;
+
+    memset (out, 0, OCI_NUMBER_SIZE);
+    if (u == 0) {
+        out[0] = 1;
+        out[1] = 0x80;
+        return;
+    }
+
+    n = snprintf (d + 24, 24, "%llu", (unsigned long long) u);
+    first = 24;
+    /* leading zeros up to the point, then an even integer part */
+    while (n < scale + 1) {
+        d[--first] = '0';
+        n++;
+    }
+    ip = n - scale;
+    if (ip % 2) {
+        d[--first] = '0';
+        n++;
+        ip++;
+    }
+    last = first + n;
+    if ((n - ip) % 2)
+        d[last++] = '0';
+
+    e = ip / 2 - 1;
+    while (first < last && d[first] == '0' && d[first + 1] == '0') {
+        first += 2;
+        e--;
+    }
+    while (last > first && d[last - 1] == '0' && d[last - 2] == '0')
+        last -= 2;
+
+    for (i = first; i < last && k < 20; i += 2) {
+        int pair = (d[i] - '0') * 10 + (d[i + 1] - '0');
+        out[2 + k++] = (ub1) (neg ? 101 - pair : pair + 1);
+    }
+    out[1] = (ub1) (neg ? 62 - e : 193 + e);
+    if (neg && k < 20)
+        out[2 + k++] = 102;
+    out[0] = (ub1) (k + 1);
+}
+
+
+/*
+** Value of a NUMBER as a double.
+*/
+static double
+stub_number_value (const ub1 *num) {
+    int len = num[0], neg = num[1] < 0x80, e, i;
+    double v = 0, w;
+
+    if (len <= 1)
+        return 0;
+    e = neg ? 62 - num[1] : num[1] - 193;
+    w = 1;
+    for (i = 0; i < e; i++)
+        w *= 100;
+    for (i = 0; i > e; i--)
+        w /= 100;
+    for (i = 2; i <= len; i++) {
+        int pair;
+        if (neg && num[i] == 102)
+            break;
+        pair = neg ? 101 - num[i] : num[i] - 1;
+        v += pair * w;
+        w /= 100;
+    }
+    return neg ? -v : v;
+}
+
+
+/*
+** Append n rows of values to a set of rows, which takes them.
+*/
+static int
+stub_rows_append (stub_rows *rows, ub4 ncols, char **values, ub4 n) {
+    size_t count = (size_t) (rows->nrows + n) * ncols;
+    char **v = (char **) realloc (rows->values, (count ? count : 1) * sizeof(char *));
+    if (v == NULL)
+        return 0;
+    memcpy (v + (size_t) rows->nrows * ncols, values, (size_t) n * ncols * sizeof(char *));
+    rows->values = v;
+    rows->ncols = ncols;
+    rows->nrows += n;
+    return 1;
+}
+
+
+static void
+stub_rows_free (stub_rows *rows) {
+    size_t i;
+    for (i = 0; i < (size_t) rows->nrows * rows->ncols; i++)
+        free (rows->values[i]);
+    free (rows->values);
+    rows->values = NULL;
+    rows->nrows = 0;
+}
+
+
+static int
+stub_kind (const char *s, size_t len, stub_column *col) {
+    static const struct {
+        const char *name;
+        int kind;
+        ub2 type;
+        ub2 size;
+    } kinds[] = {
+        {"int", COL_INT, SQLT_NUM, 22},
+        {"number", COL_NUMBER, SQLT_NUM, 22},
+        {"float", COL_FLOAT, SQLT_FLT, 8},
+        {"varchar", COL_VARCHAR, SQLT_CHR, 30},
+        {"char", COL_CHAR, SQLT_AFC, 10},
+        {"raw", COL_RAW, SQLT_BIN, 16},
+        {"longraw", COL_LONGRAW, SQLT_LBI, 100},
+        {"date", COL_DATE, SQLT_DAT, 7},
+        {"timestamp", COL_TIMESTAMP, SQLT_TIMESTAMP, 11},
+        {"timestamptz", COL_TIMESTAMP_TZ, SQLT_TIMESTAMP_TZ, 13},
+        {"timestampltz", COL_TIMESTAMP_LTZ, SQLT_TIMESTAMP_LTZ, 11},
+        {"clob", COL_CLOB, SQLT_CLOB, 64},
+        {"blob", COL_BLOB, SQLT_BLOB, 64},
+        {NULL, 0, 0, 0}
+    };
+    int i;
+
+    col->nulls = len > 0 && s[len - 1] == '?';
+    if (col->nulls)
+        len--;
+    for (i = 0; kinds[i].name; i++) {
+        size_t n = strlen (kinds[i].name);
+        if (len < n || strncmp (s, kinds[i].name, n) != 0)
+            continue;
+        if (len != n && s[n] != '(')
+            continue;
+        col->kind = kinds[i].kind;
+        col->type = kinds[i].type;
+        col->size = kinds[i].size;
+        col->lobsize = kinds[i].size;
+        if (len > n) {
+            long size = atol (s + n + 1);
+            /* LOBs may be longer than a piece of their reads */
+            int lob = col->type == SQLT_CLOB || col->type == SQLT_BLOB;
+            if (size <= 0 || size > (lob ? 16777216L : 32767L))
+                return 0;
+            if (lob)
+                col->lobsize = (ub4) size;
+            else
+                col->size = (ub2) size;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+** Read the description of a synthetic result set.
+*/
+static int
+stub_parse (stub_stmt *stmt, const char *sql, size_t len) {
+    const char *p = sql + 6, *end = sql + len;
+    char *next;
+
+    stmt->rows = strtoull (p, &next, 10);
+    if (next == p || next >= end || *next != ':')
+        return 0;
+    p = next + 1;
+    while (p < end && stmt->ncols < STUB_MAXCOLS) {
+        const char *q = p;
+        stub_column *col = &stmt->cols[stmt->ncols];
+        while (q < end && *q != ',')
+            q++;
+        if (!stub_kind (p, (size_t) (q - p), col))
+            return 0;
+        col->pos = stmt->ncols++;
+        snprintf (col->name, sizeof(col->name), "C%u", stmt->ncols);
+        p = q < end ? q + 1 : q;
+    }
+    return stmt->ncols > 0 && p >= end;
+}
+
+
+/*
+** Describe the rows of the last finished load.
+*/
+static void
+stub_describe_loaded (stub_stmt *stmt) {
+    ub4 c;
+    pthread_mutex_lock (&loaded_lock);
+    stmt->rows = loaded.nrows;
+    stmt->ncols = loaded.ncols < STUB_MAXCOLS ? loaded.ncols : STUB_MAXCOLS;
+    pthread_mutex_unlock (&loaded_lock);
+    for (c = 0; c < stmt->ncols; c++) {
+        stub_column *col = &stmt->cols[c];
+        col->kind = COL_LOADED;
+        col->type = SQLT_CHR;
+        col->size = 4000;
+        col->pos = c;
+        snprintf (col->name, sizeof(col->name), "C%u", c + 1);
+    }
+}
+
+
+static void
+stub_datetime (stub_desc *dt, uint64_t r) {
+    dt->year = (sb2) (1990 + r % 40);
+    dt->month = (ub1) (1 + r % 12);
+    dt->day = (ub1) (1 + r % 28);
+    dt->hour = (ub1) (r % 24);
+    dt->min = (ub1) (r % 60);
+    dt->sec = (ub1) ((r / 60) % 60);
+    dt->fsec = (ub4) (r % 1000) * 1000000;
+}
+
+
+/*
+** Write the value of a column at row r of the result set to element i
+** of its define buffers.
+*/
+static sword
+stub_value (OCIError *errhp, stub_column *col, stub_define *def, ub4 i,
+        uint64_t r) {
+    char *elem = (char *) def->buf + (size_t) i * def->size;
+    ub2 len = 0;
+
+    if (col->kind == COL_LOADED) {
+        const char *v;
+        pthread_mutex_lock (&loaded_lock);
+        v = r < loaded.nrows ? loaded.values[r * loaded.ncols + col->pos] : NULL;
+        if (v) {
+            len = (ub2) (strlen (v) < (size_t) def->size ? strlen (v) : (size_t) def->size);
+            memcpy (elem, v, len);
+        }
+        pthread_mutex_unlock (&loaded_lock);
+        if (def->ind)
+            def->ind[i] = (sb2) (v ? 0 : -1);
+        if (def->rlen)
+            def->rlen[i] = len;
+        return OCI_SUCCESS;
+    }
+
+    if (def->ind)
+        def->ind[i] = (sb2) (col->nulls && r % 7 == 6 ? -1 : 0);
+    if (def->ind && def->ind[i])
+        return OCI_SUCCESS;
+
+    switch (col->kind) {
+        case COL_INT:
+        case COL_NUMBER:
+        case COL_EXECUTES:
+        case COL_DROPPED:
+        case COL_SNAPSHOTS: {
+            int64_t m = col->kind == COL_INT
+                ? (int64_t) ((r * 2654435761u) % 1000000000000ull)
+                : (int64_t) ((r * 37) % 100000000) - 5000000;
+            int scale = col->kind == COL_NUMBER ? 2 : 0;
+            if (col->kind == COL_EXECUTES)
+                m = (int64_t) __sync_fetch_and_add (&executes, 0);
+            else if (col->kind == COL_DROPPED)
+                m = (int64_t) __sync_fetch_and_add (&dropped, 0);
+            else if (col->kind == COL_SNAPSHOTS)
+                m = (int64_t) __sync_fetch_and_add (&snapshots, 0);
+            else if (r % 5 == 3)
+                m = -m;
+            if (def->dty == SQLT_VNU)
+                stub_number (m, scale, (ub1 *) elem);
+            else if (def->dty == SQLT_FLT)
+                *(double *) elem = scale ? m / 100.0 : (double) m;
+            else if ((def->dty == SQLT_INT || def->dty == SQLT_UIN) && !scale)
+                memcpy (elem, &m, sizeof(m));
+            else
+                return stub_fail (errhp, "unsupported define of a NUMBER");
+            break;
+        }
+
+        case COL_FLOAT:
+            if (def->dty != SQLT_FLT)
+                return stub_fail (errhp, "unsupported define of a FLOAT");
+            *(double *) elem = (double) r * 0.5 + 0.25;
+            break;
+
+        case COL_VARCHAR:
+        case COL_CHAR: {
+            char text[32];
+            int n = snprintf (text, sizeof(text), "v%llu", (unsigned long long) r);
+            ub4 want = col->kind == COL_CHAR ? col->size
+                : 1 + (ub4) ((r * 7) % col->size);
+            if (def->dty != SQLT_CHR)
+                return stub_fail (errhp, "unsupported define of a VARCHAR2");
+            if (want > (ub4) def->size)
+                want = (ub4) def->size;
+            for (len = 0; len < want; len++)
+                elem[len] = len < n ? text[len] : (char) ('a' + len % 26);
+            break;
+        }
+
+        case COL_RAW:
+        case COL_LONGRAW:
+            if (def->dty != SQLT_BIN && def->dty != SQLT_LBI)
+                return stub_fail (errhp, "unsupported define of a RAW");
+            len = (ub2) (1 + (r % col->size));
+            if (len > def->size) {
+                /* a cut value reports its full length */
+                if (def->ind)
+                    def->ind[i] = (sb2) len;
+                len = (ub2) def->size;
+            }
+            memset (elem, (int) (r & 0xff), len);
+            break;
+
+        case COL_DATE: {
+            stub_desc dt;
+            ub1 *d = (ub1 *) elem;
+            if (def->dty != SQLT_DAT)
+                return stub_fail (errhp, "unsupported define of a DATE");
+            stub_datetime (&dt, r);
+            d[0] = (ub1) (dt.year / 100 + 100);
+            d[1] = (ub1) (dt.year % 100 + 100);
+            d[2] = dt.month;
+            d[3] = dt.day;
+            d[4] = (ub1) (dt.hour + 1);
+            d[5] = (ub1) (dt.min + 1);
+            d[6] = (ub1) (dt.sec + 1);
+            break;
+        }
+
+        case COL_TIMESTAMP:
+            if (def->dty != SQLT_TIMESTAMP
+                    || (*(stub_desc **) elem)->type != OCI_DTYPE_TIMESTAMP)
+                return stub_fail (errhp, "unsupported define of a TIMESTAMP");
+            stub_datetime (*(stub_desc **) elem, r);
+            break;
+
+        case COL_TIMESTAMP_TZ:
+        case COL_TIMESTAMP_LTZ: {
+            /* offsets from -02:30 to +02:30; the session is at +01:00 */
+            stub_desc *dt = *(stub_desc **) elem;
+            int tz = col->kind == COL_TIMESTAMP_TZ;
+            if (def->dty != (tz ? SQLT_TIMESTAMP_TZ : SQLT_TIMESTAMP_LTZ)
+                    || dt->type != (tz ? OCI_DTYPE_TIMESTAMP_TZ
+                                       : OCI_DTYPE_TIMESTAMP_LTZ))
+                return stub_fail (errhp, "unsupported define of a TIMESTAMP"
+                    " WITH TIME ZONE");
+            stub_datetime (dt, r);
+            dt->tz_hour = (sb1) (tz ? (int) (r % 5) - 2 : 1);
+            dt->tz_min = (sb1) (tz && r % 2 ? (dt->tz_hour < 0 ? -30 : 30) : 0);
+            break;
+        }
+
+        case COL_CLOB:
+        case COL_BLOB: {
+            stub_desc *lob = *(stub_desc **) elem;
+            if (def->dty != SQLT_CLOB && def->dty != SQLT_BLOB)
+                return stub_fail (errhp, "unsupported define of a LOB");
+            lob->len = col->lobsize;
+            lob->seed = (ub4) r;
+            lob->pos = 0;
+            break;
+        }
+    }
+
+    if (def->rlen)
+        def->rlen[i] = len;
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Environment and handles.
+*/
+
+sword
+OCIEnvCreate (OCIEnv **envp, ub4 mode, void *ctxp,
+        void *(*malocfp)(void *ctxp, size_t size),
+        void *(*ralocfp)(void *ctxp, void *memptr, size_t newsize),
+        void (*mfreefp)(void *ctxp, void *memptr),
+        size_t xtramem_sz, void **usrmempp) {
+    stub_handle *env = (stub_handle *) calloc (1, sizeof(stub_handle));
+    (void) mode; (void) ctxp; (void) malocfp; (void) ralocfp; (void) mfreefp;
+    (void) xtramem_sz; (void) usrmempp;
+    if (env == NULL)
+        return OCI_ERROR;
+    env->type = OCI_HTYPE_ENV;
+    *envp = (OCIEnv *) env;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIHandleAlloc (const void *parenth, void **hndlpp, const ub4 type,
+        const size_t xtramem_sz, void **usrmempp) {
+    size_t size;
+    stub_handle *h;
+    (void) parenth; (void) xtramem_sz; (void) usrmempp;
+
+    switch (type) {
+        case OCI_HTYPE_ERROR:
+            size = sizeof(stub_error);
+            break;
+        case OCI_HTYPE_SVCCTX:
+            size = sizeof(stub_svcctx);
+            break;
+        case OCI_HTYPE_SERVER:
+            size = sizeof(stub_server);
+            break;
+        case OCI_HTYPE_SESSION:
+            size = sizeof(stub_session);
+            break;
+        case OCI_HTYPE_STMT:
+            size = sizeof(stub_stmt);
+            break;
+        case OCI_HTYPE_SPOOL:
+            size = sizeof(stub_spool);
+            break;
+        case OCI_HTYPE_DIRPATH_CTX:
+            size = sizeof(stub_dirpath);
+            break;
+        case OCI_HTYPE_DIRPATH_COLUMN_ARRAY:
+        case OCI_HTYPE_DIRPATH_STREAM:
+            size = sizeof(stub_dirpart);
+            break;
+        default:
+            size = sizeof(stub_handle);
+            break;
+    }
+    h = (stub_handle *) calloc (1, size);
+    if (h == NULL)
+        return OCI_ERROR;
+    h->type = type;
+    if (type == OCI_HTYPE_DIRPATH_COLUMN_ARRAY || type == OCI_HTYPE_DIRPATH_STREAM)
+        ((stub_dirpart *) h)->ctx = (stub_dirpath *) parenth;
+    *hndlpp = h;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIHandleFree (void *hndlp, const ub4 type) {
+    if (type == OCI_HTYPE_DIRPATH_CTX) {
+        stub_dirpath *ctx = (stub_dirpath *) hndlp;
+        ub4 i;
+        for (i = 0; ctx->array && i < STUB_LOADROWS * ctx->ncols; i++)
+            free (ctx->array[i]);
+        free (ctx->array);
+        stub_rows_free (&ctx->stream);
+        stub_rows_free (&ctx->loaded);
+    }
+    free (hndlp);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDescriptorAlloc (const void *parenth, void **descpp, const ub4 type,
+        const size_t xtramem_sz, void **usrmempp) {
+    stub_desc *d = (stub_desc *) calloc (1, sizeof(stub_desc));
+    (void) parenth; (void) xtramem_sz; (void) usrmempp;
+    if (d == NULL)
+        return OCI_ERROR;
+    d->type = type;
+    *descpp = d;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDescriptorFree (void *descp, const ub4 type) {
+    (void) type;
+    free (descp);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIArrayDescriptorAlloc (const void *parenth, void **descpp, const ub4 type,
+        ub4 array_size, const size_t xtramem_sz, void **usrmempp) {
+    stub_descarray *a;
+    ub4 i;
+    (void) parenth; (void) xtramem_sz; (void) usrmempp;
+
+    a = (stub_descarray *) calloc (1, sizeof(stub_descarray)
+        + (array_size ? array_size - 1 : 0) * sizeof(stub_desc));
+    if (a == NULL)
+        return OCI_ERROR;
+    a->count = array_size;
+    for (i = 0; i < array_size; i++) {
+        a->descs[i].type = type;
+        descpp[i] = &a->descs[i];
+    }
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIArrayDescriptorFree (void **descp, const ub4 type) {
+    (void) type;
+    if (descp[0])
+        free ((char *) descp[0] - offsetof (stub_descarray, descs));
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIErrorGet (void *hndlp, ub4 recordno, OraText *sqlstate, sb4 *errcodep,
+        OraText *bufp, ub4 bufsiz, ub4 type) {
+    stub_error *err = (stub_error *) hndlp;
+    (void) sqlstate; (void) type;
+    if (err == NULL || recordno != 1 || err->code == 0)
+        return OCI_NO_DATA;
+    if (errcodep)
+        *errcodep = err->code;
+    if (bufp && bufsiz)
+        snprintf ((char *) bufp, bufsiz, "%s", err->msg);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIAttrSet (void *trgthndlp, ub4 trghndltyp, void *attributep, ub4 size,
+        ub4 attrtype, OCIError *errhp) {
+    (void) size; (void) errhp;
+    if (trghndltyp == OCI_HTYPE_SVCCTX && attrtype == OCI_ATTR_SERVER)
+        ((stub_svcctx *) trgthndlp)->server = (stub_server *) attributep;
+    else if (trghndltyp == OCI_HTYPE_SVCCTX && attrtype == OCI_ATTR_SESSION)
+        ((stub_svcctx *) trgthndlp)->session = (stub_session *) attributep;
+    else if (trghndltyp == OCI_HTYPE_SERVER
+            && attrtype == OCI_ATTR_NONBLOCKING_MODE) {
+        /* the attribute toggles the mode */
+        stub_server *srv = (stub_server *) trgthndlp;
+        srv->nonblocking = !srv->nonblocking;
+    }
+    else if (trghndltyp == OCI_HTYPE_DIRPATH_CTX
+            && attrtype == OCI_ATTR_NUM_COLS)
+        ((stub_dirpath *) trgthndlp)->ncols = *(ub2 *) attributep;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIAttrGet (const void *trgthndlp, ub4 trghndltyp, void *attributep,
+        ub4 *sizep, ub4 attrtype, OCIError *errhp) {
+    if (trghndltyp == OCI_DTYPE_PARAM) {
+        stub_column *col = (stub_column *) trgthndlp;
+        switch (attrtype) {
+            case OCI_ATTR_NAME:
+                *(const char **) attributep = col->name;
+                if (sizep)
+                    *sizep = (ub4) strlen (col->name);
+                return OCI_SUCCESS;
+            case OCI_ATTR_DATA_TYPE:
+                *(ub2 *) attributep = col->type;
+                return OCI_SUCCESS;
+            case OCI_ATTR_DATA_SIZE:
+                *(ub2 *) attributep = col->size;
+                return OCI_SUCCESS;
+        }
+    }
+    else if (trghndltyp == OCI_HTYPE_STMT) {
+        const stub_stmt *stmt = (const stub_stmt *) trgthndlp;
+        switch (attrtype) {
+            case OCI_ATTR_STMT_TYPE:
+                *(ub2 *) attributep = stmt->stmt_type;
+                return OCI_SUCCESS;
+            case OCI_ATTR_PARAM_COUNT:
+                *(ub4 *) attributep = stmt->ncols;
+                return OCI_SUCCESS;
+            case OCI_ATTR_ROWS_FETCHED:
+                *(ub4 *) attributep = stmt->fetched;
+                return OCI_SUCCESS;
+            case OCI_ATTR_ROW_COUNT:
+                /* DML changes one row per iteration */
+                *(ub4 *) attributep = (ub4) stmt->next;
+                return OCI_SUCCESS;
+            case OCI_ATTR_NUM_DML_ERRORS:
+                *(ub4 *) attributep = 0;
+                return OCI_SUCCESS;
+        }
+    }
+    else if (trghndltyp == OCI_HTYPE_SVCCTX) {
+        stub_svcctx *svc = (stub_svcctx *) trgthndlp;
+        switch (attrtype) {
+            case OCI_ATTR_SERVER:
+                *(void **) attributep = stub_server_of (svc);
+                return OCI_SUCCESS;
+            case OCI_ATTR_SESSION:
+                *(void **) attributep = stub_session_of (svc);
+                return OCI_SUCCESS;
+        }
+    }
+    else if (trghndltyp == OCI_HTYPE_SESSION
+            && attrtype == OCI_ATTR_TRANSACTION_IN_PROGRESS) {
+        *(boolean *) attributep = ((const stub_session *) trgthndlp)->txn
+            ? TRUE : FALSE;
+        return OCI_SUCCESS;
+    }
+    else if (trghndltyp == OCI_HTYPE_SPOOL) {
+        /* sessions are opened on demand */
+        const stub_spool *spool = (const stub_spool *) trgthndlp;
+        *(ub4 *) attributep = attrtype == OCI_ATTR_SPOOL_BUSY_COUNT
+            || attrtype == OCI_ATTR_SPOOL_OPEN_COUNT ? spool->busy : 0;
+        return OCI_SUCCESS;
+    }
+    else if (trghndltyp == OCI_HTYPE_DIRPATH_CTX
+            && attrtype == OCI_ATTR_LIST_COLUMNS) {
+        /* the parameters of the columns are read from the context */
+        *(const void **) attributep = trgthndlp;
+        return OCI_SUCCESS;
+    }
+    else if (trghndltyp == OCI_HTYPE_DIRPATH_COLUMN_ARRAY) {
+        const stub_dirpart *dpca = (const stub_dirpart *) trgthndlp;
+        switch (attrtype) {
+            case OCI_ATTR_NUM_ROWS:
+                *(ub4 *) attributep = STUB_LOADROWS;
+                return OCI_SUCCESS;
+            case OCI_ATTR_ROW_COUNT:
+                *(ub4 *) attributep = dpca->ctx->converted;
+                return OCI_SUCCESS;
+        }
+    }
+    return stub_fail (errhp, "attribute not supported by the stub");
+}
+
+
+/*
+** Sessions.
+*/
+
+static sword
+stub_svc (OCISvcCtx **svchp) {
+    stub_svcctx *svc = (stub_svcctx *) calloc (1, sizeof(stub_svcctx));
+    if (svc == NULL)
+        return OCI_ERROR;
+    svc->h.type = OCI_HTYPE_SVCCTX;
+    svc->own.h.type = OCI_HTYPE_SERVER;
+    svc->own_session.h.type = OCI_HTYPE_SESSION;
+    *svchp = (OCISvcCtx *) svc;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCILogon2 (OCIEnv *envhp, OCIError *errhp, OCISvcCtx **svchp,
+        const OraText *username, ub4 uname_len,
+        const OraText *password, ub4 passwd_len,
+        const OraText *dbname, ub4 dbname_len, ub4 mode) {
+    sword status;
+    (void) envhp; (void) username; (void) uname_len; (void) password;
+    (void) passwd_len; (void) dbname; (void) dbname_len; (void) mode;
+    pthread_once (&config_once, stub_configure);
+    if ((status = stub_roundtrip (NULL, errhp, config.connect)) != OCI_SUCCESS)
+        return status;
+    return stub_svc (svchp);
+}
+
+
+sword
+OCIServerAttach (OCIServer *srvhp, OCIError *errhp, const OraText *dblink,
+        sb4 dblink_len, ub4 mode) {
+    (void) dblink; (void) dblink_len; (void) mode;
+    pthread_once (&config_once, stub_configure);
+    return stub_roundtrip ((stub_server *) srvhp, errhp, config.connect / 2);
+}
+
+
+sword
+OCIServerDetach (OCIServer *srvhp, OCIError *errhp, ub4 mode) {
+    (void) srvhp; (void) errhp; (void) mode;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCISessionBegin (OCISvcCtx *svchp, OCIError *errhp, OCISession *usrhp,
+        ub4 credt, ub4 mode) {
+    (void) usrhp; (void) credt; (void) mode;
+    pthread_once (&config_once, stub_configure);
+    return stub_roundtrip (stub_server_of ((stub_svcctx *) svchp), errhp,
+        config.connect - config.connect / 2);
+}
+
+
+sword
+OCISessionEnd (OCISvcCtx *svchp, OCIError *errhp, OCISession *usrhp,
+        ub4 mode) {
+    (void) svchp; (void) errhp; (void) usrhp; (void) mode;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCISessionPoolCreate (OCIEnv *envhp, OCIError *errhp, OCISPool *spoolhp,
+        OraText **poolName, ub4 *poolNameLen, const OraText *connStr,
+        ub4 connStrLen, ub4 sessMin, ub4 sessMax, ub4 sessIncr,
+        OraText *userid, ub4 useridLen, OraText *password, ub4 passwordLen,
+        ub4 mode) {
+    stub_spool *spool = (stub_spool *) spoolhp;
+    (void) envhp; (void) errhp; (void) connStr;
+    (void) connStrLen; (void) sessMin; (void) sessIncr;
+    (void) userid; (void) useridLen; (void) password; (void) passwordLen;
+    (void) mode;
+    memcpy (spool->name, "stub", 5);
+    spool->max = sessMax;
+    *poolName = spool->name;
+    *poolNameLen = 4;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCISessionPoolDestroy (OCISPool *spoolhp, OCIError *errhp, ub4 mode) {
+    (void) spoolhp; (void) errhp; (void) mode;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCISessionGet (OCIEnv *envhp, OCIError *errhp, OCISvcCtx **svchp,
+        OCIAuthInfo *authhp, OraText *dbName, ub4 dbName_len,
+        const OraText *tagInfo, ub4 tagInfo_len, OraText **retTagInfo,
+        ub4 *retTagInfo_len, boolean *found, ub4 mode) {
+    /* the name returned by OCISessionPoolCreate locates the pool */
+    stub_spool *spool = (stub_spool *) (dbName - offsetof (stub_spool, name));
+    sword status;
+    (void) envhp; (void) authhp;
+    (void) dbName_len; (void) tagInfo; (void) tagInfo_len; (void) retTagInfo;
+    (void) retTagInfo_len; (void) mode;
+    if (found)
+        *found = FALSE;
+    /* a full pool fails instead of waiting for a session */
+    if (spool->busy >= spool->max)
+        return stub_error_code (errhp, 24496,
+            "OCISessionGet() timed out waiting for a free connection");
+    if ((status = stub_svc (svchp)) == OCI_SUCCESS) {
+        ((stub_svcctx *) *svchp)->spool = spool;
+        spool->busy++;
+    }
+    return status;
+}
+
+
+sword
+OCISessionRelease (OCISvcCtx *svchp, OCIError *errhp, OraText *tag,
+        ub4 tag_len, ub4 mode) {
+    stub_svcctx *svc = (stub_svcctx *) svchp;
+    (void) errhp; (void) tag; (void) tag_len; (void) mode;
+    if (svc->spool)
+        svc->spool->busy--;
+    free (svc);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCITransCommit (OCISvcCtx *svchp, OCIError *errhp, ub4 flags) {
+    sword status;
+    (void) flags;
+    status = stub_roundtrip (stub_server_of ((stub_svcctx *) svchp), errhp,
+        config.latency);
+    if (status == OCI_SUCCESS)
+        stub_session_of ((stub_svcctx *) svchp)->txn = 0;
+    return status;
+}
+
+
+sword
+OCITransRollback (OCISvcCtx *svchp, OCIError *errhp, ub4 flags) {
+    sword status;
+    (void) flags;
+    status = stub_roundtrip (stub_server_of ((stub_svcctx *) svchp), errhp,
+        config.latency);
+    if (status == OCI_SUCCESS)
+        stub_session_of ((stub_svcctx *) svchp)->txn = 0;
+    return status;
+}
+
+
+sword
+OCIBreak (void *hndlp, OCIError *errhp) {
+    (void) hndlp; (void) errhp;
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Abandon the pending roundtrip of a non-blocking call or an unfinished
+** LOB read.
+*/
+sword
+OCIReset (void *hndlp, OCIError *errhp) {
+    (void) errhp;
+    stub_server *srv = NULL;
+    if (((stub_handle *) hndlp)->type == OCI_HTYPE_SERVER)
+        srv = (stub_server *) hndlp;
+    else if (((stub_handle *) hndlp)->type == OCI_HTYPE_SVCCTX)
+        srv = stub_server_of ((stub_svcctx *) hndlp);
+    if (srv)
+        srv->until = srv->lobread = 0;
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Statements.
+*/
+
+sword
+OCIStmtPrepare2 (OCISvcCtx *svchp, OCIStmt **stmtp, OCIError *errhp,
+        const OraText *stmt, ub4 stmt_len, const OraText *key, ub4 key_len,
+        ub4 language, ub4 mode) {
+    stub_stmt *st = (stub_stmt *) calloc (1, sizeof(stub_stmt));
+    (void) key; (void) key_len; (void) language; (void) mode;
+
+    if (st == NULL)
+        return stub_fail (errhp, "out of memory");
+    st->h.type = OCI_HTYPE_STMT;
+    st->svc = (stub_svcctx *) svchp;
+    if (stmt_len == 11 && memcmp (stmt, "stub:loaded", 11) == 0) {
+        st->stmt_type = OCI_STMT_SELECT;
+        stub_describe_loaded (st);
+    }
+    else if ((stmt_len == 13 && memcmp (stmt, "stub:executes", 13) == 0)
+            || (stmt_len == 12 && memcmp (stmt, "stub:dropped", 12) == 0)
+            || (stmt_len == 14 && memcmp (stmt, "stub:snapshots", 14) == 0)) {
+        st->stmt_type = OCI_STMT_SELECT;
+        st->rows = 1;
+        st->ncols = 1;
+        st->cols[0].kind = stmt_len == 13 ? COL_EXECUTES
+            : stmt_len == 12 ? COL_DROPPED : COL_SNAPSHOTS;
+        st->cols[0].type = SQLT_NUM;
+        st->cols[0].size = 22;
+        strcpy (st->cols[0].name, "C1");
+    }
+    else if (stmt_len > 6 && memcmp (stmt, "bench:", 6) == 0) {
+        st->stmt_type = OCI_STMT_SELECT;
+        if (!stub_parse (st, (const char *) stmt, stmt_len)) {
+            free (st);
+            return stub_fail (errhp, "invalid description of a result set");
+        }
+    } else {
+        st->stmt_type = OCI_STMT_UPDATE;
+        st->fail = stmt_len == 9 && memcmp (stmt, "stub:fail", 9) == 0;
+    }
+    *stmtp = (OCIStmt *) st;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIStmtRelease (OCIStmt *stmtp, OCIError *errhp, const OraText *key,
+        ub4 key_len, ub4 mode) {
+    (void) errhp; (void) key; (void) key_len;
+    if (mode & OCI_STRLS_CACHE_DELETE)
+        __sync_fetch_and_add (&dropped, 1);
+    free (stmtp);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIStmtExecute (OCISvcCtx *svchp, OCIStmt *stmtp, OCIError *errhp,
+        ub4 iters, ub4 rowoff, const OCISnapshot *snap_in,
+        OCISnapshot *snap_out, ub4 mode) {
+    stub_stmt *st = (stub_stmt *) stmtp;
+    sword status;
+    (void) rowoff;
+
+    pthread_once (&config_once, stub_configure);
+    status = stub_roundtrip (stub_server_of ((stub_svcctx *) svchp), errhp,
+        config.latency);
+    if (status != OCI_SUCCESS)
+        return status;
+    if (st->fail)
+        return stub_fail (errhp, "the statement fails");
+    if (snap_in) {
+        if (!((const stub_desc *) snap_in)->taken)
+            return stub_fail (errhp, "snapshot without a read point");
+        __sync_fetch_and_add (&snapshots, 1);
+    }
+    if (snap_out)
+        ((stub_desc *) snap_out)->taken = 1;
+    if (st->stmt_type != OCI_STMT_SELECT) {
+        __sync_fetch_and_add (&executes, 1);
+        stub_session_of ((stub_svcctx *) svchp)->txn =
+            !(mode & OCI_COMMIT_ON_SUCCESS);
+    }
+    st->next = st->stmt_type == OCI_STMT_SELECT ? 0 : iters;
+    st->fetched = 0;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIParamGet (const void *hndlp, ub4 htype, OCIError *errhp, void **parmdpp,
+        ub4 pos) {
+    stub_stmt *st = (stub_stmt *) hndlp;
+    (void) htype;
+    if (st->h.type == OCI_HTYPE_DIRPATH_CTX)
+        /* the parameter of a loaded column is only set */
+        return OCIDescriptorAlloc (hndlp, parmdpp, OCI_DTYPE_PARAM, 0, NULL);
+    if (pos < 1 || pos > st->ncols)
+        return stub_fail (errhp, "invalid column position");
+    *parmdpp = &st->cols[pos - 1];
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDefineByPos (OCIStmt *stmtp, OCIDefine **defnp, OCIError *errhp,
+        ub4 position, void *valuep, sb4 value_sz, ub2 dty, void *indp,
+        ub2 *rlenp, ub2 *rcodep, ub4 mode) {
+    stub_stmt *st = (stub_stmt *) stmtp;
+    stub_define *def;
+    (void) rcodep; (void) mode;
+
+    if (position < 1 || position > st->ncols)
+        return stub_fail (errhp, "invalid column position");
+    def = &st->defs[position - 1];
+    def->buf = valuep;
+    def->size = value_sz;
+    def->dty = dty;
+    def->ind = (sb2 *) indp;
+    def->rlen = rlenp;
+    *defnp = (OCIDefine *) def;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIStmtFetch2 (OCIStmt *stmtp, OCIError *errhp, ub4 nrows, ub2 orientation,
+        sb4 scrollOffset, ub4 mode) {
+    stub_stmt *st = (stub_stmt *) stmtp;
+    uint64_t left = st->rows - st->next;
+    ub4 n = left < nrows ? (ub4) left : nrows, i, c;
+    sword status;
+    (void) orientation; (void) scrollOffset; (void) mode;
+
+    if (st->stmt_type != OCI_STMT_SELECT)
+        return stub_fail (errhp, "fetch out of sequence");
+    pthread_once (&config_once, stub_configure);
+    if ((status = stub_roundtrip (st->svc ? stub_server_of (st->svc) : NULL,
+            errhp, config.latency)) != OCI_SUCCESS)
+        return status;
+
+    for (c = 0; c < st->ncols; c++) {
+        if (st->defs[c].buf == NULL)
+            return stub_fail (errhp, "column not defined");
+        for (i = 0; i < n; i++)
+            if ((status = stub_value (errhp, &st->cols[c], &st->defs[c], i,
+                    st->next + i)) != OCI_SUCCESS)
+                return status;
+    }
+    st->next += n;
+    st->fetched = n;
+    return n < nrows ? OCI_NO_DATA : OCI_SUCCESS;
+}
+
+
+sword
+OCIStmtFetch (OCIStmt *stmtp, OCIError *errhp, ub4 nrows, ub2 orientation,
+        ub4 mode) {
+    return OCIStmtFetch2 (stmtp, errhp, nrows, orientation, 0, mode);
+}
+
+
+sword
+OCIBindByPos (OCIStmt *stmtp, OCIBind **bindp, OCIError *errhp,
+        ub4 position, void *valuep, sb4 value_sz, ub2 dty, void *indp,
+        ub2 *alenp, ub2 *rcodep, ub4 maxarr_len, ub4 *curelep, ub4 mode) {
+    (void) stmtp; (void) errhp; (void) position; (void) valuep;
+    (void) value_sz; (void) dty; (void) indp; (void) alenp; (void) rcodep;
+    (void) maxarr_len; (void) curelep; (void) mode;
+    *bindp = NULL;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIBindByName (OCIStmt *stmtp, OCIBind **bindp, OCIError *errhp,
+        const OraText *placeholder, sb4 placeh_len, void *valuep,
+        sb4 value_sz, ub2 dty, void *indp, ub2 *alenp, ub2 *rcodep,
+        ub4 maxarr_len, ub4 *curelep, ub4 mode) {
+    (void) stmtp; (void) valuep; (void) value_sz; (void) dty; (void) indp;
+    (void) alenp; (void) rcodep; (void) maxarr_len; (void) curelep;
+    (void) mode;
+    *bindp = NULL;
+    /* placeholders keep their leading colon */
+    if (placeh_len < 2 || placeholder[0] != ':')
+        return stub_error_code (errhp, 1036, "illegal variable name/number");
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Numbers, dates and LOBs.
+*/
+
+sword
+OCINumberIsInt (OCIError *err, const OCINumber *number, boolean *result) {
+    const ub1 *num = (const ub1 *) number;
+    int len = num[0], neg = num[1] < 0x80;
+    int e = len > 1 ? (neg ? 62 - num[1] : num[1] - 193) : 0;
+    int digits = len - 1 - (neg && num[len] == 102);
+    (void) err;
+    *result = len <= 1 || digits <= e + 1;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCINumberToInt (OCIError *err, const OCINumber *number, uword rsl_length,
+        uword rsl_flag, void *rsl) {
+    double v = stub_number_value ((const ub1 *) number);
+    if (rsl_length != sizeof(int64_t))
+        return stub_fail (err, "unsupported integer size");
+    if (rsl_flag == OCI_NUMBER_UNSIGNED) {
+        uint64_t u = (uint64_t) v;
+        memcpy (rsl, &u, sizeof(u));
+    } else {
+        int64_t i = (int64_t) v;
+        memcpy (rsl, &i, sizeof(i));
+    }
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCINumberToReal (OCIError *err, const OCINumber *number, uword rsl_length,
+        void *rsl) {
+    double v = stub_number_value ((const ub1 *) number);
+    if (rsl_length != sizeof(double))
+        return stub_fail (err, "unsupported real size");
+    memcpy (rsl, &v, sizeof(v));
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDateTimeConstruct (void *hndl, OCIError *err, OCIDateTime *datetime,
+        sb2 yr, ub1 mnth, ub1 dy, ub1 hr, ub1 mm, ub1 ss, ub4 fsec,
+        OraText *timezone, size_t timezone_length) {
+    stub_desc *dt = (stub_desc *) datetime;
+    (void) hndl; (void) err; (void) timezone; (void) timezone_length;
+    dt->year = yr;
+    dt->month = mnth;
+    dt->day = dy;
+    dt->hour = hr;
+    dt->min = mm;
+    dt->sec = ss;
+    dt->fsec = fsec;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDateTimeGetDate (void *hndl, OCIError *err, const OCIDateTime *date,
+        sb2 *yr, ub1 *mnth, ub1 *dy) {
+    const stub_desc *dt = (const stub_desc *) date;
+    (void) hndl; (void) err;
+    *yr = dt->year;
+    *mnth = dt->month;
+    *dy = dt->day;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDateTimeGetTime (void *hndl, OCIError *err, OCIDateTime *datetime,
+        ub1 *hr, ub1 *mm, ub1 *ss, ub4 *fsec) {
+    const stub_desc *dt = (const stub_desc *) datetime;
+    (void) hndl; (void) err;
+    *hr = dt->hour;
+    *mm = dt->min;
+    *ss = dt->sec;
+    *fsec = dt->fsec;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDateTimeGetTimeZoneOffset (void *hndl, OCIError *err,
+        const OCIDateTime *datetime, sb1 *hr, sb1 *mm) {
+    const stub_desc *dt = (const stub_desc *) datetime;
+    (void) hndl;
+    if (dt->type == OCI_DTYPE_TIMESTAMP)
+        return stub_fail (err, "the value has no time zone");
+    *hr = dt->tz_hour;
+    *mm = dt->tz_min;
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Read a LOB in polling mode: the first piece restarts the read, the
+** call returns OCI_NEED_DATA while bytes remain.
+*/
+sword
+OCILobRead2 (OCISvcCtx *svchp, OCIError *errhp, OCILobLocator *locp,
+        oraub8 *byte_amtp, oraub8 *char_amtp, oraub8 offset, void *bufp,
+        oraub8 bufl, ub1 piece, void *ctxp, OCICallbackLobRead2 cbfp,
+        ub2 csid, ub1 csfrm) {
+    stub_desc *lob = (stub_desc *) locp;
+    oraub8 n, i;
+    (void) errhp; (void) offset; (void) ctxp; (void) cbfp;
+    (void) csid; (void) csfrm;
+
+    if (piece == OCI_FIRST_PIECE || piece == OCI_ONE_PIECE)
+        lob->pos = 0;
+    n = lob->len - lob->pos;
+    if (n > bufl)
+        n = bufl;
+    for (i = 0; i < n; i++)
+        ((char *) bufp)[i] = (char) ('a' + (lob->seed + lob->pos + i) % 26);
+    lob->pos += (ub4) n;
+    *byte_amtp = n;
+    if (char_amtp)
+        *char_amtp = n;
+    /* other calls fail until the last piece is read */
+    stub_server_of ((stub_svcctx *) svchp)->lobread = lob->pos < lob->len;
+    return lob->pos < lob->len ? OCI_NEED_DATA : OCI_SUCCESS;
+}
+
+
+sword
+OCILobLocatorAssign (OCISvcCtx *svchp, OCIError *errhp,
+        const OCILobLocator *src_locp, OCILobLocator **dst_locpp) {
+    (void) svchp; (void) errhp;
+    memcpy (*dst_locpp, src_locp, sizeof(stub_desc));
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Direct path loads.
+*/
+
+sword
+OCIDirPathPrepare (OCIDirPathCtx *dpctx, OCISvcCtx *svchp, OCIError *errhp) {
+    stub_dirpath *ctx = (stub_dirpath *) dpctx;
+    (void) svchp;
+    if (ctx->ncols == 0 || ctx->ncols > STUB_MAXCOLS)
+        return stub_fail (errhp, "invalid number of columns");
+    ctx->array = (char **) calloc (STUB_LOADROWS * ctx->ncols, sizeof(char *));
+    return ctx->array ? OCI_SUCCESS : stub_fail (errhp, "out of memory");
+}
+
+
+sword
+OCIDirPathColArrayEntrySet (OCIDirPathColArray *dpca, OCIError *errhp,
+        ub4 rownum, ub2 colIdx, ub1 *cvalp, ub4 clen, ub1 cflg) {
+    stub_dirpath *ctx = ((stub_dirpart *) dpca)->ctx;
+    char **v;
+
+    if (rownum >= STUB_LOADROWS || colIdx >= ctx->ncols)
+        return stub_fail (errhp, "invalid column array entry");
+    v = &ctx->array[rownum * ctx->ncols + colIdx];
+    free (*v);
+    *v = NULL;
+    if (cflg == OCI_DIRPATH_COL_NULL)
+        return OCI_SUCCESS;
+    if ((*v = (char *) malloc (clen + 1)) == NULL)
+        return stub_fail (errhp, "out of memory");
+    memcpy (*v, cvalp, clen);
+    (*v)[clen] = 0;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDirPathColArrayReset (OCIDirPathColArray *dpca, OCIError *errhp) {
+    stub_dirpath *ctx = ((stub_dirpart *) dpca)->ctx;
+    ub4 i;
+    (void) errhp;
+    for (i = 0; i < STUB_LOADROWS * ctx->ncols; i++) {
+        free (ctx->array[i]);
+        ctx->array[i] = NULL;
+    }
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Move rows rowoff to rowcnt of the column array to the stream.
+*/
+sword
+OCIDirPathColArrayToStream (OCIDirPathColArray *dpca,
+        const OCIDirPathCtx *dpctx, OCIDirPathStream *dpstr, OCIError *errhp,
+        ub4 rowcnt, ub4 rowoff) {
+    stub_dirpath *ctx = ((stub_dirpart *) dpca)->ctx;
+    char *values[STUB_LOADROWS * STUB_MAXCOLS];
+    ub4 n = rowcnt > rowoff ? rowcnt - rowoff : 0, i;
+    (void) dpctx; (void) dpstr;
+
+    if (rowcnt > STUB_LOADROWS)
+        return stub_fail (errhp, "invalid row count");
+    for (i = 0; i < n * ctx->ncols; i++) {
+        values[i] = ctx->array[rowoff * ctx->ncols + i];
+        ctx->array[rowoff * ctx->ncols + i] = NULL;
+    }
+    if (!stub_rows_append (&ctx->stream, ctx->ncols, values, n))
+        return stub_fail (errhp, "out of memory");
+    ctx->converted = n;
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDirPathStreamReset (OCIDirPathStream *dpstr, OCIError *errhp) {
+    (void) errhp;
+    stub_rows_free (&((stub_dirpart *) dpstr)->ctx->stream);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDirPathLoadStream (OCIDirPathCtx *dpctx, OCIDirPathStream *dpstr,
+        OCIError *errhp) {
+    stub_dirpath *ctx = (stub_dirpath *) dpctx;
+    stub_rows *stream = &((stub_dirpart *) dpstr)->ctx->stream;
+    sword status;
+
+    pthread_once (&config_once, stub_configure);
+    if ((status = stub_roundtrip (NULL, errhp, config.latency)) != OCI_SUCCESS)
+        return status;
+    if (!stub_rows_append (&ctx->loaded, ctx->ncols, stream->values, stream->nrows))
+        return stub_fail (errhp, "out of memory");
+    /* the values belong to the loaded rows now */
+    free (stream->values);
+    stream->values = NULL;
+    stream->nrows = 0;
+    return OCI_SUCCESS;
+}
+
+
+/*
+** The loaded rows replace those of the previous load.
+*/
+sword
+OCIDirPathFinish (OCIDirPathCtx *dpctx, OCIError *errhp) {
+    stub_dirpath *ctx = (stub_dirpath *) dpctx;
+    stub_rows old;
+    (void) errhp;
+    pthread_mutex_lock (&loaded_lock);
+    old = loaded;
+    loaded = ctx->loaded;
+    loaded.ncols = ctx->ncols;
+    pthread_mutex_unlock (&loaded_lock);
+    memset (&ctx->loaded, 0, sizeof(stub_rows));
+    stub_rows_free (&old);
+    return OCI_SUCCESS;
+}
+
+
+sword
+OCIDirPathAbort (OCIDirPathCtx *dpctx, OCIError *errhp) {
+    (void) errhp;
+    stub_rows_free (&((stub_dirpath *) dpctx)->loaded);
+    return OCI_SUCCESS;
+}
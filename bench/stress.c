@@ -0,0 +1,401 @@
+/*
+** Concurrency stress harness of the Oracle driver, on the stub client
+** library of bench/oci_stub.c.
+** Every worker thread runs bench/stress.lua in its own Lua state: a
+** loop over many connections opened by env:connect_async and driven
+** by polling through queries, fetches, DML and commits. At the end the
+** latencies of all workers are merged into percentiles, with the error
+** count, the peak of the process threads and the lock contention of the
+** worker pools of the environments.
+**
+**   stress [-w workers] [-c connections] [-d seconds] [-r rows]
+**          [-p poll_us] [-t] [script]
+**
+** -t runs the calls of the connections on worker threads instead of in
+** OCI non-blocking mode. Latency and failures of the stub are set by
+** the OCI_STUB_* variables, see bench/oci_stub.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
+int
+luaopen_luasql_oci8 (lua_State *L);
+
+/* latencies measured by the script, microseconds */
+static const char *const kinds[] = {
+    "connect", "execute", "fetch", "dml", "commit", "transaction", NULL
+};
+#define NKINDS (sizeof(kinds) / sizeof(kinds[0]) - 1)
+
+/* counters of the worker pools */
+static const char *const counters[] = {
+    "jobs", "locks", "contended", "waited", NULL
+};
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]) - 1)
+
+typedef struct {
+    double       *v;
+    size_t        n;
+    size_t        size;
+} samples;
+
+typedef struct {
+    pthread_t     thread;
+    int           id;
+    int           failed;
+    char          errmsg[512];
+    samples       lat[NKINDS];
+    double        transactions;
+    double        errors;
+    double        polls;
+    double        pools[2][NCOUNTERS];   /* workers, connectors */
+} worker;
+
+static struct {
+    int           workers;
+    int           connections;
+    double        duration;
+    int           rows;
+    int           poll;
+    int           threaded;
+    const char   *script;
+} opts = { 4, 32, 10, 10, 200, 0, "bench/stress.lua" };
+
+static int running;
+
+
+static uint64_t
+now_us (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+/*
+** clock () returns the monotonic time in microseconds.
+*/
+static int
+l_clock (lua_State *L) {
+    lua_pushnumber (L, (lua_Number) now_us ());
+    return 1;
+}
+
+
+/*
+** sleep (us) suspends the calling worker.
+*/
+static int
+l_sleep (lua_State *L) {
+    lua_Number us = luaL_checknumber (L, 1);
+    if (us > 0)
+        usleep ((useconds_t) us);
+    return 0;
+}
+
+
+static int
+samples_add (samples *s, double v) {
+    if (s->n == s->size) {
+        size_t size = s->size ? s->size * 2 : 1024;
+        double *p = (double *) realloc (s->v, size * sizeof(double));
+        if (p == NULL)
+            return -1;
+        s->v = p;
+        s->size = size;
+    }
+    s->v[s->n++] = v;
+    return 0;
+}
+
+
+/*
+** Append the array of numbers at index idx to s.
+*/
+static int
+samples_read (lua_State *L, int idx, samples *s) {
+    size_t i, n;
+    if (!lua_istable (L, idx))
+        return 0;
+    n = lua_rawlen (L, idx);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti (L, idx, (int) i);
+        if (samples_add (s, lua_tonumber (L, -1)) < 0)
+            return -1;
+        lua_pop (L, 1);
+    }
+    return 0;
+}
+
+
+static double
+getnumber (lua_State *L, int idx, const char *name) {
+    double v;
+    lua_getfield (L, idx, name);
+    v = lua_tonumber (L, -1);
+    lua_pop (L, 1);
+    return v;
+}
+
+
+/*
+** Copy the result table of the script at the top of the stack.
+*/
+static void
+worker_collect (lua_State *L, worker *w) {
+    int res = lua_gettop (L), pool;
+    size_t k;
+
+    lua_getfield (L, res, "latency");
+    for (k = 0; k < NKINDS; k++) {
+        lua_getfield (L, -1, kinds[k]);
+        if (samples_read (L, lua_gettop (L), &w->lat[k]) < 0) {
+            w->failed = 1;
+            snprintf (w->errmsg, sizeof(w->errmsg), "out of memory");
+        }
+        lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+
+    w->transactions = getnumber (L, res, "transactions");
+    w->errors = getnumber (L, res, "errors");
+    w->polls = getnumber (L, res, "polls");
+
+    lua_getfield (L, res, "pools");
+    for (pool = 0; pool < 2 && lua_istable (L, -1); pool++) {
+        lua_getfield (L, -1, pool ? "connectors" : "workers");
+        if (lua_istable (L, -1))
+            for (k = 0; k < NCOUNTERS; k++)
+                w->pools[pool][k] = getnumber (L, -1, counters[k]);
+        lua_pop (L, 1);
+    }
+    lua_pop (L, 1);
+}
+
+
+static void *
+worker_main (void *arg) {
+    worker *w = (worker *) arg;
+    lua_State *L = luaL_newstate ();
+
+    if (L == NULL) {
+        w->failed = 1;
+        snprintf (w->errmsg, sizeof(w->errmsg), "cannot create Lua state");
+        __atomic_sub_fetch (&running, 1, __ATOMIC_SEQ_CST);
+        return NULL;
+    }
+    luaL_openlibs (L);
+
+    /* require "luasql.oci8" resolves to the linked driver */
+    lua_getglobal (L, "package");
+    lua_getfield (L, -1, "preload");
+    lua_pushcfunction (L, luaopen_luasql_oci8);
+    lua_setfield (L, -2, "luasql.oci8");
+    lua_pop (L, 2);
+    lua_pushcfunction (L, l_clock);
+    lua_setglobal (L, "clock");
+    lua_pushcfunction (L, l_sleep);
+    lua_setglobal (L, "sleep");
+
+    if (luaL_loadfile (L, opts.script) != 0 || lua_pcall (L, 0, 1, 0) != 0)
+        goto fail;
+
+    lua_newtable (L);
+    lua_pushinteger (L, w->id);
+    lua_setfield (L, -2, "worker");
+    lua_pushinteger (L, opts.connections);
+    lua_setfield (L, -2, "connections");
+    lua_pushnumber (L, opts.duration);
+    lua_setfield (L, -2, "duration");
+    lua_pushinteger (L, opts.rows);
+    lua_setfield (L, -2, "rows");
+    lua_pushinteger (L, opts.poll);
+    lua_setfield (L, -2, "poll");
+    lua_pushboolean (L, opts.threaded);
+    lua_setfield (L, -2, "threaded");
+    if (lua_pcall (L, 1, 1, 0) != 0)
+        goto fail;
+    if (!lua_istable (L, -1)) {
+        lua_pushliteral (L, "script returned no results");
+        goto fail;
+    }
+    worker_collect (L, w);
+    lua_close (L);
+    __atomic_sub_fetch (&running, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+
+fail:
+    w->failed = 1;
+    snprintf (w->errmsg, sizeof(w->errmsg), "%s", lua_tostring (L, -1));
+    lua_close (L);
+    __atomic_sub_fetch (&running, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+
+/*
+** Number of threads of the process, from /proc.
+*/
+static int
+process_threads (void) {
+    char line[256];
+    int n = 0;
+    FILE *f = fopen ("/proc/self/status", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets (line, sizeof(line), f) != NULL)
+        if (strncmp (line, "Threads:", 8) == 0) {
+            n = atoi (line + 8);
+            break;
+        }
+    fclose (f);
+    return n;
+}
+
+
+static int
+compare (const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+
+static double
+percentile (const samples *s, double p) {
+    size_t i = (size_t) (p * (double) s->n);
+    if (i >= s->n)
+        i = s->n - 1;
+    return s->v[i];
+}
+
+
+static void
+usage (const char *prog) {
+    fprintf (stderr, "usage: %s [-w workers] [-c connections] [-d seconds] "
+        "[-r rows] [-p poll_us] [-t] [script]\n", prog);
+    exit (2);
+}
+
+
+int
+main (int argc, char **argv) {
+    worker *ws;
+    samples all[NKINDS];
+    double transactions = 0, errors = 0, polls = 0;
+    double pools[2][NCOUNTERS];
+    uint64_t start;
+    double elapsed;
+    int i, opt, peak = 0, failed = 0;
+    size_t k;
+
+    while ((opt = getopt (argc, argv, "w:c:d:r:p:th")) != -1) {
+        switch (opt) {
+            case 'w': opts.workers = atoi (optarg); break;
+            case 'c': opts.connections = atoi (optarg); break;
+            case 'd': opts.duration = atof (optarg); break;
+            case 'r': opts.rows = atoi (optarg); break;
+            case 'p': opts.poll = atoi (optarg); break;
+            case 't': opts.threaded = 1; break;
+            default: usage (argv[0]);
+        }
+    }
+    if (optind < argc)
+        opts.script = argv[optind];
+    if (opts.workers < 1 || opts.connections < 1 || opts.duration <= 0)
+        usage (argv[0]);
+
+    ws = (worker *) calloc ((size_t) opts.workers, sizeof(worker));
+    if (ws == NULL) {
+        fprintf (stderr, "out of memory\n");
+        return 1;
+    }
+
+    printf ("%d workers x %d connections, %.0f s, %d rows, %s\n",
+        opts.workers, opts.connections, opts.duration, opts.rows,
+        opts.threaded ? "threaded" : "non-blocking");
+    fflush (stdout);
+
+    running = opts.workers;
+    start = now_us ();
+    for (i = 0; i < opts.workers; i++) {
+        ws[i].id = i + 1;
+        if (pthread_create (&ws[i].thread, NULL, worker_main, &ws[i]) != 0) {
+            fprintf (stderr, "cannot create worker %d\n", i + 1);
+            return 1;
+        }
+    }
+
+    /* sample the thread count while the workers run */
+    while (__atomic_load_n (&running, __ATOMIC_SEQ_CST) > 0) {
+        int n = process_threads ();
+        if (n > peak)
+            peak = n;
+        usleep (10000);
+    }
+    for (i = 0; i < opts.workers; i++)
+        pthread_join (ws[i].thread, NULL);
+    elapsed = (double) (now_us () - start) / 1e6;
+
+    memset (all, 0, sizeof(all));
+    memset (pools, 0, sizeof(pools));
+    for (i = 0; i < opts.workers; i++) {
+        worker *w = &ws[i];
+        if (w->failed) {
+            fprintf (stderr, "worker %d: %s\n", w->id, w->errmsg);
+            failed++;
+        }
+        for (k = 0; k < NKINDS; k++) {
+            size_t j;
+            for (j = 0; j < w->lat[k].n; j++)
+                samples_add (&all[k], w->lat[k].v[j]);
+            free (w->lat[k].v);
+        }
+        transactions += w->transactions;
+        errors += w->errors;
+        polls += w->polls;
+        for (k = 0; k < NCOUNTERS; k++) {
+            pools[0][k] += w->pools[0][k];
+            pools[1][k] += w->pools[1][k];
+        }
+    }
+    free (ws);
+
+    printf ("%-12s %10s %10s %10s %10s %10s %10s %10s\n", "latency, us",
+        "count", "per s", "p50", "p90", "p99", "p99.9", "max");
+    for (k = 0; k < NKINDS; k++) {
+        samples *s = &all[k];
+        if (s->n == 0)
+            continue;
+        qsort (s->v, s->n, sizeof(double), compare);
+        printf ("%-12s %10zu %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+            kinds[k], s->n, (double) s->n / elapsed, percentile (s, 0.5),
+            percentile (s, 0.9), percentile (s, 0.99), percentile (s, 0.999),
+            s->v[s->n - 1]);
+        free (s->v);
+    }
+    printf ("transactions %.0f (%.0f/s), errors %.0f, polls %.0f\n",
+        transactions, transactions / elapsed, errors, polls);
+    printf ("peak threads %d\n", peak);
+    for (i = 0; i < 2; i++)
+        printf ("%-10s jobs %.0f, locks %.0f, contended %.0f (%.2f%%), "
+            "waited %.0f us\n", i ? "connectors" : "workers", pools[i][0],
+            pools[i][1], pools[i][2],
+            pools[i][1] > 0 ? 100 * pools[i][2] / pools[i][1] : 0.0,
+            pools[i][3]);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+--
+-- Stress loop of one worker of bench/stress.c.
+-- Opens cfg.connections connections with env:connect_async and drives
+-- them all from one loop by polling: every connection repeats a query,
+-- fetches its rows, runs a DML statement and commits, for cfg.duration
+-- seconds. A failed call closes the connection, which is then opened
+-- again. Return the latencies of the steps in microseconds, the
+-- counters of the run and env:workerstats().
+--
+
+local driver = require "luasql.oci8"
+local STILL = require "oci".OCI_STILL_EXECUTING
+
+local QUERY = "bench:%d:int,varchar(20)"
+local DML = "update stress set n = n + 1"
+
+return function (cfg)
+    local env = assert (driver.oci8 ())
+    local query = QUERY:format (cfg.rows)
+    local opts = { threaded = cfg.threaded }
+    local latency = {
+        connect = {}, execute = {}, fetch = {}, dml = {}, commit = {},
+        transaction = {},
+    }
+    local res = { latency = latency, transactions = 0, errors = 0, polls = 0 }
+
+    local function record (kind, t0)
+        local l = latency[kind]
+        l[#l + 1] = clock () - t0
+    end
+
+    -- one step of a slot: return true when it made progress
+    local steps = {}
+
+    function steps.connect (s)
+        local conn, status
+        if s.conn then
+            conn, status = env:connect_async ("bench", "bench", "bench", s.conn)
+        else
+            s.t0 = clock ()
+            conn, status = env:connect_async ("bench", "bench", "bench", opts)
+        end
+        s.conn = conn
+        if status == STILL then
+            return false
+        end
+        record ("connect", s.t0)
+        s.state = "query"
+        return true
+    end
+
+    function steps.query (s)
+        local cur, status
+        if s.handle then
+            cur, status = s.conn:execute (query, s.handle)
+        else
+            s.t0 = clock ()
+            s.txn = s.t0
+            cur, status = s.conn:execute (query)
+        end
+        if status == STILL then
+            s.handle = cur
+            return false
+        end
+        s.handle = nil
+        record ("execute", s.t0)
+        s.cur = cur
+        s.t0 = clock ()
+        s.state = "fetch"
+        return true
+    end
+
+    function steps.fetch (s)
+        local id, status = s.cur:fetch ()
+        if id == nil and status == STILL then
+            return false
+        end
+        if id == nil then
+            -- the driver closes the cursor at the end of the rows
+            s.cur = nil
+            record ("fetch", s.t0)
+            s.t0 = clock ()
+            s.state = "dml"
+        end
+        return true
+    end
+
+    function steps.dml (s)
+        local n, status
+        if s.handle then
+            n, status = s.conn:execute (DML, s.handle)
+        else
+            n, status = s.conn:execute (DML)
+        end
+        if status == STILL then
+            s.handle = n
+            return false
+        end
+        s.handle = nil
+        record ("dml", s.t0)
+        s.t0 = clock ()
+        s.state = "commit"
+        return true
+    end
+
+    function steps.commit (s)
+        local ok, status = s.conn:commit ()
+        if ok == nil and status == STILL then
+            return false
+        end
+        record ("commit", s.t0)
+        record ("transaction", s.txn)
+        res.transactions = res.transactions + 1
+        s.state = "query"
+        return true
+    end
+
+    -- drop the connection of a failed slot, it is opened again
+    local function reset (s)
+        if s.cur then
+            pcall (s.cur.close, s.cur)
+        end
+        if s.conn then
+            pcall (s.conn.close, s.conn)
+        end
+        s.conn, s.cur, s.handle = nil, nil, nil
+        s.state = "connect"
+    end
+
+    local slots = {}
+    for i = 1, cfg.connections do
+        slots[i] = { state = "connect" }
+    end
+
+    local stop = clock () + cfg.duration * 1e6
+    local active = #slots
+    while active > 0 do
+        local progress = false
+        local stopping = clock () >= stop
+        active = 0
+        for _, s in ipairs (slots) do
+            -- after the deadline, slots between transactions are closed
+            if stopping and s.state == "query" and not s.handle then
+                reset (s)
+                s.state = "done"
+            end
+            if s.state ~= "done" then
+                active = active + 1
+                local ok, moved = pcall (steps[s.state], s)
+                if not ok then
+                    res.errors = res.errors + 1
+                    reset (s)
+                    if stopping then
+                        s.state = "done"
+                    end
+                    moved = true
+                end
+                if moved then
+                    progress = true
+                else
+                    res.polls = res.polls + 1
+                end
+            end
+        end
+        if not progress and active > 0 then
+            sleep (cfg.poll)
+        end
+    end
+
+    res.pools = env:workerstats ()
+    env:close ()
+    return res
+end
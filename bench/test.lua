@@ -0,0 +1,513 @@
+--
+-- Regression checks of the driver on the stub library of
+-- bench/oci_stub.c, which serves synthetic result sets from memory.
+-- Run by `make test`; exits with a failure status if a check fails.
+--
+
+local driver = require "luasql.oci8"
+local STILL = require "oci".OCI_STILL_EXECUTING
+
+local failures, count = 0, 0
+
+local function check (name, fn)
+    count = count + 1
+    local ok, err = pcall (fn)
+    if ok then
+        print ("ok      " .. name)
+    else
+        failures = failures + 1
+        print ("FAILED  " .. name .. ": " .. tostring (err))
+    end
+end
+
+local function eq (got, want, what)
+    if got ~= want then
+        error (string.format ("%s: got %s, expected %s", what,
+            tostring (got), tostring (want)), 2)
+    end
+end
+
+local function readfile (path)
+    local f = assert (io.open (path, "rb"))
+    local s = f:read "*a"
+    f:close ()
+    return s
+end
+
+local function writefile (path, s)
+    local f = assert (io.open (path, "wb"))
+    f:write (s)
+    f:close ()
+end
+
+-- values of the synthetic columns at row r, see stub_value
+local function int_value (r)
+    local m = (r * 2654435761) % 1000000000000
+    if r % 5 == 3 then
+        m = -m
+    end
+    return m
+end
+
+local function number_cents (r)
+    local m = (r * 37) % 100000000 - 5000000
+    if r % 5 == 3 then
+        m = -m
+    end
+    return m
+end
+
+-- exact decimal text of cents / 100
+local function cents_text (m)
+    local sign = m < 0 and "-" or ""
+    local a = math.abs (m)
+    local frac = a % 100
+    local text = sign .. string.format ("%d", (a - frac) / 100)
+    if frac ~= 0 then
+        text = text .. ("." .. string.format ("%02d", frac)):gsub ("0$", "")
+    end
+    return text
+end
+
+local env = assert (driver.oci8 { cache = true })
+local conn = assert (env:connect ("test", "test", "test"))
+
+check ("NUMBER text of exported values", function ()
+    local path = os.tmpname ()
+    local rows = 500
+    local cur = assert (conn:execute ("bench:" .. rows .. ":int,number?"))
+    local n = cur:export (path, { header = false })
+    eq (n, rows, "exported rows")
+    local r = 0
+    for line in readfile (path):gmatch "([^\r\n]*)\r\n" do
+        local a, b = line:match "^([^,]*),([^,]*)$"
+        eq (a, string.format ("%d", int_value (r)), "int of row " .. r)
+        eq (b, r % 7 == 6 and "" or cents_text (number_cents (r)),
+            "number of row " .. r)
+        r = r + 1
+    end
+    eq (r, rows, "lines")
+    os.remove (path)
+end)
+
+check ("cached result replays the fetched rows", function ()
+    local sql = "bench:250:int,varchar(20),number?,raw(8)?,date"
+    local function fetchall ()
+        local cur = assert (conn:execute (sql, { cache = true }))
+        local rows = {}
+        local row = cur:fetch ({}, "n")
+        while row do
+            rows[#rows + 1] = { row[1], row[2], row[3], row[4],
+                row[5] and row[5].year, row[5] and row[5].sec }
+            row = cur:fetch ({}, "n")
+        end
+        return rows
+    end
+    local before = env:cachestats ()
+    local first = fetchall ()
+    local second = fetchall ()
+    local after = env:cachestats ()
+    eq (after.misses - before.misses, 1, "misses")
+    eq (after.hits - before.hits, 1, "hits")
+    eq (#second, #first, "rows")
+    eq (#first, 250, "rows")
+    for i = 1, #first do
+        for j = 1, 6 do
+            eq (second[i][j], first[i][j], "row " .. i .. ", column " .. j)
+        end
+    end
+end)
+
+check ("cache keys collapse white space outside literals", function ()
+    local before = env:cachestats ()
+    local cur = assert (conn:execute ("bench:3:int", { cache = true }))
+    while cur:fetch () do end
+    cur = assert (conn:execute ("  bench:3:int  ", { cache = true }))
+    while cur:fetch () do end
+    local after = env:cachestats ()
+    eq (after.hits - before.hits, 1, "hits")
+end)
+
+check ("cache keys tell users apart", function ()
+    local other = assert (env:connect ("test", "other", "test"))
+    local before = env:cachestats ()
+    local cur = assert (conn:execute ("bench:4:int", { cache = true }))
+    while cur:fetch () do end
+    cur = assert (other:execute ("bench:4:int", { cache = true }))
+    while cur:fetch () do end
+    local after = env:cachestats ()
+    other:close ()
+    eq (after.misses - before.misses, 2, "misses")
+    eq (after.hits - before.hits, 0, "hits")
+end)
+
+check ("results are not cached inside a transaction", function ()
+    local cur = assert (conn:execute ("bench:5:int", { cache = true }))
+    while cur:fetch () do end
+    conn:setautocommit (false)
+    eq (conn:execute "update t set a = 1", 1, "rows of the update")
+    local before = env:cachestats ()
+    cur = assert (conn:execute ("bench:5:int", { cache = true }))
+    while cur:fetch () do end
+    local after = env:cachestats ()
+    conn:rollback ()
+    conn:setautocommit (true)
+    eq (after.hits - before.hits, 0, "hits")
+    eq (after.misses - before.misses, 0, "misses")
+end)
+
+check ("LONG RAW values longer than longsize fail the fetch", function ()
+    local lconn = assert (env:connect ("test", "test", "test",
+        { longsize = 50 }))
+    local cur = assert (lconn:execute "bench:100:longraw(80)")
+    local ok, err = pcall (cur.fetch, cur)
+    local again = pcall (cur.fetch, cur)
+    cur:close ()
+    cur = assert (lconn:execute "bench:100:longraw(50)")
+    local rows = 0
+    while cur:fetch () do
+        rows = rows + 1
+    end
+    lconn:close ()
+    eq (ok, false, "status")
+    assert (tostring (err):find ("column c1 is longer than longsize", 1, true),
+        err)
+    eq (again, false, "status of the next fetch")
+    eq (rows, 100, "rows up to longsize")
+end)
+
+check ("time zones of timestamps", function ()
+    local sql = "bench:10:timestamp,timestamptz,timestampltz"
+    local cur = assert (conn:execute (sql))
+    cur:setdateformat "epoch"
+    local r = 0
+    local row = cur:fetch ({}, "n")
+    while row do
+        local h = r % 5 - 2
+        local m = r % 2 == 1 and (h < 0 and -30 or 30) or 0
+        eq (row[2], row[1] - h * 3600 - m * 60, "epoch with time zone, row " .. r)
+        eq (row[3], row[1] - 3600, "epoch with local time zone, row " .. r)
+        r = r + 1
+        row = cur:fetch ({}, "n")
+    end
+    eq (r, 10, "rows")
+
+    cur = assert (conn:execute (sql))
+    cur:setdateformat "iso"
+    for _ = 0, 3 do
+        row = cur:fetch ({}, "n")
+    end
+    eq (row[2], "1993-04-04T03:03:00.003000000+01:30", "iso with time zone")
+    eq (row[3], "1993-04-04T03:03:00.003000000+01:00", "iso with local time zone")
+    cur:setdateformat "table"
+    row = cur:fetch ({}, "n")
+    cur:close ()
+    eq (row[1].tz_hour, nil, "time zone of a timestamp")
+    eq (row[2].tz_hour, 2, "tz_hour")
+    eq (row[2].tz_min, 0, "tz_min")
+end)
+
+check ("invalid options name their field", function ()
+    local ok, err = pcall (env.connect, env, "test", "test", "test",
+        { datetime = "julian" })
+    eq (ok, false, "status")
+    assert (tostring (err):find ("'julian' for field 'datetime'", 1, true), err)
+end)
+
+check ("LOB readers reach the rows of the batch", function ()
+    local lconn = assert (env:connect ("test", "test", "test"))
+    local cur = assert (lconn:execute "bench:10:int,clob(20)")
+    local row = cur:fetch ({}, "n")
+    local first = cur:lob (2, 8)
+    local third = cur:lob (2, 8, 3)
+    local a = first ()
+    local c = third ()
+    local bad = pcall (cur.lob, cur, 2, 8, 11)
+    cur:close ()
+    -- the unfinished readers do not keep the connection open
+    local closed = lconn:close ()
+    local again = first:close ()
+    eq (row[1], int_value (0), "first row")
+    eq (a, "abcdefgh", "chunk of the first row")
+    eq (c, "cdefghij", "chunk of the third row")
+    eq (bad, false, "status of a row out of the batch")
+    eq (closed, true, "close of the connection")
+    eq (again, false, "close of a detached reader")
+end)
+
+check ("executemany binds named placeholders", function ()
+    local n, errors = conn:executemany ("insert into t values (:a, :b)",
+        { { a = 1, b = "x" }, { a = 2, b = "y" } })
+    eq (n, 2, "rows")
+    eq (#errors, 0, "failed rows")
+end)
+
+check ("executemany is traced", function ()
+    local tenv = assert (driver.oci8 { trace = 64 })
+    local tconn = assert (tenv:connect ("test", "test", "test"))
+    tconn:executemany ("insert into t values (:1)", { { 1 }, { 2 } })
+    local trace = tenv:trace ()
+    tconn:close ()
+    tenv:close ()
+    assert (trace:find ('"OCIStmtExecute"', 1, true), trace)
+end)
+
+check ("failed statements leave the statement cache", function ()
+    local function dropped ()
+        local cur = assert (conn:execute "stub:dropped")
+        local n = cur:fetch ()
+        cur:close ()
+        return n
+    end
+    local before = dropped ()
+    local ok = pcall (conn.execute, conn, "stub:fail")
+    eq (ok, false, "status of execute")
+    ok = pcall (conn.executemany, conn, "stub:fail", { { 1 } })
+    eq (ok, false, "status of executemany")
+    local stmt = assert (conn:prepare "stub:fail")
+    ok = pcall (stmt.execute, stmt)
+    stmt:close ()
+    eq (ok, false, "status of a prepared statement")
+    eq (conn:execute "update t set a = 1", 1, "rows of the update")
+    eq (dropped () - before, 3, "dropped statements")
+end)
+
+check ("parallel queries merge the ranges at one read point", function ()
+    local pool = assert (env:pool ("test", "test", "test", { min = 1, max = 4 }))
+    local function snapshots ()
+        local cur = assert (conn:execute "stub:snapshots")
+        local n = cur:fetch ()
+        cur:close ()
+        return n
+    end
+    local before = snapshots ()
+    local pq = assert (env:parallel_query ("bench:50:int", { pool = pool,
+        sessions = 3, split = { { 1, 10 }, { 11, 20 }, { 21, 30 }, { 31, 40 } } }))
+    local rows = 0
+    for batch in function () return pq:fetch () end do
+        rows = rows + #batch
+    end
+    eq (rows, 200, "merged rows")
+    eq (snapshots () - before, 3, "executes at the read point")
+    pool:close ()
+end)
+
+check ("parallel queries take only the free sessions of the pool", function ()
+    local pool = assert (env:pool ("test", "test", "test", { min = 1, max = 2 }))
+    local held = assert (pool:acquire ())
+    local pq = assert (env:parallel_query ("bench:20:int", { pool = pool,
+        sessions = 4, split = { { 1, 10 }, { 11, 20 } } }))
+    local rows = 0
+    for batch in function () return pq:fetch () end do
+        rows = rows + #batch
+    end
+    eq (rows, 40, "merged rows")
+    local other = assert (pool:acquire ())
+    local ok, err = pcall (env.parallel_query, env, "bench:20:int",
+        { pool = pool, split = { { 1, 10 } } })
+    other:close ()
+    held:close ()
+    pool:close ()
+    eq (ok, false, "status with a full pool")
+    assert (tostring (err):find ("no free session", 1, true), err)
+end)
+
+check ("gather returns the results in the order of the statements", function ()
+    local pool = assert (env:pool ("test", "test", "test", { min = 1, max = 2 }))
+    local held = assert (pool:acquire ())
+    local res = assert (pool:gather { "bench:3:int", "update t set a = 1",
+        { "bench:5:int", 1 }, { "delete from t where a = :1", "x" } })
+    held:close ()
+    pool:close ()
+    eq (#res, 4, "results")
+    eq (#res[1], 3, "rows of the first query")
+    eq (res[1][2][1], int_value (1), "value of the first query")
+    eq (res[2], 1, "rows of the update")
+    eq (#res[3], 5, "rows of the second query")
+    eq (res[4], 1, "rows of the delete")
+end)
+
+check ("a failed statement of a gather leaves the others", function ()
+    local pool = assert (env:pool ("test", "test", "test", { min = 1, max = 3 }))
+    local g = assert (pool:gather ({ "bench:4:int", "stub:fail",
+        "update t set a = 1" }, { async = true }))
+    local results, errors = {}, {}
+    while true do
+        local ok, i, res = pcall (g.next, g, true)
+        if not ok then
+            errors[#errors + 1] = i
+        elseif i == nil then
+            break
+        else
+            results[i] = res
+        end
+    end
+    local ok, err = pcall (pool.gather, pool, { "update t set a = 1",
+        "stub:fail" })
+    pool:close ()
+    eq (#errors, 1, "errors")
+    assert (tostring (errors[1]):find ("statement #2", 1, true), errors[1])
+    eq (#results[1], 4, "rows of the query")
+    eq (results[2], nil, "result of the failed statement")
+    eq (results[3], 1, "rows of the update")
+    eq (ok, false, "status of a gather with a failed statement")
+    assert (tostring (err):find ("statement #2", 1, true), err)
+end)
+
+check ("gather fails without a free session in the pool", function ()
+    local pool = assert (env:pool ("test", "test", "test", { min = 1, max = 1 }))
+    local held = assert (pool:acquire ())
+    local ok, err = pcall (pool.gather, pool, { "update t set a = 1" })
+    held:close ()
+    pool:close ()
+    eq (ok, false, "status")
+    assert (tostring (err):find ("statement #1: no free session", 1, true), err)
+end)
+
+check ("a failed write of an exported LOB leaves the connection usable", function ()
+    local cur = assert (conn:execute "bench:3:int,clob(200000)")
+    local ok, err = pcall (cur.export, cur, "/dev/full")
+    eq (ok, false, "status of the export")
+    assert (tostring (err):find ("write error", 1, true), err)
+    cur:close ()
+    cur = assert (conn:execute "bench:2:int")
+    local rows = 0
+    while cur:fetch () do
+        rows = rows + 1
+    end
+    eq (rows, 2, "rows of the next query")
+end)
+
+check ("CSV parser of the loader", function ()
+    local path = os.tmpname ()
+    writefile (path, table.concat ({
+        'a,b,c\r\n',
+        '1,plain,"quoted"\r\n',
+        '\r\n',
+        '2,"with ""quotes""","two\nlines"\n',
+        '3,,""\n',
+        '4,"a,b",last',
+    }))
+    local ld = assert (conn:loader ("t", { "A", "B", "C" }))
+    eq (ld:loadcsv (path, { header = true }), 4, "parsed rows")
+    eq (ld:finish (), 4, "loaded rows")
+    ld:close ()
+    os.remove (path)
+
+    local want = {
+        { "1", "plain", "quoted" },
+        { "2", 'with "quotes"', "two\nlines" },
+        { "3", nil, "" },
+        { "4", "a,b", "last" },
+    }
+    local cur = assert (conn:execute "stub:loaded")
+    for i = 1, #want do
+        local row = cur:fetch ({}, "n")
+        assert (row, "missing row " .. i)
+        for j = 1, 3 do
+            eq (row[j], want[i][j], "row " .. i .. ", column " .. j)
+        end
+    end
+    eq (cur:fetch ({}, "n"), nil, "extra row")
+end)
+
+check ("CSV parser reports malformed lines", function ()
+    local path = os.tmpname ()
+    writefile (path, '1,2,3\n4,5\n')
+    local ld = assert (conn:loader ("t", { "A", "B", "C" }))
+    local ok, err = pcall (ld.loadcsv, ld, path)
+    ld:close ()
+    os.remove (path)
+    eq (ok, false, "status")
+    assert (tostring (err):find ("line 2: 2 fields, 3 expected", 1, true), err)
+end)
+
+check ("loaders need a blocking connection", function ()
+    local tconn = assert (env:connect ("test", "test", "test",
+        { threaded = true }))
+    local ok, err = pcall (tconn.loader, tconn, "t", { "A" })
+    tconn:close ()
+    eq (ok, false, "status")
+    assert (tostring (err):find ("blocking connection", 1, true), err)
+end)
+
+check ("pooled connections keep their pool", function ()
+    local pconn = assert (assert (env:pool ("test", "test", "test")):acquire ())
+    collectgarbage ()
+    collectgarbage ()
+    local cur = assert (pconn:execute "bench:2:int")
+    while cur:fetch () do end
+    eq (pconn:close (), true, "close")
+    -- now the pool goes
+    collectgarbage ()
+    collectgarbage ()
+end)
+
+check ("closing a cursor leaves the call of another statement", function ()
+    local tconn = assert (env:connect ("test", "test", "test",
+        { threaded = true }))
+    local function run (sql)
+        local res, status = tconn:execute (sql)
+        while status == STILL do
+            res, status = tconn:execute (sql, res)
+        end
+        return res
+    end
+    local function executes ()
+        local cur = run "stub:executes"
+        local n, status
+        repeat
+            n, status = cur:fetch ()
+        until status ~= STILL
+        cur:close ()
+        return n
+    end
+
+    local before = executes ()
+    local cur = run "bench:10:int"
+    local handle, status = tconn:execute "update t set a = 1"
+    eq (status, STILL, "status of the update")
+    cur:close ()
+    local n
+    repeat
+        n, status = tconn:execute ("update t set a = 1", handle)
+    until status ~= STILL
+    local after = executes ()
+    tconn:close ()
+    eq (n, 1, "rows of the update")
+    eq (after - before, 1, "executes of the update")
+end)
+
+check ("define buffers are not resized under a pending fetch", function ()
+    local tconn = assert (env:connect ("test", "test", "test",
+        { threaded = true }))
+    local cur, status = tconn:execute "bench:300:int"
+    while status == STILL do
+        cur, status = tconn:execute ("bench:300:int", cur)
+    end
+    local row
+    row, status = cur:fetch ()
+    eq (status, STILL, "status of the fetch")
+    local ok, err = pcall (cur.fetchmany, cur, 200)
+    local big = pcall (cur.setarraysize, cur, 2 ^ 40)
+    local rows = 0
+    repeat
+        row, status = cur:fetch ()
+        if row then
+            rows = rows + 1
+        end
+    until row == nil and status ~= STILL
+    tconn:close ()
+    eq (ok, false, "status of the resize")
+    assert (tostring (err):find ("another call is in progress", 1, true), err)
+    eq (big, false, "status of a huge array size")
+    eq (rows, 300, "rows")
+end)
+
+conn:close ()
+env:close ()
+
+print (string.format ("%d of %d checks failed", failures, count))
+if failures > 0 then
+    os.exit (1)
+end
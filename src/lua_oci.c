@@ -7,11 +7,21 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <strings.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "oci.h"
 #include "oratypes.h"
@@ -22,6 +32,7 @@
 #include "lauxlib.h"
 
 #include "luasql.h"
+#include "lua_oci_ffi.h"
 
 #ifdef _WITH_INT64
 #include "lua_int64.h"
@@ -35,6 +46,257 @@ luaopen_luasql_oci8 (lua_State *L);
 #define LUASQL_ENVIRONMENT_OCI8 "Oracle environment"
 #define LUASQL_CONNECTION_OCI8  "Oracle connection"
 #define LUASQL_CURSOR_OCI8      "Oracle cursor"
+#define LUASQL_STATEMENT_OCI8   "Oracle statement"
+#define LUASQL_POOL_OCI8        "Oracle session pool"
+#define LUASQL_LOB_OCI8         "Oracle LOB reader"
+#define LUASQL_LOADER_OCI8      "Oracle direct path loader"
+#define LUASQL_PARALLEL_OCI8    "Oracle parallel query"
+#define LUASQL_GATHER_OCI8      "Oracle gather"
+
+/* default number of rows prefetched by OCI */
+#define LUASQL_OCI_PREFETCH     500
+
+/* memory budget of autotuned prefetch, bytes */
+#define LUASQL_OCI_PREFETCH_BUDGET  (1024 * 1024)
+
+/* upper bound of autotuned prefetch rows */
+#define LUASQL_OCI_PREFETCH_MAX     10000
+
+/* fetch calls slower than this went to the server, microseconds */
+#define LUASQL_OCI_PREFETCH_RTT     500
+
+/* default bytes of each LOB prefetched with its row */
+#define LUASQL_OCI_LOBPREFETCH  4096
+
+/* default bytes returned by one LOB reader call */
+#define LUASQL_OCI_LOBCHUNK     65536
+
+/* default bytes of a LONG RAW value, bounded by the ub2 returned lengths */
+#define LUASQL_OCI_LONGSIZE     65535
+
+/* bytes buffered by cur:export between writes */
+#define LUASQL_OCI_EXPORTBUF    65536
+
+/* default bytes of a direct path stream buffer */
+#define LUASQL_OCI_LOADBUF      (1024 * 1024)
+
+/* default longest text of a value given to the direct path loader */
+#define LUASQL_OCI_LOADFIELD    4000
+
+/* default byte budget of the result cache */
+#define LUASQL_OCI_CACHE_BYTES  (16 * 1024 * 1024)
+
+/* default lifetime of cached results, seconds */
+#define LUASQL_OCI_CACHE_TTL    60
+
+/* initial number of hash buckets of the result cache */
+#define LUASQL_OCI_CACHE_BUCKETS    64
+
+/* most distinct SQL fingerprints with statistics */
+#define LUASQL_OCI_STATS_MAX    1024
+
+/* bytes of a fingerprint kept for env:stats() */
+#define LUASQL_OCI_STATS_TEXT   512
+
+/* default number of OCI calls kept by the tracer, a power of 2 */
+#define LUASQL_OCI_TRACE_EVENTS 65536
+
+/* default number of statements kept in the OCI statement cache */
+#define LUASQL_OCI_STMTCACHE    20
+
+/* default number of rows fetched by one OCIStmtFetch2 call */
+#define LUASQL_OCI_ARRAYSIZE    100
+
+/* largest number of rows of the define buffers of a cursor */
+#define LUASQL_OCI_ARRAYMAX     65536
+
+/* default number of worker threads of an environment */
+#define LUASQL_OCI_WORKERS      4
+
+/* default number of connect threads of an environment */
+#define LUASQL_OCI_CONNECTORS   16
+
+#define OCI_OK(status) ((status) == OCI_SUCCESS || (status) == OCI_SUCCESS_WITH_INFO)
+
+
+/* calls run by the worker threads */
+enum { JOB_EXECUTE = 1, JOB_FETCH, JOB_COMMIT, JOB_ROLLBACK, JOB_CONNECT,
+    JOB_DRAIN };
+
+/* states of a job */
+enum { JOB_IDLE = 0, JOB_QUEUED, JOB_DONE };
+
+
+typedef struct job_data job_data;
+
+struct job_data {
+    job_data     *next;               /* queue link */
+    int           op;
+    int           state;              /* guarded by the workers lock */
+    int           abandoned;          /* the caller is gone, guarded too */
+    sword         status;             /* result of the call */
+    uint64_t      started;            /* now_us() when the call began */
+    uint64_t      elapsed;            /* microseconds spent in the call */
+    OCISvcCtx    *svchp;
+    OCIStmt      *stmthp;
+    OCIError     *errhp;
+    ub4           iters;              /* iterations or rows to fetch */
+    ub4           mode;
+    OCISnapshot  *snap_in;            /* read point of an execute */
+    OCISnapshot  *snap_out;           /* takes the read point of an execute */
+    void         *arg;                /* cursor of a drain */
+    int           fd[2];              /* completion event: read and write ends */
+};
+
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  wakeup;           /* a job is queued */
+    pthread_cond_t  done;             /* a job is finished */
+    job_data       *head;
+    job_data       *tail;
+    pthread_t      *threads;
+    int             nthreads;         /* started threads */
+    int             size;             /* threads to start */
+    int             shutdown;
+    uint64_t        jobs;             /* queued jobs */
+    uint64_t        locks;            /* acquisitions of the lock */
+    uint64_t        contended;        /* acquisitions which had to wait */
+    uint64_t        waited;           /* microseconds waited for the lock */
+} workers_data;
+
+
+/* logon run by a connect worker */
+typedef struct {
+    job_data      job;                /* must be the first field */
+    OCIEnv       *envhp;
+    OCIError     *errhp;
+    OCIServer    *srvhp;
+    OCISvcCtx    *svchp;
+    OCISession   *authp;
+    int           attached;
+    int           began;
+    int           nonblocking;        /* set OCI non-blocking mode */
+    ub4           stmtcache;
+    uint64_t      deadline;           /* now_us() limit, 0 for none */
+    uint64_t      timeout;            /* microseconds, 0 for none */
+    char          username[256];
+    char          password[256];
+    char          sourcename[256];
+} connect_data;
+
+
+typedef struct cache_entry cache_entry;
+
+
+/* column of a cached result */
+typedef struct {
+    char         *name;
+    ub4           namelen;
+    ub2           type;
+    ub2           max;
+} cache_column;
+
+
+/* rows of a query encoded from the define buffers */
+struct cache_entry {
+    cache_entry  *prev;               /* LRU list, most recent first */
+    cache_entry  *next;
+    cache_entry  *chain;              /* hash bucket */
+    uint64_t      hash;
+    char         *key;                /* normalized SQL and bind values */
+    size_t        keylen;
+    uint64_t      ttl;                /* lifetime, microseconds */
+    uint64_t      expires;            /* now_us() limit */
+    int           refs;               /* the cache and replaying cursors */
+    size_t        bytes;              /* charged to the budget */
+    int           numcols;
+    cache_column *cols;
+    ub4           nrows;
+    char         *data;               /* encoded rows */
+    size_t        used;
+    size_t        size;
+};
+
+
+typedef struct {
+    size_t        budget;             /* bytes, 0 when disabled */
+    uint64_t      ttl;                /* default lifetime, microseconds */
+    size_t        bytes;
+    int           entries;
+    cache_entry  *head;               /* most recently used */
+    cache_entry  *tail;
+    cache_entry **buckets;
+    size_t        nbuckets;
+    lua_Number    hits;
+    lua_Number    misses;
+    lua_Number    evictions;
+    lua_Number    expired;
+} cache_data;
+
+
+/* log2 buckets of call latencies in microseconds */
+#define STATS_BUCKETS   32
+
+
+typedef struct {
+    uint64_t      count;
+    uint64_t      total;              /* microseconds */
+    uint64_t      max;
+    uint64_t      buckets[STATS_BUCKETS];  /* [i] counts calls < 2^(i+1) us */
+} latency_stats;
+
+
+typedef struct stats_entry stats_entry;
+
+
+/* counters of the statements sharing an SQL fingerprint */
+struct stats_entry {
+    stats_entry  *chain;              /* hash bucket */
+    uint64_t      hash;
+    size_t        len;                /* length of the whole fingerprint */
+    char         *text;               /* its first LUASQL_OCI_STATS_TEXT bytes */
+    uint64_t      executes;
+    uint64_t      errors;
+    uint64_t      rows;               /* fetched or affected */
+    uint64_t      fetches;
+    uint64_t      roundtrips;
+    latency_stats prepare;
+    latency_stats execute;
+    latency_stats fetch;
+};
+
+
+typedef struct {
+    int           enabled;
+    int           entries;
+    stats_entry **buckets;            /* LUASQL_OCI_STATS_MAX buckets */
+    stats_entry  *other;              /* fingerprints beyond the limit */
+} stats_data;
+
+
+/* OCI call recorded by the tracer */
+typedef struct {
+    uint64_t      seq;                /* position + 1, 0 while written */
+    uint64_t      begin;              /* now_us() */
+    uint64_t      end;
+    const char   *name;               /* OCI function */
+    stats_entry  *tag;                /* SQL fingerprint, NULL for none */
+    sword         status;
+    unsigned      lane;               /* connection */
+} trace_event;
+
+
+/*
+** Ring of the last OCI calls. Positions are taken with an atomic
+** increment, so calls are recorded without a lock by any thread.
+*/
+typedef struct {
+    trace_event  *ring;               /* NULL when disabled */
+    uint64_t      size;               /* a power of 2 */
+    uint64_t      head;               /* positions taken */
+    unsigned      lanes;              /* connections numbered */
+} trace_data;
 
 
 typedef struct {
@@ -42,36 +304,92 @@ typedef struct {
     int             conn_counter;
     OCIEnv         *envhp;
     OCIError       *errhp;
-    pthread_mutex_t mtx;
+    workers_data    workers;          /* threads of threaded connections */
+    workers_data    connectors;       /* threads of async connects */
+    cache_data      cache;            /* results of cached queries */
+    stats_data      stats;            /* statistics by SQL fingerprint */
+    trace_data      trace;            /* last OCI calls */
 } env_data;
 
 
+typedef struct pool_data pool_data;
+typedef struct lob_data lob_data;
+
+
+/* representations of DATE and TIMESTAMP values */
+enum { DATETIME_TABLE = 0, DATETIME_EPOCH, DATETIME_ISO };
+
+static const char *const datetime_formats[] = { "table", "epoch", "iso", NULL };
+
+
+typedef struct {
+    ub4           rows;               /* OCI_ATTR_PREFETCH_ROWS */
+    ub4           memory;             /* OCI_ATTR_PREFETCH_MEMORY, 0 for no limit */
+    int           autotune;           /* adapt rows to row width and latency */
+} prefetch_opts;
+
+
 typedef struct {
     short         closed;
     short         auto_commit;        /* 0 for manual commit */
     int           cur_counter;
+    int           stmt_counter;
     env_data     *env;                /* reference to environment */
     OCISvcCtx    *svchp;
     OCIServer    *srvhp;
     OCISession   *authp;
     OCIError     *errhp;
-    pthread_t     tid;                /* connection create thread */
-    volatile int  connecting;
+    connect_data *connect;            /* pending async connect */
     char          username[256];
     char          password[256];
     char          sourcename[256];
     int           utf8;
+    int           datetime;           /* default representation of dates */
+    ub4           arraysize;          /* default rows per fetch for cursors */
+    prefetch_opts prefetch;           /* default prefetch of statements */
+    ub4           stmtcache;          /* statement cache size, 0 disables */
+    ub4           lobprefetch;        /* LOB bytes prefetched with rows */
+    ub4           longsize;           /* bytes defined for LONG RAW values */
+    int           nonblocking;        /* OCI non-blocking mode is on */
+    OCIStmt      *exec_stmthp;        /* non-blocking execute being polled */
+    uint64_t      exec_start;         /* now_us() at its first poll */
+    int           threaded;           /* calls run by the environment workers */
+    job_data      job;                /* call of a threaded connection */
+    pool_data    *pool;               /* session pool of the connection */
+    int           poolref;            /* luaref */
+    lob_data     *lobs;               /* open LOB readers */
+    unsigned      lane;               /* number of the connection in traces */
 } conn_data;
 
 
-typedef union {
-    char        *text;
-    double       dbl;
-    OCIDateTime *date;
-    OCINumber    ociNumber;
-    int64_t      i64;
-    uint64_t     u64;
-} column_value;
+struct pool_data {
+    short         closed;
+    int           conn_counter;       /* acquired connections */
+    env_data     *env;                /* reference to environment */
+    OCISPool     *spoolhp;
+    OCIError     *errhp;
+    OraText      *name;               /* pool name used by OCISessionGet */
+    ub4           namelen;
+    ub4           min;
+    ub4           max;
+    double        acquired;
+    double        released;
+    double        waits;              /* acquires with all sessions busy */
+    double        waittime;           /* microseconds in OCISessionGet */
+    conn_data     conf;               /* options of pooled connections */
+};
+
+
+/* kinds of decoded NUMBER values */
+enum {
+    NUM_SIGNED = LUASQL_OCI_NUM_SIGNED,
+    NUM_UNSIGNED = LUASQL_OCI_NUM_UNSIGNED,
+    NUM_REAL = LUASQL_OCI_NUM_REAL
+};
+
+
+/* decoded NUMBER values are part of the FFI ABI */
+typedef luasql_oci_number num_value;
 
 
 typedef struct {
@@ -79,66 +397,280 @@ typedef struct {
     text         *name;    /* column name */
     ub4           namelen; /* column name length */
     ub2           max;     /* maximum size */
-    sb2           null;    /* is null? */
+    ub4           size;    /* size of one row in the define buffer */
     OCIDefine    *define;  /* define handle */
-    column_value  val;
+    sb2          *null;    /* null indicators, one per row */
+    ub2          *len;     /* returned lengths, one per row */
+    ub2           dtype;   /* type of the define */
+    void         *buf;     /* define buffer, arraysize rows */
+    num_value    *nums;    /* decoded NUMBER values, one per row */
 } column_data;
 
 
+typedef struct {
+    char         *name;    /* placeholder name, NULL for positional binds */
+    ub4           pos;     /* position of positional binds */
+    ub2           type;    /* bound SQLT type */
+    sb2           null;    /* indicator */
+    ub2           len;     /* actual length of character data */
+    sb4           size;    /* bound buffer size */
+    void         *ptr;     /* bound buffer */
+    char         *text;    /* character data buffer */
+    sb4           cap;     /* allocated size of the text buffer */
+    union {
+        double        dbl;
+        int64_t       i64;
+        uint64_t      u64;
+    } val;
+    OCIDateTime  *date;    /* timestamp descriptor */
+    OCIBind      *bind;    /* bind handle */
+} bind_data;
+
+
+typedef struct {
+    short         closed;
+    short         executing;          /* non-blocking execute in progress */
+    short         failed;             /* a prepare or execute failed */
+    uint64_t      started;            /* now_us() at the first poll */
+    conn_data    *conn;               /* reference to connection */
+    int           cur_counter;
+    ub2           type;               /* statement type */
+    prefetch_opts prefetch;
+    char         *text;               /* text of SQL statement */
+    OCIStmt      *stmthp;             /* statement handle */
+    OCIError     *errhp;
+    int           nbinds;             /* number of bind slots */
+    bind_data   **binds;              /* array of bind slots */
+    stats_entry  *stats;              /* statistics of the statement */
+} stmt_data;
+
+
 typedef struct {
     short         closed;
+    short         eof;                /* last fetch returned OCI_NO_DATA */
+    short         failed;             /* a fetch failed */
+    short         fetching;           /* non-blocking fetch in progress */
     conn_data    *conn;               /* reference to connection */
+    stmt_data    *stmt;               /* owner of the statement handle */
+    int           stmtref;            /* luaref */
     int           numcols;            /* number of columns */
     int           colnames;           /* luaref */
     int           coltypes;           /* luaref */
     int           columns;            /* luaref */
+    int           keys;               /* luaref, column names of row tables */
+    int           ffiref;             /* luaref, anchor of the FFI view */
+    ub4           arraysize;          /* rows in define buffers */
+    int           datetime;           /* representation of dates */
+    ub4           nrows;              /* rows fetched by the last call */
+    ub4           row;                /* next row to return */
+    prefetch_opts prefetch;
+    ub4           prefetch_max;       /* autotuned prefetch limit */
     char         *text;               /* text of SQL statement */
     OCIStmt      *stmthp;             /* statement handle */
     OCIError     *errhp;
     column_data  *cols;               /* array of columns */
+    void         *arena;              /* buffers of all columns */
+    luasql_oci_column *views;         /* FFI views of the columns */
+    luasql_oci_batch batch;           /* FFI view of the cursor */
+    cache_entry  *replay;             /* cached result, no statement */
+    size_t        replay_off;         /* next encoded row */
+    ub4           replay_row;
+    cache_entry  *fill;               /* result being cached */
+    stats_entry  *stats;              /* statistics of the statement */
+    int           truncated;          /* column of a cut LONG RAW, from 1 */
 } cur_data;
 
 
+/* states of a LOB reader */
+enum { LOB_START = 0, LOB_READING, LOB_DONE };
+
+
+struct lob_data {
+    short         closed;
+    int           state;
+    conn_data    *conn;               /* reference to connection */
+    OCIError     *errhp;
+    OCILobLocator *locp;              /* copy of the fetched locator */
+    ub1           csfrm;              /* character set form, 0 for binary */
+    ub4           chunk;              /* bytes per read */
+    char         *buf;
+    lob_data     *next;               /* next open reader of the connection */
+};
+
+
+typedef struct {
+    short         closed;
+    short         finished;           /* the load was finished or aborted */
+    conn_data    *conn;               /* reference to connection */
+    OCIError     *errhp;
+    OCIDirPathCtx *dpctx;
+    OCIDirPathColArray *dpca;
+    OCIDirPathStream *dpstr;
+    ub2           ncols;
+    ub4           maxrows;            /* rows of the column array */
+    ub4           nrows;              /* rows waiting in the column array */
+    uint64_t      loaded;             /* rows sent to the server */
+    char         *data;               /* text of the waiting values */
+    size_t        size;
+    size_t        used;
+    ub4          *off;                /* offset in data of each value */
+    ub4          *len;                /* length of each value */
+    ub1          *flg;                /* OCI_DIRPATH_COL_* of each value */
+} loader_data;
+
+
+/* range of a parallel query */
+typedef struct {
+    char         *sql;                /* text for the range, NULL for the query */
+    ub2           type[2];            /* SQLT_FLT or SQLT_CHR of :lo and :hi */
+    double        num[2];
+    char         *text[2];
+} range_data;
+
+
+/* states of a session of a parallel query */
+enum { PQ_IDLE = 0, PQ_EXECUTING, PQ_FETCHING, PQ_DONE };
+
+/* states of the read point of a parallel query */
+enum { SNAP_NONE = 0, SNAP_TAKING, SNAP_TAKEN };
+
+
+typedef struct {
+    int           state;
+    conn_data    *conn;               /* pooled connection */
+    int           connref;            /* luaref */
+    cur_data     *cur;                /* cursor of the running range */
+    int           curref;             /* luaref */
+    OCIStmt      *stmthp;             /* statement being executed */
+    range_data   *range;
+    uint64_t      start;              /* now_us() at the execute */
+} stream_data;
+
+
+typedef struct {
+    short         closed;
+    short         failed;             /* a range failed */
+    env_data     *env;                /* reference to environment */
+    int           poolref;            /* luaref */
+    char         *sql;
+    stats_entry  *stats;              /* statistics of the query */
+    OCISnapshot  *snap;               /* read point shared by the sessions */
+    int           snapshot;           /* SNAP_* */
+    ub4           arraysize;          /* rows per batch */
+    int           nranges;
+    int           next;               /* next range to run */
+    range_data   *ranges;
+    int           nstreams;
+    stream_data  *streams;
+    int           turn;               /* session polled first */
+} parallel_data;
+
+
+/* value bound to a statement of a gather */
+typedef struct {
+    ub2           type;               /* SQLT_FLT or SQLT_CHR */
+    double        num;
+    char         *text;
+} gather_value;
+
+
+/* states of a statement of a gather */
+enum { GATHER_PENDING = 0, GATHER_EXECUTING, GATHER_DRAINING, GATHER_FETCHING,
+    GATHER_READY, GATHER_FAILED, GATHER_RETURNED };
+
+
+typedef struct {
+    int           state;
+    char         *sql;
+    int           nvalues;
+    gather_value *values;             /* bound by position */
+    ub2           type;               /* OCI_ATTR_STMT_TYPE */
+    conn_data    *conn;               /* pooled connection while running */
+    int           connref;            /* luaref */
+    OCIStmt      *stmthp;             /* statement being executed */
+    cur_data     *cur;                /* cursor of a query */
+    int           curref;             /* luaref */
+    int           result;             /* luaref, rows or affected rows */
+    ub4           count;              /* rows in the result */
+    uint64_t      start;              /* now_us() at the last call */
+    stats_entry  *stats;              /* statistics of the statement */
+    char         *errmsg;             /* message of a failure */
+} gather_query;
+
+
+typedef struct {
+    short         closed;
+    short         num;                /* rows with numerical indices */
+    short         named;              /* rows with alphanumerical indices */
+    env_data     *env;                /* reference to environment */
+    pool_data    *pool;
+    int           poolref;            /* luaref */
+    int           nqueries;
+    gather_query *queries;
+    int           next;               /* next statement to start */
+    int           running;            /* sessions in use */
+    job_data      event;              /* completion event of all sessions */
+} gather_data;
+
+
 /*
-** Raise on OCI error.
+** Format the message of an OCI error.
 */
-static int
-ASSERT_OCI (lua_State *L, sword status, OCIError *errhp) {
+static void
+oci_error_message (sword status, OCIError *errhp, char *buf, size_t size) {
     switch (status) {
         case OCI_SUCCESS:
-            return 0;
-
         case OCI_SUCCESS_WITH_INFO:
-            return 0;
+            buf[0] = 0;
+            break;
 
         case OCI_NEED_DATA:
-            return luaL_error (L, LUASQL_PREFIX"OCI_NEED_DATA");
+            snprintf (buf, size, "OCI_NEED_DATA");
+            break;
 
         case OCI_NO_DATA:
-            return luaL_error (L, LUASQL_PREFIX"OCI_NODATA");
+            snprintf (buf, size, "OCI_NODATA");
+            break;
 
         case OCI_ERROR: {
-            text errbuf[512];
             sb4 errcode = 0;
+            buf[0] = 0;
             OCIErrorGet (errhp, (ub4) 1, (text *) NULL, &errcode,
-                errbuf, (ub4) sizeof (errbuf), OCI_HTYPE_ERROR);
-            return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+                (text *) buf, (ub4) size, OCI_HTYPE_ERROR);
+            break;
         }
 
         case OCI_INVALID_HANDLE:
-            return luaL_error (L, LUASQL_PREFIX"OCI_INVALID_HANDLE");
+            snprintf (buf, size, "OCI_INVALID_HANDLE");
+            break;
 
         case OCI_STILL_EXECUTING:
-            return luaL_error (L, LUASQL_PREFIX"OCI_STILL_EXECUTE");
+            snprintf (buf, size, "OCI_STILL_EXECUTE");
+            break;
 
         case OCI_CONTINUE:
-            return luaL_error (L, LUASQL_PREFIX"OCI_CONTINUE");
+            snprintf (buf, size, "OCI_CONTINUE");
+            break;
 
         default:
+            snprintf (buf, size, "CODE=%d", status);
             break;
     }
+}
+
+
+/*
+** Raise on OCI error.
+*/
+static int
+ASSERT_OCI (lua_State *L, sword status, OCIError *errhp) {
+    char errbuf[512];
 
-    return luaL_error (L, LUASQL_PREFIX"CODE=%d", status);
+    if (status == OCI_SUCCESS || status == OCI_SUCCESS_WITH_INFO)
+        return 0;
+
+    oci_error_message (status, errhp, errbuf, sizeof (errbuf));
+    return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
 }
 
 
@@ -154,1081 +686,7618 @@ ASSERT_PTR (lua_State *L, void *p) {
 
 
 /*
-** Check for valid environment.
+** Return a statement handle to the statement cache. A statement whose
+** prepare or execute failed is dropped from the cache instead, so that
+** the next prepare of its text does not get the failed handle back.
 */
-static env_data *
-getenvironment (lua_State *L) {
-    env_data *env = (env_data *)luaL_checkudata (L, 1, LUASQL_ENVIRONMENT_OCI8);
-    luaL_argcheck (L, env != NULL, 1, LUASQL_PREFIX"environment expected");
-    luaL_argcheck (L, !env->closed, 1, LUASQL_PREFIX"environment is closed");
-    return env;
+static void
+stmt_release (OCIStmt *stmthp, OCIError *errhp, int failed) {
+    OCIStmtRelease (stmthp, errhp, (OraText *)0, (ub4)0,
+        failed ? OCI_STRLS_CACHE_DELETE : OCI_DEFAULT);
 }
 
 
 /*
-** Check for valid connection.
+** Read a field of the options table at index t which names one of the
+** options of the list; return its index, or d if the field is nil.
 */
-static conn_data *
-getconnection (lua_State *L) {
-    conn_data *conn = (conn_data *)luaL_checkudata (L, 1, LUASQL_CONNECTION_OCI8);
-    luaL_argcheck (L, conn != NULL, 1, LUASQL_PREFIX"connection expected");
-    luaL_argcheck (L, !conn->closed, 1, LUASQL_PREFIX"connection is closed");
-    return conn;
+static int
+getoptionfield (lua_State *L, int t, const char *k, int d,
+        const char *const lst[]) {
+    const char *name;
+    int i;
+    lua_getfield (L, t, k);
+    if (lua_isnil (L, -1)) {
+        lua_pop (L, 1);
+        return d;
+    }
+    name = lua_type (L, -1) == LUA_TSTRING ? lua_tostring (L, -1) : NULL;
+    for (i = 0; name && lst[i]; i++)
+        if (strcmp (lst[i], name) == 0) {
+            lua_pop (L, 1);
+            return i;
+        }
+    return luaL_error (L, LUASQL_PREFIX"invalid option '%s' for field '%s'",
+        name ? name : luaL_typename (L, -1), k);
 }
 
 
 /*
-** Check for valid cursor.
+** Monotonic clock in microseconds.
 */
-static cur_data *
-getcursor (lua_State *L) {
-    cur_data *cur = (cur_data *)luaL_checkudata (L, 1, LUASQL_CURSOR_OCI8);
-    luaL_argcheck (L, cur != NULL, 1, LUASQL_PREFIX"cursor expected");
-    luaL_argcheck (L, !cur->closed, 1, LUASQL_PREFIX"cursor is closed");
-    return cur;
+static uint64_t
+now_us (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
 }
 
 
 /*
-** Copy the column name to the column structure and convert it to lower case.
+** End the session of an async connect and release its handles.
 */
-static int
-copy_column_name (lua_State *L, column_data *col, text *name) {
-    unsigned int i;
-    col->name = (text *)strndup ((const char *) name, col->namelen);
-    ASSERT_PTR (L, col->name);
-    for (i = 0; i < col->namelen; i++)
-        col->name[i] = tolower (col->name[i]);
-    return 0;
+static void
+connect_detach (connect_data *c) {
+    if (c->began)
+        OCISessionEnd(c->svchp, c->errhp, c->authp, (ub4) 0);
+    if (c->attached)
+        OCIServerDetach(c->srvhp, c->errhp, (ub4) OCI_DEFAULT);
+    if (c->authp)
+        OCIHandleFree((dvoid *) c->authp, (ub4) OCI_HTYPE_SESSION);
+    if (c->svchp)
+        OCIHandleFree((dvoid *) c->svchp, (ub4) OCI_HTYPE_SVCCTX);
+    if (c->srvhp)
+        OCIHandleFree((dvoid *) c->srvhp, (ub4) OCI_HTYPE_SERVER);
+    c->began = c->attached = 0;
+    c->authp = NULL;
+    c->svchp = NULL;
+    c->srvhp = NULL;
 }
 
 
 /*
-** Alloc buffers for column values.
+** Write the data source of an async connect with its timeout, so that
+** Oracle Net gives up the attach instead of blocking the worker: an
+** Easy Connect string gets a connect_timeout parameter and a connect
+** descriptor a CONNECT_TIMEOUT clause. Net service names are left as
+** they are, their timeout comes from sqlnet.ora.
 */
-static int
-alloc_column_buffer (lua_State *L, cur_data *cur, int i) {
-    /* column index ranges from 1 to numcols */
-    /* C array index ranges from 0 to numcols-1 */
-    column_data *col = &(cur->cols[i-1]);
-    OCIParam *param;
-    text *name;
-
-    ASSERT_OCI (L, OCIParamGet (cur->stmthp, OCI_HTYPE_STMT, cur->errhp,
-        (dvoid **)&param, i), cur->errhp);
-    ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
-        (dvoid *)&(name), (ub4 *)&(col->namelen),
-        OCI_ATTR_NAME, cur->errhp), cur->errhp);
-    ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
-        (dvoid *)&(col->type), (ub4 *)0, OCI_ATTR_DATA_TYPE,
-        cur->errhp), cur->errhp);
-
-    copy_column_name (L, col, name);
+static void
+connect_string (connect_data *c, char *buf, size_t size) {
+    const char *s = c->sourcename;
+    unsigned secs = (unsigned) ((c->timeout + 999999) / 1000000);
+
+    if (secs > 0 && strncasecmp (s, "(DESCRIPTION=", 13) == 0)
+        snprintf (buf, size, "(DESCRIPTION=(CONNECT_TIMEOUT=%u)%s", secs,
+            s + 13);
+    else if (secs > 0 && strchr (s, '(') == NULL
+            && (strchr (s, '/') || strchr (s, ':')))
+        snprintf (buf, size, "%s%cconnect_timeout=%u", s,
+            strchr (s, '?') ? '&' : '?', secs);
+    else
+        snprintf (buf, size, "%s", s);
+}
 
-    switch (col->type) {
-        case SQLT_CHR:
-        case SQLT_STR:
-        case SQLT_VCS:
-        case SQLT_AFC:
-        case SQLT_AVC:
-            ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
-                (dvoid *)&(col->max), 0, OCI_ATTR_DATA_SIZE,
-                cur->errhp), cur->errhp);
-            col->val.text = calloc (col->max + 1, sizeof(col->val.text));
-            ASSERT_PTR (L, col->val.text);
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, col->val.text, col->max+1,
-                SQLT_STR /*col->type*/, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            if (cur->conn->utf8) {
-                /* SELECT NLS_CHARSET_ID('UTF8') FROM DUAL; */
-                static ub2 UTF8 = 871;
-                ASSERT_OCI (L, OCIAttrSet( (dvoid *)col->define,
-                    (ub4)OCI_HTYPE_DEFINE, (void *)&UTF8, (ub4)0, (ub4)OCI_ATTR_CHARSET_ID, cur->errhp), cur->errhp);
-            }
-            break;
 
-        case SQLT_FLT:
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, &(col->val.dbl), sizeof(col->val.dbl),
-                SQLT_FLT, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            break;
+/*
+** Begin the session of an async connect on a connect worker.
+** On failure all handles but the error handle are released.
+*/
+static sword
+connect_run (connect_data *c) {
+    char dblink[sizeof(c->sourcename) + 64];
+    sword status;
 
-        case SQLT_INT:
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, &(col->val.i64), sizeof(col->val.i64),
-                SQLT_INT, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            break;
+    status = OCIHandleAlloc((dvoid *) c->envhp, (dvoid **) &(c->errhp),
+        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0);
+    if (status != OCI_SUCCESS)
+        return status;
+
+    status = OCIHandleAlloc((dvoid *) c->envhp, (dvoid **) &(c->srvhp),
+        (ub4) OCI_HTYPE_SERVER, (size_t) 0, (dvoid **) 0);
+    if (OCI_OK (status))
+        status = OCIHandleAlloc((dvoid *) c->envhp, (dvoid **) &(c->svchp),
+            (ub4) OCI_HTYPE_SVCCTX, (size_t) 0, (dvoid **) 0);
+    if (OCI_OK (status))
+        status = OCIHandleAlloc((dvoid *) c->envhp, (dvoid **) &c->authp,
+            OCI_HTYPE_SESSION, 0 , (dvoid **) 0);
+
+    if (OCI_OK (status)) {
+        connect_string (c, dblink, sizeof(dblink));
+        status = OCIServerAttach(c->srvhp, c->errhp, (text *) dblink,
+            (sb4) strlen(dblink), OCI_DEFAULT);
+    }
+    c->attached = OCI_OK (status);
+
+    if (OCI_OK (status))
+        status = OCIAttrSet((dvoid *) c->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) c->srvhp, (ub4)0, OCI_ATTR_SERVER, c->errhp);
+    if (OCI_OK (status))
+        status = OCIAttrSet((dvoid *)c->authp, OCI_HTYPE_SESSION,
+            (dvoid *) c->username, (ub4) strlen(c->username), OCI_ATTR_USERNAME, c->errhp);
+    if (OCI_OK (status))
+        status = OCIAttrSet((dvoid *)c->authp, OCI_HTYPE_SESSION,
+            (dvoid *) c->password, (ub4) strlen(c->password), OCI_ATTR_PASSWORD, c->errhp);
+
+#ifdef OCI_ATTR_CALL_TIMEOUT
+    /* the roundtrips of the logon are bounded as well */
+    if (OCI_OK (status) && c->timeout) {
+        ub4 ms = (ub4) ((c->timeout + 999) / 1000);
+        status = OCIAttrSet((dvoid *) c->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) &ms, (ub4)0, OCI_ATTR_CALL_TIMEOUT, c->errhp);
+    }
+#endif
 
-        case SQLT_UIN:
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, &(col->val.u64), sizeof(col->val.u64),
-                SQLT_UIN, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            break;
+    if (OCI_OK (status))
+        status = OCISessionBegin(c->svchp, c->errhp, c->authp,
+            OCI_CRED_RDBMS, (ub4) OCI_DEFAULT);
+    c->began = OCI_OK (status);
 
-        case SQLT_NUM:
-        case SQLT_VNU:
-            memset(col->val.ociNumber.OCINumberPart, 0, OCI_NUMBER_SIZE);
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, col->val.ociNumber.OCINumberPart, OCI_NUMBER_SIZE,
-                SQLT_VNU, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            break;
+#ifdef OCI_ATTR_CALL_TIMEOUT
+    if (OCI_OK (status) && c->timeout) {
+        ub4 ms = 0;
+        status = OCIAttrSet((dvoid *) c->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) &ms, (ub4)0, OCI_ATTR_CALL_TIMEOUT, c->errhp);
+    }
+#endif
 
-        case SQLT_DAT:
-        case SQLT_TIMESTAMP:
-        case SQLT_TIMESTAMP_TZ:
-        case SQLT_TIMESTAMP_LTZ:
-            ASSERT_OCI (L, OCIDescriptorAlloc(cur->conn->env->envhp, (dvoid *)&(col->val.date),
-                    OCI_DTYPE_TIMESTAMP, (size_t)0, (dvoid **)0), cur->errhp);
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, &(col->val.date), sizeof(OCIDateTime*),
-                SQLT_TIMESTAMP, (dvoid *)&(col->null), (ub2 *)0,
-                (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
-            break;
+    if (OCI_OK (status))
+        status = OCIAttrSet(c->svchp, OCI_HTYPE_SVCCTX,
+            c->authp, 0, OCI_ATTR_SESSION, c->errhp);
 
-        case SQLT_CLOB:
-            ASSERT_OCI (L, OCIDescriptorAlloc (cur->conn->env->envhp, (dvoid *)&(col->val.text),
-                OCI_DTYPE_LOB, (size_t)0, (dvoid **)0), cur->errhp);
-            ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
-                cur->errhp, (ub4)i, &(col->val.text), (sb4)sizeof(dvoid *),
-                SQLT_CLOB, (dvoid *)&(col->null), (ub2 *)0, (ub2 *)0,
-                OCI_DEFAULT), cur->errhp);
-            break;
+    /* a nonzero cache size enables statement caching */
+    if (OCI_OK (status))
+        status = OCIAttrSet((dvoid *) c->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) &c->stmtcache, (ub4)0, OCI_ATTR_STMTCACHESIZE, c->errhp);
 
-        default:
-            return luaL_error (L, LUASQL_PREFIX"invalid type %d #%d", col->type, i);
-    }
+    if (OCI_OK (status) && c->nonblocking)
+        status = OCIAttrSet ((dvoid *) c->srvhp, (ub4) OCI_HTYPE_SERVER,
+            (dvoid *) 0, (ub4) 0, (ub4) OCI_ATTR_NONBLOCKING_MODE, c->errhp);
 
-    return 0;
+    if (!OCI_OK (status))
+        connect_detach (c);
+    return status;
 }
 
 
 /*
-** Deallocate column buffers.
+** Release an async connect, with its session if it was not taken.
 */
-static int
-free_column_buffers (lua_State *L, cur_data *cur, int i) {
-    /* column index ranges from 1 to numcols */
+static void
+connect_free (connect_data *c) {
+    connect_detach (c);
+    if (c->errhp)
+        OCIHandleFree((dvoid *) c->errhp, (ub4) OCI_HTYPE_ERROR);
+    if (c->job.fd[0] >= 0)
+        close (c->job.fd[0]);
+    if (c->job.fd[1] >= 0 && c->job.fd[1] != c->job.fd[0])
+        close (c->job.fd[1]);
+    free (c);
+}
+
+
+static sword
+cur_drain (cur_data *cur);
+
+
+/*
+** Run the call of a job.
+*/
+static sword
+job_run (job_data *job) {
+    switch (job->op) {
+        case JOB_EXECUTE:
+            return OCIStmtExecute (job->svchp, job->stmthp, job->errhp,
+                job->iters, (ub4)0, (CONST OCISnapshot *)job->snap_in,
+                job->snap_out, job->mode);
+        case JOB_FETCH:
+            return OCIStmtFetch2 (job->stmthp, job->errhp, job->iters,
+                OCI_FETCH_NEXT, (sb4) 0, OCI_DEFAULT);
+        case JOB_COMMIT:
+            return OCITransCommit (job->svchp, job->errhp, OCI_DEFAULT);
+        case JOB_ROLLBACK:
+            return OCITransRollback (job->svchp, job->errhp, OCI_DEFAULT);
+        case JOB_CONNECT:
+            return connect_run ((connect_data *) job);
+        case JOB_DRAIN:
+            return cur_drain ((cur_data *) job->arg);
+    }
+    return OCI_INVALID_HANDLE;
+}
+
+
+/*
+** Take the lock of a pool, counting the acquisitions which had to wait.
+*/
+static void
+workers_lock (workers_data *w) {
+    if (pthread_mutex_trylock (&w->lock) != 0) {
+        uint64_t start = now_us ();
+        pthread_mutex_lock (&w->lock);
+        w->contended++;
+        w->waited += now_us () - start;
+    }
+    w->locks++;
+}
+
+
+/*
+** Main loop of a worker thread.
+** The completion event is signalled before the job is marked as done,
+** so a caller which sees the job done always finds the event to drain.
+*/
+static void *
+worker_main (void *p) {
+    workers_data *w = (workers_data *) p;
+    uint64_t one = 1, start;
+    job_data *job;
+    int abandoned;
+
+    workers_lock (w);
+    for (;;) {
+        while (w->head == NULL && !w->shutdown)
+            pthread_cond_wait (&w->wakeup, &w->lock);
+        if (w->head == NULL)
+            break;
+
+        job = w->head;
+        w->head = job->next;
+        if (w->head == NULL)
+            w->tail = NULL;
+        abandoned = job->abandoned;
+        pthread_mutex_unlock (&w->lock);
+
+        start = now_us ();
+        job->status = abandoned ? OCI_ERROR : job_run (job);
+        job->started = start;
+        job->elapsed = now_us () - start;
+        if (write (job->fd[1], &one, sizeof(one)) < 0) {
+            /* the event is still pending */
+        }
+
+        workers_lock (w);
+        job->state = JOB_DONE;
+        pthread_cond_broadcast (&w->done);
+        if (job->abandoned) {
+            /* only connects are abandoned */
+            pthread_mutex_unlock (&w->lock);
+            connect_free ((connect_data *) job);
+            workers_lock (w);
+        }
+    }
+    pthread_mutex_unlock (&w->lock);
+    return NULL;
+}
+
+
+/*
+** Start the worker threads on the first job.
+** Called with the workers lock held.
+*/
+static int
+workers_start (workers_data *w) {
+    w->threads = (pthread_t *) calloc (w->size, sizeof(pthread_t));
+    if (w->threads == NULL)
+        return -1;
+    for (w->nthreads = 0; w->nthreads < w->size; w->nthreads++)
+        if (pthread_create (&w->threads[w->nthreads], NULL, worker_main, w))
+            break;
+    return w->nthreads > 0 ? 0 : -1;
+}
+
+
+/*
+** Queue a job, starting the worker threads on the first one.
+*/
+static int
+job_submit (workers_data *w, job_data *job) {
+    workers_lock (w);
+    if (w->threads == NULL && workers_start (w) < 0) {
+        pthread_mutex_unlock (&w->lock);
+        return -1;
+    }
+    job->next = NULL;
+    job->state = JOB_QUEUED;
+    w->jobs++;
+    if (w->tail)
+        w->tail->next = job;
+    else
+        w->head = job;
+    w->tail = job;
+    pthread_cond_signal (&w->wakeup);
+    pthread_mutex_unlock (&w->lock);
+    return 0;
+}
+
+
+/*
+** Initialize a pool of worker threads.
+*/
+static void
+workers_init (workers_data *w, int size) {
+    memset (w, 0, sizeof(workers_data));
+    w->size = size;
+    pthread_mutex_init (&w->lock, NULL);
+    pthread_cond_init (&w->wakeup, NULL);
+    pthread_cond_init (&w->done, NULL);
+}
+
+
+/*
+** Release the synchronization objects of a stopped pool.
+*/
+static void
+workers_free (workers_data *w) {
+    pthread_cond_destroy (&w->wakeup);
+    pthread_cond_destroy (&w->done);
+    pthread_mutex_destroy (&w->lock);
+}
+
+
+/*
+** Stop and join the worker threads.
+*/
+static void
+workers_stop (workers_data *w) {
+    int i;
+    workers_lock (w);
+    w->shutdown = 1;
+    pthread_cond_broadcast (&w->wakeup);
+    pthread_mutex_unlock (&w->lock);
+    for (i = 0; i < w->nthreads; i++)
+        pthread_join (w->threads[i], NULL);
+    if (w->threads)
+        free (w->threads);
+    w->threads = NULL;
+    w->nthreads = 0;
+}
+
+
+/*
+** Create the completion event of a connection.
+** An eventfd where available, a pipe otherwise.
+*/
+static int
+job_init (job_data *job, int threaded) {
+    memset (job, 0, sizeof(job_data));
+    job->fd[0] = job->fd[1] = -1;
+    if (!threaded)
+        return 0;
+#ifdef __linux__
+    job->fd[0] = job->fd[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return job->fd[0] < 0 ? -1 : 0;
+#else
+    if (pipe (job->fd) < 0)
+        return -1;
+    fcntl (job->fd[0], F_SETFL, O_NONBLOCK);
+    fcntl (job->fd[1], F_SETFL, O_NONBLOCK);
+    fcntl (job->fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl (job->fd[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+
+/*
+** Consume the completion event.
+*/
+static void
+job_drain (job_data *job) {
+    uint64_t buf;
+    ssize_t n;
+    do
+        n = read (job->fd[0], &buf, sizeof(buf));
+    while (n > 0 || (n < 0 && errno == EINTR));
+}
+
+
+/*
+** Wait for the job of the connection to finish and forget its result.
+** With a statement handle, only a job on that statement is waited for:
+** the job of another caller is left for its owner to collect.
+*/
+static void
+job_wait (conn_data *conn, OCIStmt *stmthp) {
+    workers_data *w = &conn->env->workers;
+    if (!conn->threaded)
+        return;
+    workers_lock (w);
+    if (stmthp == NULL || conn->job.stmthp == stmthp) {
+        while (conn->job.state == JOB_QUEUED)
+            pthread_cond_wait (&w->done, &w->lock);
+        if (conn->job.state == JOB_DONE)
+            job_drain (&conn->job);
+        conn->job.state = JOB_IDLE;
+    }
+    pthread_mutex_unlock (&w->lock);
+}
+
+
+/*
+** Wait for the end of the job of a connection, keeping its result for
+** the next job_call.
+*/
+static void
+job_settle (conn_data *conn) {
+    workers_data *w = &conn->env->workers;
+    if (!conn->threaded)
+        return;
+    workers_lock (w);
+    while (conn->job.state == JOB_QUEUED)
+        pthread_cond_wait (&w->done, &w->lock);
+    pthread_mutex_unlock (&w->lock);
+}
+
+
+/*
+** Release the completion event of a connection.
+*/
+static void
+job_free (conn_data *conn) {
+    job_wait (conn, NULL);
+    if (conn->job.fd[0] >= 0)
+        close (conn->job.fd[0]);
+    if (conn->job.fd[1] >= 0 && conn->job.fd[1] != conn->job.fd[0])
+        close (conn->job.fd[1]);
+    conn->job.fd[0] = conn->job.fd[1] = -1;
+}
+
+
+/*
+** Run a call on the worker threads of a threaded connection.
+** The first call queues the job, later calls with the same operation
+** return OCI_STILL_EXECUTING until the job is done and then its status.
+*/
+static sword
+job_call (lua_State *L, conn_data *conn, int op, OCIStmt *stmthp,
+        OCIError *errhp, ub4 iters, ub4 mode) {
+    workers_data *w = &conn->env->workers;
+    job_data *job = &conn->job;
+    sword status = OCI_STILL_EXECUTING;
+
+    workers_lock (w);
+    if (job->state != JOB_IDLE && (job->op != op || job->stmthp != stmthp)) {
+        pthread_mutex_unlock (&w->lock);
+        return luaL_error (L, LUASQL_PREFIX"another call is in progress");
+    }
+
+    if (job->state == JOB_DONE) {
+        job_drain (job);
+        job->state = JOB_IDLE;
+        status = job->status;
+    }
+    else if (job->state == JOB_IDLE) {
+        pthread_mutex_unlock (&w->lock);
+        job->op = op;
+        job->svchp = conn->svchp;
+        job->stmthp = stmthp;
+        job->errhp = errhp;
+        job->iters = iters;
+        job->mode = mode;
+        if (job_submit (w, job) < 0)
+            return luaL_error (L, LUASQL_PREFIX"couldn't start worker threads");
+        return status;
+    }
+    pthread_mutex_unlock (&w->lock);
+    return status;
+}
+
+
+/*
+** Check whether a call of a threaded connection is still to be collected.
+*/
+static int
+job_pending (conn_data *conn) {
+    workers_data *w = &conn->env->workers;
+    int pending;
+    if (!conn->threaded)
+        return 0;
+    workers_lock (w);
+    pending = conn->job.state != JOB_IDLE;
+    pthread_mutex_unlock (&w->lock);
+    return pending;
+}
+
+
+/*
+** Run an execute on the worker threads of a threaded connection and
+** wait for its status, without raising errors. The job must be idle.
+** If the threads cannot start the call runs on the calling thread.
+*/
+static sword
+job_sync (conn_data *conn, OCIStmt *stmthp, ub4 iters, ub4 mode) {
+    workers_data *w = &conn->env->workers;
+    job_data *job = &conn->job;
+    sword status;
+
+    job->op = JOB_EXECUTE;
+    job->svchp = conn->svchp;
+    job->stmthp = stmthp;
+    job->errhp = conn->errhp;
+    job->iters = iters;
+    job->mode = mode;
+    if (job_submit (w, job) < 0) {
+        /* timed as a call of the workers, for trace_call */
+        job->started = now_us ();
+        status = OCIStmtExecute (conn->svchp, stmthp, conn->errhp, iters,
+            (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, mode);
+        job->elapsed = now_us () - job->started;
+        return status;
+    }
+
+    workers_lock (w);
+    while (job->state == JOB_QUEUED)
+        pthread_cond_wait (&w->done, &w->lock);
+    job_drain (job);
+    job->state = JOB_IDLE;
+    status = job->status;
+    pthread_mutex_unlock (&w->lock);
+    return status;
+}
+
+
+/*
+** Check for valid environment.
+*/
+static env_data *
+getenvironment (lua_State *L) {
+    env_data *env = (env_data *)luaL_checkudata (L, 1, LUASQL_ENVIRONMENT_OCI8);
+    luaL_argcheck (L, env != NULL, 1, LUASQL_PREFIX"environment expected");
+    luaL_argcheck (L, !env->closed, 1, LUASQL_PREFIX"environment is closed");
+    return env;
+}
+
+
+/*
+** Check for valid connection.
+*/
+static conn_data *
+getconnection (lua_State *L) {
+    conn_data *conn = (conn_data *)luaL_checkudata (L, 1, LUASQL_CONNECTION_OCI8);
+    luaL_argcheck (L, conn != NULL, 1, LUASQL_PREFIX"connection expected");
+    luaL_argcheck (L, !conn->closed, 1, LUASQL_PREFIX"connection is closed");
+    return conn;
+}
+
+
+/*
+** Check for valid cursor.
+*/
+static cur_data *
+getcursor (lua_State *L) {
+    cur_data *cur = (cur_data *)luaL_checkudata (L, 1, LUASQL_CURSOR_OCI8);
+    luaL_argcheck (L, cur != NULL, 1, LUASQL_PREFIX"cursor expected");
+    luaL_argcheck (L, !cur->closed, 1, LUASQL_PREFIX"cursor is closed");
+    return cur;
+}
+
+
+/*
+** Check for valid session pool.
+*/
+static pool_data *
+getpool (lua_State *L) {
+    pool_data *pool = (pool_data *)luaL_checkudata (L, 1, LUASQL_POOL_OCI8);
+    luaL_argcheck (L, pool != NULL, 1, LUASQL_PREFIX"session pool expected");
+    luaL_argcheck (L, !pool->closed, 1, LUASQL_PREFIX"session pool is closed");
+    return pool;
+}
+
+
+/*
+** Check for valid LOB reader.
+*/
+static lob_data *
+getlob (lua_State *L) {
+    lob_data *lob = (lob_data *)luaL_checkudata (L, 1, LUASQL_LOB_OCI8);
+    luaL_argcheck (L, lob != NULL, 1, LUASQL_PREFIX"LOB reader expected");
+    luaL_argcheck (L, !lob->closed, 1, LUASQL_PREFIX"LOB reader is closed");
+    return lob;
+}
+
+
+/*
+** Check for valid direct path loader.
+*/
+static loader_data *
+getloader (lua_State *L) {
+    loader_data *ld = (loader_data *)luaL_checkudata (L, 1, LUASQL_LOADER_OCI8);
+    luaL_argcheck (L, ld != NULL, 1, LUASQL_PREFIX"loader expected");
+    luaL_argcheck (L, !ld->closed, 1, LUASQL_PREFIX"loader is closed");
+    luaL_argcheck (L, !ld->finished, 1, LUASQL_PREFIX"load is finished");
+    return ld;
+}
+
+
+/*
+** Check for valid parallel query.
+*/
+static parallel_data *
+getparallel (lua_State *L) {
+    parallel_data *pq = (parallel_data *)luaL_checkudata (L, 1, LUASQL_PARALLEL_OCI8);
+    luaL_argcheck (L, pq != NULL, 1, LUASQL_PREFIX"parallel query expected");
+    luaL_argcheck (L, !pq->closed, 1, LUASQL_PREFIX"parallel query is closed");
+    return pq;
+}
+
+
+/*
+** Check for valid gather.
+*/
+static gather_data *
+getgather (lua_State *L) {
+    gather_data *g = (gather_data *)luaL_checkudata (L, 1, LUASQL_GATHER_OCI8);
+    luaL_argcheck (L, g != NULL, 1, LUASQL_PREFIX"gather expected");
+    luaL_argcheck (L, !g->closed, 1, LUASQL_PREFIX"gather is closed");
+    return g;
+}
+
+
+/*
+** Check for valid statement.
+*/
+static stmt_data *
+getstatement (lua_State *L) {
+    stmt_data *stmt = (stmt_data *)luaL_checkudata (L, 1, LUASQL_STATEMENT_OCI8);
+    luaL_argcheck (L, stmt != NULL, 1, LUASQL_PREFIX"statement expected");
+    luaL_argcheck (L, !stmt->closed, 1, LUASQL_PREFIX"statement is closed");
+    return stmt;
+}
+
+
+/*
+** Copy the column name to the column structure and convert it to lower case.
+*/
+static int
+copy_column_name (lua_State *L, column_data *col, text *name) {
+    unsigned int i;
+    col->name = (text *)strndup ((const char *) name, col->namelen);
+    ASSERT_PTR (L, col->name);
+    for (i = 0; i < col->namelen; i++)
+        col->name[i] = tolower (col->name[i]);
+    return 0;
+}
+
+
+/*
+** Set the type and the row size of the define buffer of the column.
+*/
+static void
+define_type (column_data *col) {
+    switch (col->type) {
+        case SQLT_CHR:
+        case SQLT_STR:
+        case SQLT_VCS:
+        case SQLT_AFC:
+        case SQLT_AVC:
+            /* no terminator, values are pushed with their returned length */
+            col->size = col->max ? col->max : 1;
+            col->dtype = SQLT_CHR;
+            break;
+
+        case SQLT_FLT:
+            col->size = sizeof(double);
+            col->dtype = SQLT_FLT;
+            break;
+
+        case SQLT_INT:
+            col->size = sizeof(int64_t);
+            col->dtype = SQLT_INT;
+            break;
+
+        case SQLT_UIN:
+            col->size = sizeof(uint64_t);
+            col->dtype = SQLT_UIN;
+            break;
+
+        case SQLT_NUM:
+        case SQLT_VNU:
+            col->size = OCI_NUMBER_SIZE;
+            col->dtype = SQLT_VNU;
+            break;
+
+        case SQLT_DAT:
+            /* 7 bytes decoded without OCI calls */
+            col->size = 7;
+            col->dtype = SQLT_DAT;
+            break;
+
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ:
+            /* the descriptor keeps the time zone of the value */
+            col->size = sizeof(OCIDateTime *);
+            col->dtype = col->type;
+            break;
+
+        case SQLT_BIN:
+        case SQLT_LBI:
+            /* binary values are pushed with their returned length */
+            col->size = col->max ? col->max : 1;
+            col->dtype = col->type;
+            break;
+
+        case SQLT_CLOB:
+        case SQLT_BLOB:
+            col->size = sizeof(OCILobLocator *);
+            col->dtype = col->type;
+            break;
+    }
+}
+
+
+/*
+** Describe the column: name, database type and maximum size.
+*/
+static int
+describe_column (lua_State *L, cur_data *cur, int i) {
+    /* column index ranges from 1 to numcols */
     /* C array index ranges from 0 to numcols-1 */
     column_data *col = &(cur->cols[i-1]);
-    if (col->name)
-        free (col->name);
+    OCIParam *param;
+    text *name;
+
+    ASSERT_OCI (L, OCIParamGet (cur->stmthp, OCI_HTYPE_STMT, cur->errhp,
+        (dvoid **)&param, i), cur->errhp);
+    ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
+        (dvoid *)&(name), (ub4 *)&(col->namelen),
+        OCI_ATTR_NAME, cur->errhp), cur->errhp);
+    ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
+        (dvoid *)&(col->type), (ub4 *)0, OCI_ATTR_DATA_TYPE,
+        cur->errhp), cur->errhp);
+
+    copy_column_name (L, col, name);
+
+    switch (col->type) {
+        case SQLT_CHR:
+        case SQLT_STR:
+        case SQLT_VCS:
+        case SQLT_AFC:
+        case SQLT_AVC:
+        case SQLT_BIN:
+            ASSERT_OCI (L, OCIAttrGet (param, OCI_DTYPE_PARAM,
+                (dvoid *)&(col->max), 0, OCI_ATTR_DATA_SIZE,
+                cur->errhp), cur->errhp);
+            break;
+
+        case SQLT_LBI:
+            col->max = (ub2) cur->conn->longsize;
+            break;
+
+        case SQLT_FLT:
+        case SQLT_INT:
+        case SQLT_UIN:
+        case SQLT_NUM:
+        case SQLT_VNU:
+        case SQLT_DAT:
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ:
+        case SQLT_CLOB:
+        case SQLT_BLOB:
+            break;
+
+        default:
+            return luaL_error (L, LUASQL_PREFIX"invalid type %d #%d", col->type, i);
+    }
+
+    define_type (col);
+    return 0;
+}
+
+
+/*
+** Descriptor type of the values of a TIMESTAMP define.
+*/
+static ub4
+datetime_dtype (ub2 dtype) {
+    switch (dtype) {
+        case SQLT_TIMESTAMP_TZ:
+            return OCI_DTYPE_TIMESTAMP_TZ;
+        case SQLT_TIMESTAMP_LTZ:
+            return OCI_DTYPE_TIMESTAMP_LTZ;
+        default:
+            return OCI_DTYPE_TIMESTAMP;
+    }
+}
+
+
+/*
+** Define the column on its buffers.
+*/
+static int
+define_column (lua_State *L, cur_data *cur, int i) {
+    /* column index ranges from 1 to numcols */
+    /* C array index ranges from 0 to numcols-1 */
+    column_data *col = &(cur->cols[i-1]);
+
+    switch (col->dtype) {
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ:
+            ASSERT_OCI (L, OCIArrayDescriptorAlloc (cur->conn->env->envhp,
+                col->buf, datetime_dtype (col->dtype), cur->arraysize,
+                (size_t)0, (dvoid **)0), cur->errhp);
+            break;
+
+        case SQLT_CLOB:
+        case SQLT_BLOB:
+            ASSERT_OCI (L, OCIArrayDescriptorAlloc (cur->conn->env->envhp,
+                col->buf, OCI_DTYPE_LOB, cur->arraysize, (size_t)0,
+                (dvoid **)0), cur->errhp);
+            break;
+
+        default:
+            break;
+    }
+
+    ASSERT_OCI (L, OCIDefineByPos (cur->stmthp, &(col->define),
+        cur->errhp, (ub4)i, col->buf, (sb4)col->size, col->dtype,
+        (dvoid *)col->null, col->len, (ub2 *)0, (ub4) OCI_DEFAULT), cur->errhp);
+
+    if ((col->dtype == SQLT_CLOB || col->dtype == SQLT_BLOB) && cur->conn->lobprefetch) {
+        /* small LOBs and their lengths arrive with the rows */
+        boolean prefetch_length = TRUE;
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *)col->define, (ub4)OCI_HTYPE_DEFINE,
+            (void *)&cur->conn->lobprefetch, (ub4)0, (ub4)OCI_ATTR_LOBPREFETCH_SIZE,
+            cur->errhp), cur->errhp);
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *)col->define, (ub4)OCI_HTYPE_DEFINE,
+            (void *)&prefetch_length, (ub4)0, (ub4)OCI_ATTR_LOBPREFETCH_LENGTH,
+            cur->errhp), cur->errhp);
+    }
+
+    if (col->dtype == SQLT_CHR && cur->conn->utf8) {
+        /* SELECT NLS_CHARSET_ID('UTF8') FROM DUAL; */
+        static ub2 UTF8 = 871;
+        ASSERT_OCI (L, OCIAttrSet( (dvoid *)col->define,
+            (ub4)OCI_HTYPE_DEFINE, (void *)&UTF8, (ub4)0, (ub4)OCI_ATTR_CHARSET_ID, cur->errhp), cur->errhp);
+    }
+
+    return 0;
+}
+
+
+/*
+** Point the FFI views at the column buffers.
+*/
+static void
+update_views (cur_data *cur) {
+    int i;
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        luasql_oci_column *view = &(cur->views[i]);
+        view->name = (const char *) col->name;
+        view->namelen = col->namelen;
+        view->type = col->dtype;
+        view->size = col->size;
+        view->data = col->buf;
+        view->null = col->null;
+        view->len = col->len;
+        view->nums = col->nums;
+    }
+    cur->batch.cursor = cur;
+    cur->batch.numcols = cur->numcols;
+    cur->batch.cols = cur->views;
+    cur->batch.first = cur->row;
+    cur->batch.rows = cur->nrows - cur->row;
+    cur->batch.eof = cur->eof;
+}
+
+
+#define ARENA_ALIGN(n)  (((n) + 15) & ~(size_t) 15)
+
+/*
+** Alloc the buffers of cur->arraysize rows of all columns from one
+** arena and define the columns on them.
+*/
+static int
+alloc_buffers (lua_State *L, cur_data *cur) {
+    size_t total = 0, n = cur->arraysize;
+    char *p;
+    int i;
+
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        total += ARENA_ALIGN (n * col->size)
+            + ARENA_ALIGN (n * sizeof(sb2)) + ARENA_ALIGN (n * sizeof(ub2));
+        if (col->dtype == SQLT_VNU)
+            total += ARENA_ALIGN (n * sizeof(num_value));
+    }
+
+    cur->arena = calloc (1, total ? total : 1);
+    ASSERT_PTR (L, cur->arena);
+
+    p = (char *) cur->arena;
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        col->buf = p;
+        p += ARENA_ALIGN (n * col->size);
+        col->null = (sb2 *) p;
+        p += ARENA_ALIGN (n * sizeof(sb2));
+        col->len = (ub2 *) p;
+        p += ARENA_ALIGN (n * sizeof(ub2));
+        if (col->dtype == SQLT_VNU) {
+            col->nums = (num_value *) p;
+            p += ARENA_ALIGN (n * sizeof(num_value));
+        }
+    }
+
+    /* replayed results are copied to the buffers */
+    for (i = 1; i <= cur->numcols && !cur->replay; i++)
+        define_column (L, cur, i);
+    update_views (cur);
+    return 0;
+}
+
+
+/*
+** Deallocate the descriptors and the arena of the column buffers.
+*/
+static void
+free_buffers (cur_data *cur) {
+    int i;
+
+    for (i = 0; i < cur->numcols && cur->arena; i++) {
+        column_data *col = &(cur->cols[i]);
+        switch (col->dtype) {
+            case SQLT_TIMESTAMP:
+            case SQLT_TIMESTAMP_TZ:
+            case SQLT_TIMESTAMP_LTZ:
+                if (*(OCIDateTime **)col->buf)
+                    OCIArrayDescriptorFree (col->buf, datetime_dtype (col->dtype));
+                break;
+
+            case SQLT_CLOB:
+            case SQLT_BLOB:
+                if (*(OCILobLocator **)col->buf)
+                    OCIArrayDescriptorFree (col->buf, OCI_DTYPE_LOB);
+                break;
+
+            default:
+                break;
+        }
+        col->buf = NULL;
+        col->null = NULL;
+        col->len = NULL;
+        col->nums = NULL;
+    }
+
+    if (cur->arena)
+        free (cur->arena);
+    cur->arena = NULL;
+}
+
+
+/* powers of ten exactly representable as double */
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/*
+** Decode an Oracle NUMBER without OCI calls.
+** The first byte is the length, the second the sign and the base-100
+** exponent, then come the base-100 digits: d + 1 for positive numbers,
+** 101 - d followed by a 102 terminator for negative ones.
+** Return 0 if OCI must convert the number: infinities, integers beyond
+** 64 bits and fractions which one correctly rounded division of two
+** exact doubles cannot produce.
+*/
+static int
+number_decode (const ub1 *num, num_value *out) {
+    ub1 len = num[0], e = num[1];
+    int neg = e < 0x80;
+    int n = len - 1, exp, i;
+    uint64_t mant = 0;
+
+    if (len == 1 && e == 0x80) {
+        out->kind = NUM_UNSIGNED;
+        out->v.u64 = 0;
+        return 1;
+    }
+    if (len < 2 || len > OCI_NUMBER_SIZE - 1)
+        return 0;
+
+    if (neg) {
+        if (num[len] == 102)
+            n--;
+        exp = ((~e) & 0x7F) - 65;
+    } else
+        exp = (e & 0x7F) - 65;
+
+    for (i = 0; i < n; i++) {
+        unsigned d = neg ? 101u - num[2 + i] : num[2 + i] - 1u;
+        if (d > 99 || mant > (UINT64_MAX - 99) / 100)
+            return 0;
+        mant = mant * 100 + d;
+    }
+
+    /* value is mant * 100^exp */
+    exp -= n - 1;
+    if (exp >= 0) {
+        for (; exp > 0; exp--) {
+            if (mant > UINT64_MAX / 100)
+                return 0;
+            mant *= 100;
+        }
+        if (!neg) {
+            out->kind = NUM_UNSIGNED;
+            out->v.u64 = mant;
+        } else if (mant <= (uint64_t) INT64_MAX + 1) {
+            out->kind = NUM_SIGNED;
+            out->v.i64 = -(int64_t) (mant - 1) - 1;
+        } else
+            return 0;
+        return 1;
+    }
+
+    if (mant > ((uint64_t) 1 << 53) || -2 * exp > 22)
+        return 0;
+    out->kind = NUM_REAL;
+    out->v.dbl = (double) mant / pow10_exact[-2 * exp];
+    if (neg)
+        out->v.dbl = -out->v.dbl;
+    return 1;
+}
+
+
+/* longest text of an Oracle NUMBER: sign, 0., 128 zeros and 40 digits */
+#define NUMBER_TEXT_SIZE  176
+
+/*
+** Write the exact decimal text of an Oracle NUMBER, without exponent.
+** Return the length of the text, or 0 for infinities and malformed
+** numbers.
+*/
+static int
+number_text (const ub1 *num, char *out) {
+    ub1 len = num[0], e = num[1];
+    int neg = e < 0x80;
+    int n = len - 1, exp, i, nd = 0, p, k = 0;
+    char digits[2 * OCI_NUMBER_SIZE], *d = digits;
+
+    if (len == 1 && e == 0x80) {
+        out[0] = '0';
+        return 1;
+    }
+    if (len < 2 || len > OCI_NUMBER_SIZE - 1)
+        return 0;
+
+    if (neg) {
+        if (num[len] == 102)
+            n--;
+        exp = ((~e) & 0x7F) - 65;
+    } else
+        exp = (e & 0x7F) - 65;
+
+    for (i = 0; i < n; i++) {
+        unsigned v = neg ? 101u - num[2 + i] : num[2 + i] - 1u;
+        if (v > 99)
+            return 0;
+        d[nd++] = (char) ('0' + v / 10);
+        d[nd++] = (char) ('0' + v % 10);
+    }
+
+    /* the decimal point follows the first p digits */
+    p = 2 * (exp + 1);
+    if (d[0] == '0') {
+        d++;
+        nd--;
+        p--;
+    }
+    while (nd > p && d[nd - 1] == '0')
+        nd--;
+
+    if (neg)
+        out[k++] = '-';
+    if (p <= 0) {
+        out[k++] = '0';
+        out[k++] = '.';
+        memset (out + k, '0', -p);
+        k += -p;
+        memcpy (out + k, d, nd);
+        k += nd;
+    } else if (p >= nd) {
+        memcpy (out + k, d, nd);
+        k += nd;
+        memset (out + k, '0', p - nd);
+        k += p - nd;
+    } else {
+        memcpy (out + k, d, p);
+        k += p;
+        out[k++] = '.';
+        memcpy (out + k, d + p, nd - p);
+        k += nd - p;
+    }
+    return k;
+}
+
+
+/*
+** Convert an Oracle NUMBER with OCI calls.
+*/
+static sword
+number_oci (cur_data *cur, OCINumber *num, num_value *out) {
+#ifdef _WITH_INT64
+    boolean isint;
+    sword status = OCINumberIsInt(cur->errhp, num, &isint);
+    if (status != OCI_SUCCESS)
+        return status;
+    if (isint) {
+        if (((ub1 *) num)[1] >= 0x80) {
+            out->kind = NUM_UNSIGNED;
+            return OCINumberToInt(cur->errhp,
+                num, sizeof(uint64_t), OCI_NUMBER_UNSIGNED, &out->v.u64);
+        } else {
+            out->kind = NUM_SIGNED;
+            return OCINumberToInt(cur->errhp,
+                num, sizeof(int64_t), OCI_NUMBER_SIGNED, &out->v.i64);
+        }
+    }
+#endif
+    out->kind = NUM_REAL;
+    return OCINumberToReal(cur->errhp, num, sizeof(double), &out->v.dbl);
+}
+
+
+/*
+** Decode the fetched rows of the NUMBER columns, column by column.
+*/
+static sword
+decode_numbers (cur_data *cur) {
+    sword status;
+    int i;
+    ub4 row;
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        OCINumber *nums = (OCINumber *) col->buf;
+        if (col->nums == NULL)
+            continue;
+        for (row = 0; row < cur->nrows; row++)
+            if (!col->null[row]
+                    && !number_decode ((const ub1 *) &nums[row], &col->nums[row])
+                    && (status = number_oci (cur, &nums[row], &col->nums[row])) != OCI_SUCCESS)
+                return status;
+    }
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Complete a fetch call with the given status: note the end of the
+** result set, count the fetched rows and decode them.
+** A LONG RAW value longer than its define buffer fails the fetch and
+** the cursor, rather than being returned cut.
+*/
+static sword
+fetched_rows (cur_data *cur, sword status) {
+    int i;
+    ub4 row;
+
+    if (status == OCI_NO_DATA)
+        /* the last batch may be incomplete */
+        cur->eof = 1;
+    else if (!OCI_OK (status))
+        return status;
+
+    status = OCIAttrGet ((dvoid *)cur->stmthp, (ub4)OCI_HTYPE_STMT,
+        (dvoid *)&cur->nrows, (ub4 *)0, (ub4)OCI_ATTR_ROWS_FETCHED,
+        cur->errhp);
+    if (status != OCI_SUCCESS)
+        return status;
+
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        if (col->dtype != SQLT_LBI)
+            continue;
+        /* the indicator holds the full length, or -2 if it is too big */
+        for (row = 0; row < cur->nrows; row++)
+            if (col->null[row] > 0 || col->null[row] == -2) {
+                cur->truncated = i + 1;
+                cur->nrows = 0;
+                return OCI_ERROR;
+            }
+    }
+
+    return decode_numbers (cur);
+}
+
+
+/*
+** Describe the failure of a fetch.
+*/
+static void
+fetch_error (cur_data *cur, sword status, char *buf, size_t size) {
+    if (cur->truncated) {
+        column_data *col = &(cur->cols[cur->truncated - 1]);
+        snprintf (buf, size, "LONG RAW value of column %.*s is longer than "
+            "longsize (%u bytes)", (int) col->namelen, (char *) col->name,
+            (unsigned) cur->conn->longsize);
+    }
+    else
+        oci_error_message (status, cur->errhp, buf, size);
+}
+
+
+/*
+** Raise the failure of a fetch.
+*/
+static int
+fetch_raise (lua_State *L, cur_data *cur, sword status) {
+    char errbuf[512];
+    fetch_error (cur, status, errbuf, sizeof(errbuf));
+    return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+}
+
+
+static uint64_t
+cache_hash (const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+static void
+cache_entry_free (cache_entry *e) {
+    int i;
+    for (i = 0; i < e->numcols && e->cols; i++)
+        free (e->cols[i].name);
+    free (e->cols);
+    free (e->key);
+    free (e->data);
+    free (e);
+}
+
+
+static void
+cache_release (cache_entry *e) {
+    if (--e->refs == 0)
+        cache_entry_free (e);
+}
+
+
+static void
+lru_remove (cache_data *c, cache_entry *e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        c->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        c->tail = e->prev;
+}
+
+
+static void
+lru_push (cache_data *c, cache_entry *e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head)
+        c->head->prev = e;
+    else
+        c->tail = e;
+    c->head = e;
+}
+
+
+/*
+** Drop an entry from the cache; replaying cursors keep it alive.
+*/
+static void
+cache_unlink (cache_data *c, cache_entry *e) {
+    cache_entry **p = &c->buckets[e->hash & (c->nbuckets - 1)];
+    while (*p != e)
+        p = &(*p)->chain;
+    *p = e->chain;
+    lru_remove (c, e);
+    c->bytes -= e->bytes;
+    c->entries--;
+    cache_release (e);
+}
+
+
+static void
+cache_flush (cache_data *c) {
+    while (c->head)
+        cache_unlink (c, c->head);
+}
+
+
+static cache_entry *
+cache_find (cache_data *c, const char *key, size_t len, uint64_t h) {
+    cache_entry *e;
+    for (e = c->buckets[h & (c->nbuckets - 1)]; e; e = e->chain)
+        if (e->hash == h && e->keylen == len && memcmp (e->key, key, len) == 0)
+            return e;
+    return NULL;
+}
+
+
+/*
+** Find the live entry of a key and make it the most recently used.
+*/
+static cache_entry *
+cache_lookup (cache_data *c, const char *key, size_t len) {
+    cache_entry *e = cache_find (c, key, len, cache_hash (key, len));
+    if (e && e->expires <= now_us ()) {
+        c->expired++;
+        cache_unlink (c, e);
+        e = NULL;
+    }
+    if (e == NULL) {
+        c->misses++;
+        return NULL;
+    }
+    c->hits++;
+    if (e != c->head) {
+        lru_remove (c, e);
+        lru_push (c, e);
+    }
+    return e;
+}
+
+
+/*
+** Double the hash buckets; the cache works on with the old ones if
+** memory is short.
+*/
+static void
+cache_grow (cache_data *c) {
+    size_t n = c->nbuckets * 2, i;
+    cache_entry **buckets = (cache_entry **) calloc (n, sizeof(cache_entry *));
+    if (buckets == NULL)
+        return;
+    for (i = 0; i < c->nbuckets; i++) {
+        cache_entry *e = c->buckets[i];
+        while (e) {
+            cache_entry *next = e->chain;
+            e->chain = buckets[e->hash & (n - 1)];
+            buckets[e->hash & (n - 1)] = e;
+            e = next;
+        }
+    }
+    free (c->buckets);
+    c->buckets = buckets;
+    c->nbuckets = n;
+}
+
+
+/*
+** Add a complete result, evicting the least recently used entries to
+** keep within the budget.
+*/
+static void
+cache_insert (cache_data *c, cache_entry *e) {
+    cache_entry *old;
+
+    e->bytes += e->size;
+    if (e->bytes > c->budget) {
+        cache_entry_free (e);
+        return;
+    }
+    e->hash = cache_hash (e->key, e->keylen);
+    e->expires = now_us () + e->ttl;
+
+    old = cache_find (c, e->key, e->keylen, e->hash);
+    if (old)
+        cache_unlink (c, old);
+    while (c->tail && c->bytes + e->bytes > c->budget) {
+        c->evictions++;
+        cache_unlink (c, c->tail);
+    }
+    if ((size_t) c->entries >= c->nbuckets)
+        cache_grow (c);
+
+    e->chain = c->buckets[e->hash & (c->nbuckets - 1)];
+    c->buckets[e->hash & (c->nbuckets - 1)] = e;
+    lru_push (c, e);
+    c->bytes += e->bytes;
+    c->entries++;
+    e->refs++;
+}
+
+
+/*
+** Types whose define buffers can be copied: no descriptors.
+*/
+static int
+cache_column_ok (column_data *col) {
+    switch (col->dtype) {
+        case SQLT_CHR:
+        case SQLT_VNU:
+        case SQLT_INT:
+        case SQLT_UIN:
+        case SQLT_FLT:
+        case SQLT_DAT:
+        case SQLT_BIN:
+        case SQLT_LBI:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+/*
+** Start caching the result of a cursor under the given key.
+** Return NULL if the result cannot be cached.
+*/
+static cache_entry *
+cache_begin (cur_data *cur, const char *key, size_t keylen, uint64_t ttl) {
+    cache_entry *e;
+    int i;
+
+    for (i = 0; i < cur->numcols; i++)
+        if (!cache_column_ok (&(cur->cols[i])))
+            return NULL;
+
+    e = (cache_entry *) calloc (1, sizeof(cache_entry));
+    if (e == NULL)
+        return NULL;
+    e->ttl = ttl;
+    e->numcols = cur->numcols;
+    e->bytes = sizeof(cache_entry) + keylen + cur->numcols * sizeof(cache_column);
+    e->key = (char *) malloc (keylen);
+    e->cols = (cache_column *) calloc (cur->numcols, sizeof(cache_column));
+    if (e->key == NULL || e->cols == NULL) {
+        cache_entry_free (e);
+        return NULL;
+    }
+    memcpy (e->key, key, keylen);
+    e->keylen = keylen;
+
+    for (i = 0; i < cur->numcols; i++) {
+        column_data *col = &(cur->cols[i]);
+        cache_column *cc = &(e->cols[i]);
+        cc->name = (char *) malloc (col->namelen + 1);
+        if (cc->name == NULL) {
+            cache_entry_free (e);
+            return NULL;
+        }
+        memcpy (cc->name, col->name, col->namelen);
+        cc->name[col->namelen] = 0;
+        cc->namelen = col->namelen;
+        cc->type = col->type;
+        cc->max = col->max;
+        e->bytes += col->namelen + 1;
+    }
+    return e;
+}
+
+
+/*
+** Append the fetched rows to the entry: for each value a byte telling
+** NULL from not NULL, then the lengths and bytes of character and
+** binary values, the bytes of NUMBERs and their decoded values, or the
+** fixed size buffer of the other types.
+** Return 0 if the entry outgrows the budget or memory is short.
+*/
+static int
+cache_append (cache_entry *e, cur_data *cur, size_t budget) {
+    size_t row = 0;
+    int i;
+
+    for (row = 0; row < cur->nrows; row++)
+        for (i = 0; i < cur->numcols; i++) {
+            column_data *col = &(cur->cols[i]);
+            const ub1 *v = (const ub1 *) col->buf + row * col->size;
+            size_t need = 1 + sizeof(ub2) + col->size + sizeof(num_value);
+            char *p;
+
+            if (e->used + need > e->size) {
+                size_t size = e->size ? e->size : 4096;
+                char *data;
+                while (e->used + need > size)
+                    size *= 2;
+                if (e->bytes + size > budget
+                        || (data = (char *) realloc (e->data, size)) == NULL)
+                    return 0;
+                e->data = data;
+                e->size = size;
+            }
+
+            p = e->data + e->used;
+            if (col->null[row]) {
+                *p++ = 0;
+                e->used = p - e->data;
+                continue;
+            }
+            *p++ = 1;
+            switch (col->dtype) {
+                case SQLT_CHR:
+                case SQLT_BIN:
+                case SQLT_LBI:
+                    memcpy (p, &col->len[row], sizeof(ub2));
+                    p += sizeof(ub2);
+                    memcpy (p, v, col->len[row]);
+                    p += col->len[row];
+                    break;
+
+                case SQLT_VNU: {
+                    size_t len = v[0] < OCI_NUMBER_SIZE ? v[0] + 1 : OCI_NUMBER_SIZE;
+                    memcpy (p, v, len);
+                    p += len;
+                    memcpy (p, &col->nums[row], sizeof(num_value));
+                    p += sizeof(num_value);
+                    break;
+                }
+
+                default:
+                    memcpy (p, v, col->size);
+                    p += col->size;
+                    break;
+            }
+            e->used = p - e->data;
+        }
+
+    e->nrows += cur->nrows;
+    return 1;
+}
+
+
+/*
+** Add the rows of a completed fetch to the result being cached; the
+** whole result enters the cache at the end.
+*/
+static void
+cache_fetched (cur_data *cur) {
+    cache_data *c = &cur->conn->env->cache;
+    if (cur->fill == NULL)
+        return;
+    if (!cache_append (cur->fill, cur, c->budget)) {
+        cache_entry_free (cur->fill);
+        cur->fill = NULL;
+    }
+    else if (cur->eof) {
+        cache_insert (c, cur->fill);
+        cur->fill = NULL;
+    }
+}
+
+
+/*
+** Fetch the rest of the result of a cursor into its entry being
+** filled, without Lua: run by a worker for pool:gather. Short of
+** memory, the entry is dropped and the drain ends.
+*/
+static sword
+cur_drain (cur_data *cur) {
+    sword status;
+    while (!cur->eof) {
+        status = OCIStmtFetch2 (cur->stmthp, cur->errhp, cur->arraysize,
+            OCI_FETCH_NEXT, (sb4) 0, OCI_DEFAULT);
+        if ((status = fetched_rows (cur, status)) != OCI_SUCCESS)
+            return status;
+        if (!cache_append (cur->fill, cur, (size_t) -1)) {
+            cache_entry_free (cur->fill);
+            cur->fill = NULL;
+            break;
+        }
+    }
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Copy the next rows of the cached result to the define buffers.
+** Return the number of rows.
+*/
+static ub4
+replay_rows (cur_data *cur) {
+    cache_entry *e = cur->replay;
+    const char *p = e->data + cur->replay_off;
+    ub4 n = 0;
+    int i;
+
+    for (; n < cur->arraysize && cur->replay_row < e->nrows; n++, cur->replay_row++)
+        for (i = 0; i < cur->numcols; i++) {
+            column_data *col = &(cur->cols[i]);
+            ub1 *v = (ub1 *) col->buf + n * col->size;
+
+            col->null[n] = *p++ ? 0 : -1;
+            if (col->null[n])
+                continue;
+            switch (col->dtype) {
+                case SQLT_CHR:
+                case SQLT_BIN:
+                case SQLT_LBI:
+                    memcpy (&col->len[n], p, sizeof(ub2));
+                    p += sizeof(ub2);
+                    memcpy (v, p, col->len[n]);
+                    p += col->len[n];
+                    break;
+
+                case SQLT_VNU: {
+                    size_t len = (ub1) p[0] < OCI_NUMBER_SIZE ? (ub1) p[0] + 1
+                        : OCI_NUMBER_SIZE;
+                    memcpy (v, p, len);
+                    p += len;
+                    memcpy (&col->nums[n], p, sizeof(num_value));
+                    p += sizeof(num_value);
+                    break;
+                }
+
+                default:
+                    memcpy (v, p, col->size);
+                    p += col->size;
+                    break;
+            }
+        }
+
+    cur->replay_off = p - e->data;
+    cur->nrows = n;
+    if (cur->replay_row == e->nrows)
+        cur->eof = 1;
+    return n;
+}
+
+
+/*
+** Check whether the session of a connection has an open transaction.
+*/
+static int
+conn_intransaction (conn_data *conn) {
+    OCISession *authp = conn->authp;
+    boolean txn = FALSE;
+    if (authp == NULL && OCIAttrGet ((dvoid *) conn->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) &authp, (ub4 *)0, OCI_ATTR_SESSION, conn->errhp))
+        return 0;
+    OCIAttrGet ((dvoid *) authp, OCI_HTYPE_SESSION, (dvoid *) &txn,
+        (ub4 *)0, OCI_ATTR_TRANSACTION_IN_PROGRESS, conn->errhp);
+    return txn ? 1 : 0;
+}
+
+
+/*
+** Read the 'cache' option of the options table at index 3: true for the
+** lifetime of the environment cache or a lifetime in seconds.
+** Results are not cached inside a transaction, whose changes other
+** sessions do not see.
+** Return the lifetime in microseconds, 0 if the result is not cached.
+*/
+static uint64_t
+cache_option (lua_State *L, conn_data *conn) {
+    env_data *env = conn->env;
+    uint64_t ttl = 0;
+    if (env->cache.budget == 0 || !lua_istable (L, 3))
+        return 0;
+    lua_getfield (L, 3, "cache");
+    if (lua_isboolean (L, -1) && lua_toboolean (L, -1))
+        ttl = env->cache.ttl;
+    else if (lua_type (L, -1) == LUA_TNUMBER && lua_tonumber (L, -1) > 0)
+        ttl = (uint64_t) (lua_tonumber (L, -1) * 1e6);
+    lua_pop (L, 1);
+    if (ttl && conn_intransaction (conn))
+        return 0;
+    return ttl;
+}
+
+
+/*
+** Push the cache key of a query: the user and data source of the
+** connection, the SQL text with runs of white space outside literals
+** and quoted identifiers collapsed, then the bound values of the
+** statement.
+** Return the stack index of the key, or 0 if bound values cannot be
+** encoded.
+*/
+static int
+cache_key (lua_State *L, conn_data *conn, const char *sql, stmt_data *stmt) {
+    luaL_Buffer b;
+    int i, space = 0, quote = 0;
+
+    for (i = 0; stmt && i < stmt->nbinds; i++)
+        if (!stmt->binds[i]->null && stmt->binds[i]->type == SQLT_TIMESTAMP)
+            return 0;
+
+    luaL_buffinit (L, &b);
+    /* results differ between users and databases */
+    luaL_addstring (&b, conn->username);
+    luaL_addchar (&b, '@');
+    luaL_addstring (&b, conn->sourcename);
+    luaL_addchar (&b, '\0');
+    while (isspace ((unsigned char) *sql))
+        sql++;
+    for (; *sql; sql++) {
+        if (!quote && isspace ((unsigned char) *sql)) {
+            space = 1;
+            continue;
+        }
+        if (space) {
+            luaL_addchar (&b, ' ');
+            space = 0;
+        }
+        if (*sql == '\'' || *sql == '"') {
+            if (!quote)
+                quote = *sql;
+            else if (quote == *sql)
+                quote = 0;
+        }
+        luaL_addchar (&b, *sql);
+    }
+    luaL_addchar (&b, '\0');
+
+    for (i = 0; stmt && i < stmt->nbinds; i++) {
+        bind_data *bd = stmt->binds[i];
+        if (bd->name) {
+            luaL_addchar (&b, ':');
+            luaL_addstring (&b, bd->name);
+        } else {
+            luaL_addchar (&b, '#');
+            luaL_addlstring (&b, (const char *) &bd->pos, sizeof(ub4));
+        }
+        if (bd->null) {
+            luaL_addchar (&b, 'N');
+            continue;
+        }
+        luaL_addchar (&b, 'V');
+        luaL_addlstring (&b, (const char *) &bd->type, sizeof(ub2));
+        switch (bd->type) {
+            case SQLT_CHR:
+                luaL_addlstring (&b, (const char *) &bd->len, sizeof(ub2));
+                luaL_addlstring (&b, bd->text, bd->len);
+                break;
+            case SQLT_LNG:
+                luaL_addlstring (&b, (const char *) &bd->size, sizeof(sb4));
+                luaL_addlstring (&b, bd->text, bd->size);
+                break;
+            default:
+                luaL_addlstring (&b, (const char *) &bd->val, sizeof(bd->val));
+                break;
+        }
+    }
+    luaL_pushresult (&b);
+    return lua_gettop (L);
+}
+
+
+/*
+** Find the cached result of the key at the given index.
+*/
+static cache_entry *
+cache_get (lua_State *L, env_data *env, int key) {
+    size_t len;
+    const char *k = lua_tolstring (L, key, &len);
+    return cache_lookup (&env->cache, k, len);
+}
+
+
+/*
+** Begin caching the result of the cursor at index c under the key at
+** index key, if any; leave the cursor on top of the stack.
+*/
+static void
+cache_fill (lua_State *L, int c, int key, uint64_t ttl) {
+    if (key) {
+        cur_data *cur = (cur_data *) lua_touserdata (L, c);
+        size_t len;
+        const char *k = lua_tolstring (L, key, &len);
+        cur->fill = cache_begin (cur, k, len, ttl);
+    }
+    lua_settop (L, c);
+}
+
+
+/*
+** Normalize SQL text into its fingerprint: literals become '?', runs
+** of white space one space and the rest lower case, quoted identifiers
+** excepted. The first size bytes are written to out.
+** Return the hash of the whole fingerprint and set its length.
+*/
+static uint64_t
+fingerprint (const char *sql, char *out, size_t size, size_t *len) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t n = 0;
+    int space = 0;
+    char prev = 0;
+
+#define EMIT(ch) do { \
+        char c_ = (ch); \
+        if (space && n > 0) { \
+            if (n < size) out[n] = ' '; \
+            n++; \
+            h = (h ^ ' ') * 1099511628211ULL; \
+        } \
+        space = 0; \
+        if (n < size) out[n] = c_; \
+        n++; \
+        h = (h ^ (unsigned char) c_) * 1099511628211ULL; \
+        prev = c_; \
+    } while (0)
+
+    while (*sql) {
+        unsigned char c = (unsigned char) *sql;
+        if (isspace (c)) {
+            space = 1;
+            sql++;
+        }
+        else if (c == '\'') {
+            /* string literal, quotes doubled inside */
+            for (sql++; *sql; sql++)
+                if (*sql == '\'' && *++sql != '\'')
+                    break;
+            EMIT ('?');
+        }
+        else if (c == '"') {
+            EMIT ('"');
+            for (sql++; *sql && *sql != '"'; sql++)
+                EMIT (*sql);
+            if (*sql)
+                sql++;
+            EMIT ('"');
+        }
+        else if (isdigit (c) && !(isalnum ((unsigned char) prev) || prev == '_'
+                || prev == '$' || prev == '#')) {
+            /* numeric literal */
+            while (isdigit ((unsigned char) *sql) || *sql == '.'
+                    || *sql == 'e' || *sql == 'E')
+                sql++;
+            EMIT ('?');
+        }
+        else {
+            EMIT ((char) tolower (c));
+            sql++;
+        }
+    }
+
+#undef EMIT
+
+    *len = n;
+    return h;
+}
+
+
+static stats_entry *
+stats_new (const char *text, size_t len, uint64_t hash) {
+    size_t kept = len < LUASQL_OCI_STATS_TEXT ? len : LUASQL_OCI_STATS_TEXT;
+    stats_entry *st = (stats_entry *) calloc (1, sizeof(stats_entry));
+    if (st == NULL)
+        return NULL;
+    st->text = (char *) malloc (kept);
+    if (st->text == NULL) {
+        free (st);
+        return NULL;
+    }
+    memcpy (st->text, text, kept);
+    st->len = len;
+    st->hash = hash;
+    return st;
+}
+
+
+/*
+** Find the statistics of an SQL text, created on first use.
+** Return NULL if statistics are disabled or memory is short.
+*/
+static stats_entry *
+stats_lookup (env_data *env, const char *sql) {
+    stats_data *sd = &env->stats;
+    char text[LUASQL_OCI_STATS_TEXT];
+    stats_entry **b, *st;
+    uint64_t h;
+    size_t len;
+
+    if (!sd->enabled)
+        return NULL;
+
+    h = fingerprint (sql, text, sizeof(text), &len);
+    b = &sd->buckets[h % LUASQL_OCI_STATS_MAX];
+    for (st = *b; st; st = st->chain)
+        if (st->hash == h && st->len == len
+                && memcmp (st->text, text, len < sizeof(text) ? len : sizeof(text)) == 0)
+            return st;
+
+    if (sd->entries >= LUASQL_OCI_STATS_MAX) {
+        if (sd->other == NULL)
+            sd->other = stats_new ("<other>", 7, 0);
+        return sd->other;
+    }
+    st = stats_new (text, len, h);
+    if (st) {
+        st->chain = *b;
+        *b = st;
+        sd->entries++;
+    }
+    return st;
+}
+
+
+static void
+latency_add (latency_stats *l, uint64_t us) {
+    uint64_t v = us >> 1;
+    int i = 0;
+    while (v && i < STATS_BUCKETS - 1) {
+        v >>= 1;
+        i++;
+    }
+    l->buckets[i]++;
+    l->count++;
+    l->total += us;
+    if (us > l->max)
+        l->max = us;
+}
+
+
+/*
+** Record a finished execute call; an execute is one roundtrip.
+*/
+static void
+stats_execute (stats_entry *st, uint64_t us, sword status) {
+    if (st == NULL)
+        return;
+    st->executes++;
+    st->roundtrips++;
+    if (!OCI_OK (status) && status != OCI_NO_DATA)
+        st->errors++;
+    latency_add (&st->execute, us);
+}
+
+
+/*
+** Record a finished fetch call. Calls served from the prefetched rows
+** do not reach the server: a roundtrip is counted for slower calls.
+*/
+static void
+stats_fetch (stats_entry *st, uint64_t us, ub4 rows) {
+    if (st == NULL)
+        return;
+    st->fetches++;
+    st->rows += rows;
+    if (us > LUASQL_OCI_PREFETCH_RTT)
+        st->roundtrips++;
+    latency_add (&st->fetch, us);
+}
+
+
+/*
+** Time of the call which just finished: measured by the worker on
+** threaded connections.
+*/
+static uint64_t
+call_time (conn_data *conn, uint64_t start) {
+    return conn->threaded ? conn->job.elapsed : now_us () - start;
+}
+
+
+#define TRACING(env)    ((env)->trace.ring != NULL)
+
+
+/*
+** Record an OCI call in the trace ring of the environment.
+** The sequence number of a slot is cleared while it is written, so a
+** reader skips the slots being overwritten.
+*/
+static void
+trace_add (env_data *env, const char *name, stats_entry *tag, uint64_t begin,
+        uint64_t end, sword status, unsigned lane) {
+    trace_data *t = &env->trace;
+    uint64_t pos;
+    trace_event *e;
+
+    if (t->ring == NULL)
+        return;
+    pos = __atomic_fetch_add (&t->head, 1, __ATOMIC_RELAXED);
+    e = &t->ring[pos & (t->size - 1)];
+    __atomic_store_n (&e->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    e->begin = begin;
+    e->end = end;
+    e->name = name;
+    e->tag = tag;
+    e->status = status;
+    e->lane = lane;
+    __atomic_store_n (&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+** Record a call which just finished, as timed by call_time.
+*/
+static void
+trace_call (conn_data *conn, const char *name, stats_entry *tag,
+        uint64_t start, sword status) {
+    if (!TRACING (conn->env))
+        return;
+    if (conn->threaded)
+        trace_add (conn->env, name, tag, conn->job.started,
+            conn->job.started + conn->job.elapsed, status, conn->lane);
+    else
+        trace_add (conn->env, name, tag, start, now_us (), status, conn->lane);
+}
+
+
+/*
+** Read a piece of a LOB in polling mode.
+** The first piece starts a read of the whole LOB; *amount is set to the
+** bytes in the buffer. Return OCI_NEED_DATA while pieces remain.
+*/
+static sword
+lob_piece (conn_data *conn, OCIError *errhp, OCILobLocator *locp, ub1 csfrm,
+        ub1 piece, void *buf, ub4 size, ub4 *amount) {
+    oraub8 bytes = 0, chars = 0;
+    uint64_t start = TRACING (conn->env) ? now_us () : 0;
+    sword status = OCILobRead2 (conn->svchp, errhp, locp, &bytes, &chars,
+        (oraub8) 1, buf, (oraub8) size, piece, (dvoid *)0,
+        (OCICallbackLobRead2) 0, (ub2) 0, csfrm);
+    if (start)
+        trace_add (conn->env, "OCILobRead2", NULL, start, now_us (), status,
+            conn->lane);
+    *amount = (ub4) bytes;
+    return status;
+}
+
+
+/*
+** Abort an unfinished polling LOB read, so that the connection can run
+** other calls.
+*/
+static void
+lob_abort (conn_data *conn, OCIError *errhp) {
+    OCIBreak (conn->svchp, errhp);
+    OCIReset (conn->svchp, errhp);
+}
+
+
+/*
+** Push the whole content of a LOB as a string.
+** LOBs prefetched with the row are read without roundtrips.
+*/
+static void
+pushlob (lua_State *L, conn_data *conn, OCIError *errhp, OCILobLocator *locp,
+        ub1 csfrm) {
+    ub1 piece = OCI_FIRST_PIECE;
+    luaL_Buffer b;
+    sword status;
+    ub4 amount;
+
+    luaL_buffinit (L, &b);
+    do {
+        char *p = luaL_prepbuffer (&b);
+        status = lob_piece (conn, errhp, locp, csfrm, piece, p,
+            LUAL_BUFFERSIZE, &amount);
+        if (status != OCI_NEED_DATA) {
+            if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO
+                    && piece == OCI_NEXT_PIECE)
+                lob_abort (conn, errhp);
+            ASSERT_OCI (L, status, errhp);
+        }
+        luaL_addsize (&b, amount);
+        piece = OCI_NEXT_PIECE;
+    } while (status == OCI_NEED_DATA);
+    luaL_pushresult (&b);
+}
+
+
+typedef struct {
+    sb2           year;
+    ub1           month, day, hour, min, sec;
+    ub4           fsec;               /* nanoseconds */
+    int           tz;                 /* the value has a time zone */
+    sb1           tz_hour, tz_min;    /* offset from UTC, same signs */
+} datetime_parts;
+
+
+/*
+** Days from 1970-01-01 to the date of the proleptic Gregorian calendar.
+*/
+static int64_t
+days_from_civil (int64_t y, unsigned m, unsigned d) {
+    int64_t era;
+    unsigned yoe, doy, doe;
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned) (y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t) doe - 719468;
+}
+
+
+/*
+** Get the fields of a DATE or TIMESTAMP value of the buffers, with the
+** offset of TIMESTAMP WITH (LOCAL) TIME ZONE values.
+*/
+static sword
+datetime_get (cur_data *cur, column_data *col, ub4 row, datetime_parts *dt) {
+    dt->tz = 0;
+    dt->tz_hour = dt->tz_min = 0;
+    if (col->dtype == SQLT_DAT) {
+        /* century and year excess 100, time fields excess 1 */
+        const ub1 *d = (const ub1 *)col->buf + row * col->size;
+        dt->year = (sb2) ((d[0] - 100) * 100 + (d[1] - 100));
+        dt->month = d[2];
+        dt->day = d[3];
+        dt->hour = d[4] - 1;
+        dt->min = d[5] - 1;
+        dt->sec = d[6] - 1;
+        dt->fsec = 0;
+        return OCI_SUCCESS;
+    } else {
+        OCIDateTime *date = ((OCIDateTime **)col->buf)[row];
+        sword status = OCIDateTimeGetDate (cur->conn->env->envhp, cur->errhp,
+            date, &dt->year, &dt->month, &dt->day);
+        if (status != OCI_SUCCESS)
+            return status;
+        status = OCIDateTimeGetTime (cur->conn->env->envhp, cur->errhp,
+            date, &dt->hour, &dt->min, &dt->sec, &dt->fsec);
+        if (status != OCI_SUCCESS || col->dtype == SQLT_TIMESTAMP)
+            return status;
+        dt->tz = 1;
+        return OCIDateTimeGetTimeZoneOffset (cur->conn->env->envhp,
+            cur->errhp, date, &dt->tz_hour, &dt->tz_min);
+    }
+}
+
+
+/*
+** Write a date as an ISO 8601 string; return its length.
+*/
+static int
+datetime_iso (char *buf, size_t size, datetime_parts *dt) {
+    int n = snprintf (buf, size, "%04d-%02u-%02uT%02u:%02u:%02u",
+        dt->year, dt->month, dt->day, dt->hour, dt->min, dt->sec);
+    if (dt->fsec)
+        n += snprintf (buf + n, size - n, ".%09u", (unsigned) dt->fsec);
+    if (dt->tz) {
+        int off = dt->tz_hour * 60 + dt->tz_min;
+        n += snprintf (buf + n, size - n, "%c%02d:%02d", off < 0 ? '-' : '+',
+            abs (off) / 60, abs (off) % 60);
+    }
+    return n;
+}
+
+
+/*
+** Push a date in the given representation: a table of fields, seconds
+** since the epoch or an ISO 8601 string. Values without time zone are
+** taken as UTC; the others carry their offset in the string and the
+** tz_hour and tz_min fields.
+*/
+static void
+pushdatetime (lua_State *L, int format, datetime_parts *dt) {
+    switch (format) {
+        case DATETIME_EPOCH: {
+            int64_t days = days_from_civil (dt->year, dt->month, dt->day);
+            lua_Number t = (lua_Number) (days * 86400
+                + dt->hour * 3600 + dt->min * 60 + dt->sec
+                - dt->tz_hour * 3600 - dt->tz_min * 60);
+            if (dt->fsec)
+                t += dt->fsec / 1e9;
+            lua_pushnumber (L, t);
+            break;
+        }
+
+        case DATETIME_ISO: {
+            char buf[48];
+            lua_pushlstring (L, buf, datetime_iso (buf, sizeof(buf), dt));
+            break;
+        }
+
+        default:
+            lua_createtable(L, 0, dt->tz ? 9 : 7);
+
+            lua_pushliteral(L, "year");
+            lua_pushnumber(L, dt->year);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "month");
+            lua_pushnumber(L, dt->month);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "day");
+            lua_pushnumber(L, dt->day);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "hour");
+            lua_pushnumber(L, dt->hour);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "min");
+            lua_pushnumber(L, dt->min);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "sec");
+            lua_pushnumber(L, dt->sec);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "fsec");
+            lua_pushnumber(L, dt->fsec);
+            lua_rawset(L, -3);
+
+            if (dt->tz) {
+                lua_pushliteral(L, "tz_hour");
+                lua_pushnumber(L, dt->tz_hour);
+                lua_rawset(L, -3);
+
+                lua_pushliteral(L, "tz_min");
+                lua_pushnumber(L, dt->tz_min);
+                lua_rawset(L, -3);
+            }
+            break;
+    }
+}
+
+
+/*
+** Push a value on top of the stack.
+*/
+static int
+pushvalue (lua_State *L, cur_data *cur, int i, ub4 row) {
+    /* column index ranges from 1 to numcols */
+    /* C array index ranges from 0 to numcols-1 */
+    column_data *col = &(cur->cols[i-1]);
+    if (col->null[row]) {
+        /* Oracle NULL => Lua nil */
+        lua_pushnil (L);
+        return 1;
+    }
+
+    switch (col->type) {
+
+#ifdef _WITH_INT64
+
+        case SQLT_INT:
+            lua_pushinteger64(L, ((int64_t *)col->buf)[row]);
+            break;
+
+        case SQLT_UIN:
+            lua_pushunsigned64(L, ((uint64_t *)col->buf)[row]);
+            break;
+
+        case SQLT_NUM:
+        case SQLT_VNU: {
+            num_value *num = &col->nums[row];
+            if (num->kind == NUM_UNSIGNED)
+                lua_pushunsigned64(L, num->v.u64);
+            else if (num->kind == NUM_SIGNED)
+                lua_pushinteger64(L, num->v.i64);
+            else
+                lua_pushnumber(L, num->v.dbl);
+            break;
+        }
+
+#else
+
+        case SQLT_INT:
+            lua_pushnumber(L, ((int64_t *)col->buf)[row]);
+            break;
+
+        case SQLT_UIN:
+            lua_pushnumber(L, ((uint64_t *)col->buf)[row]);
+            break;
+
+        case SQLT_NUM:
+        case SQLT_VNU: {
+            num_value *num = &col->nums[row];
+            if (num->kind == NUM_UNSIGNED)
+                lua_pushnumber(L, (lua_Number) num->v.u64);
+            else if (num->kind == NUM_SIGNED)
+                lua_pushnumber(L, (lua_Number) num->v.i64);
+            else
+                lua_pushnumber(L, num->v.dbl);
+            break;
+        }
+
+#endif
+
+        case SQLT_FLT:
+            lua_pushnumber (L, ((double *)col->buf)[row]);
+            break;
+
+        case SQLT_CHR:
+        case SQLT_STR:
+        case SQLT_VCS:
+        case SQLT_AFC:
+        case SQLT_AVC:
+            lua_pushlstring (L, (char *)col->buf + row * col->size, col->len[row]);
+            break;
+
+        case SQLT_DAT:
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ: {
+            datetime_parts dt;
+            ASSERT_OCI (L, datetime_get (cur, col, row, &dt), cur->errhp);
+            pushdatetime (L, cur->datetime, &dt);
+            break;
+        }
+
+        case SQLT_BIN:
+        case SQLT_LBI:
+            lua_pushlstring (L, (char *)col->buf + row * col->size, col->len[row]);
+            break;
+
+        case SQLT_CLOB:
+            pushlob (L, cur->conn, cur->errhp,
+                ((OCILobLocator **)col->buf)[row], SQLCS_IMPLICIT);
+            break;
+
+        case SQLT_BLOB:
+            /* the character set form is ignored for binary LOBs */
+            pushlob (L, cur->conn, cur->errhp,
+                ((OCILobLocator **)col->buf)[row], 0);
+            break;
+
+        default:
+            luaL_error (L, LUASQL_PREFIX"unexpected error");
+    }
+    return 1;
+}
+
+
+/*
+** Close the cursor on top of the stack.
+** Return 1
+*/
+static int
+cur_close (lua_State *L) {
+    int i;
+    cur_data *cur = (cur_data *)luaL_checkudata (L, 1, LUASQL_CURSOR_OCI8);
+    luaL_argcheck (L, cur != NULL, 1, LUASQL_PREFIX"cursor expected");
+    if (cur->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+
+    /* a fetch may still use the statement */
+    if (cur->stmthp)
+        job_wait (cur->conn, cur->stmthp);
+
+    /* Deallocate buffers. */
+    if (cur->cols) {
+        free_buffers (cur);
+        for (i = 1; i <= cur->numcols; i++)
+            if (cur->cols[i-1].name)
+                free (cur->cols[i-1].name);
+        free (cur->cols);
+    }
+    if (cur->views)
+        free (cur->views);
+    if (cur->text)
+        free (cur->text);
+    if (cur->fill)
+        /* the result was not read to the end */
+        cache_entry_free (cur->fill);
+    if (cur->replay)
+        cache_release (cur->replay);
+
+    /* Nullify structure fields. */
+    if (cur->stmt) {
+        /* the statement handle belongs to a prepared statement */
+        cur->stmt->cur_counter--;
+        if (cur->failed)
+            cur->stmt->failed = 1;
+        if (cur->prefetch.autotune)
+            /* the next execution starts from the tuned value */
+            cur->stmt->prefetch.rows = cur->prefetch.rows;
+    }
+    else if (cur->stmthp)
+        stmt_release (cur->stmthp, cur->errhp, cur->failed);
+    if (cur->errhp)
+        OCIHandleFree ((dvoid *)cur->errhp, OCI_HTYPE_ERROR);
+
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->stmtref);
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->colnames);
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->coltypes);
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->columns);
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->keys);
+    luaL_unref (L, LUA_REGISTRYINDEX, cur->ffiref);
+
+    cur->closed = 1;
+    cur->batch.cursor = NULL;
+    cur->fill = NULL;
+    cur->replay = NULL;
+    cur->stmt = NULL;
+    cur->stmtref = LUA_NOREF;
+    cur->colnames = LUA_NOREF;
+    cur->coltypes = LUA_NOREF;
+    cur->columns = LUA_NOREF;
+    cur->keys = LUA_NOREF;
+    cur->ffiref = LUA_NOREF;
+
+    lua_pushboolean (L, 1);
+
+    /* Decrement cursor counter on connection object */
+    cur->conn->cur_counter--;
+
+    return 1;
+}
+
+
+/*
+** Account for a fetch call which returned the given status, started at
+** start (0 if untimed): count the fetched rows, cache and time them and
+** tune the prefetch. Used by fetch and the FFI, so it does not touch
+** Lua. Return the status of the fetch.
+*/
+static sword
+fetch_done (cur_data *cur, sword status, uint64_t start) {
+    trace_call (cur->conn, "OCIStmtFetch2", cur->stats, start, status);
+    /* time the call, not the polling */
+    if (cur->conn->threaded)
+        start = now_us () - cur->conn->job.elapsed;
+
+    status = fetched_rows (cur, status);
+    if (!OCI_OK (status)) {
+        cur->failed = 1;
+        return status;
+    }
+    cache_fetched (cur);
+    if (cur->stats)
+        stats_fetch (cur->stats, now_us () - start, cur->nrows);
+
+    /* a roundtrip was needed: prefetch more rows next time */
+    if (cur->prefetch.autotune && !cur->eof
+            && cur->prefetch.rows < cur->prefetch_max
+            && now_us () - start > LUASQL_OCI_PREFETCH_RTT) {
+        cur->prefetch.rows *= 2;
+        if (cur->prefetch.rows > cur->prefetch_max)
+            cur->prefetch.rows = cur->prefetch_max;
+        status = OCIAttrSet ((dvoid *)cur->stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&cur->prefetch.rows, (ub4)0, (ub4)OCI_ATTR_PREFETCH_ROWS,
+            cur->errhp);
+    }
+    return status;
+}
+
+
+/*
+** Fill the define buffers with the next batch of rows.
+** Return the number of rows fetched, 0 at the end of the result set
+** or -1 if the call is still executing in non-blocking mode.
+*/
+static int
+cur_refill (lua_State *L, cur_data *cur) {
+    uint64_t start = 0;
+    sword status;
+
+    cur->row = 0;
+    cur->nrows = 0;
+    if (cur->truncated)
+        return fetch_raise (L, cur, OCI_ERROR);
+    if (cur->eof)
+        return 0;
+
+    if (cur->replay)
+        return (int) replay_rows (cur);
+
+    if (cur->prefetch.autotune || cur->stats || TRACING (cur->conn->env))
+        start = now_us ();
+
+    if (cur->conn->threaded)
+        status = job_call (L, cur->conn, JOB_FETCH, cur->stmthp, cur->errhp,
+            cur->arraysize, OCI_DEFAULT);
+    else
+        status = OCIStmtFetch2 (cur->stmthp, cur->errhp, cur->arraysize,
+            OCI_FETCH_NEXT, (sb4) 0, OCI_DEFAULT);
+
+    cur->fetching = status == OCI_STILL_EXECUTING;
+    if (cur->fetching)
+        return -1;
+
+    status = fetch_done (cur, status, start);
+    if (!OCI_OK (status))
+        return fetch_raise (L, cur, status);
+
+    return (int) cur->nrows;
+}
+
+
+/*
+** Redefine the column buffers for n rows.
+** Rows still buffered from the previous fetch would be lost, so the
+** buffers must be drained; a pending fetch would write to the freed
+** buffers, so it must be finished.
+*/
+static int
+set_arraysize (lua_State *L, cur_data *cur, ub4 n) {
+    if (cur->row < cur->nrows)
+        return luaL_error (L, LUASQL_PREFIX"fetched rows are pending");
+    if (cur->fetching || job_pending (cur->conn))
+        return luaL_error (L, LUASQL_PREFIX"another call is in progress");
+    free_buffers (cur);
+    cur->arraysize = n;
+    cur->row = cur->nrows = 0;
+    return alloc_buffers (L, cur);
+}
+
+
+/*
+** Push the column names used as keys of alphanumerical indices.
+** The strings are created once per cursor.
+*/
+static void
+pushkeys (lua_State *L, cur_data *cur) {
+    int i;
+    if (cur->keys != LUA_NOREF) {
+        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->keys);
+        return;
+    }
+    lua_createtable (L, cur->numcols, 0);
+    for (i = 1; i <= cur->numcols; i++) {
+        column_data *col = &(cur->cols[i-1]);
+        lua_pushlstring (L, (char *) col->name, col->namelen);
+        lua_rawseti (L, -2, i);
+    }
+    lua_pushvalue (L, -1);
+    cur->keys = luaL_ref (L, LUA_REGISTRYINDEX);
+}
+
+
+/*
+** Copy the values of the row to the table at the given index.
+** If keys is not 0, it is the stack index of the column names and
+** the values are also copied to alphanumerical indices.
+*/
+static void
+fillrow (lua_State *L, cur_data *cur, ub4 row, int t, int num, int keys) {
+    int i;
+    if (num)
+        /* Copy values to numerical indices */
+        for (i = 1; i <= cur->numcols; i++) {
+            pushvalue (L, cur, i, row);
+            lua_rawseti (L, t, i);
+        }
+    if (keys)
+        /* Copy values to alphanumerical indices */
+        for (i = 1; i <= cur->numcols; i++) {
+            lua_rawgeti (L, keys, i);
+            pushvalue (L, cur, i, row);
+            lua_rawset (L, t);
+        }
+}
+
+
+/*
+** Get another row of the given cursor.
+** With a table, the row is copied to it; with an options string
+** instead, a new table sized for the row is returned.
+*/
+static int
+cur_fetch (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    ub4 row;
+
+    if (cur->row >= cur->nrows) {
+        int status = cur_refill (L, cur);
+
+        if (status < 0) {
+            lua_pushnil(L);
+            lua_pushinteger(L, OCI_STILL_EXECUTING);
+            return 2;
+        }
+
+        if (status == 0) {
+            /* No more rows */
+            cur_close (L);
+            lua_pop (L, 1);
+            lua_pushnil (L);
+            return 1;
+        }
+    }
+
+    row = cur->row++;
+
+    if (lua_istable (L, 2) || lua_type (L, 2) == LUA_TSTRING) {
+        const char *opts;
+        int num, keys = 0;
+
+        if (lua_istable (L, 2))
+            opts = luaL_optstring (L, 3, "n");
+        else {
+            opts = lua_tostring (L, 2);
+            lua_settop (L, 2);
+        }
+        num = strchr (opts, 'n') != NULL;
+        if (strchr (opts, 'a') != NULL) {
+            pushkeys (L, cur);
+            keys = lua_gettop (L);
+        }
+        if (!lua_istable (L, 2)) {
+            lua_createtable (L, num ? cur->numcols : 0, keys ? cur->numcols : 0);
+            lua_replace (L, 2);
+        }
+        fillrow (L, cur, row, 2, num, keys);
+        lua_pushvalue(L, 2);
+        return 1; /* return table */
+    }
+    else {
+        int i;
+        luaL_checkstack (L, cur->numcols, LUASQL_PREFIX"too many columns");
+        for (i = 1; i <= cur->numcols; i++)
+            pushvalue (L, cur, i, row);
+        return cur->numcols; /* return #numcols values */
+    }
+}
+
+
+/*
+** Make up to n rows available in the define buffers.
+** Rows left by fetch are used first, otherwise the buffers are grown to
+** n rows and refilled. Return the number of available rows; at the end
+** of the result set close the cursor, push nil and return 0; in
+** non-blocking mode push nil and OCI_STILL_EXECUTING and return -1.
+*/
+static int
+next_batch (lua_State *L, cur_data *cur, ub4 n) {
+    ub4 count;
+
+    if (cur->row >= cur->nrows) {
+        int status;
+
+        if (n > cur->arraysize)
+            set_arraysize (L, cur, n);
+
+        status = cur_refill (L, cur);
+
+        if (status < 0) {
+            lua_pushnil(L);
+            lua_pushinteger(L, OCI_STILL_EXECUTING);
+            return -1;
+        }
+
+        if (status == 0) {
+            /* No more rows */
+            cur_close (L);
+            lua_pop (L, 1);
+            lua_pushnil (L);
+            return 0;
+        }
+    }
+
+    count = cur->nrows - cur->row;
+    return (int) (count > n ? n : count);
+}
+
+
+/*
+** Get up to n rows of the given cursor as an array of tables.
+** Rows left in the define buffers by fetch are returned first, otherwise
+** the buffers are grown to n rows and filled by a single fetch call,
+** so fewer than n rows may be returned.
+*/
+static int
+cur_fetchmany (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    lua_Integer n = luaL_optinteger (L, 2, cur->arraysize);
+    const char *opts = luaL_optstring (L, 3, "n");
+    int narr = strchr (opts, 'n') != NULL ? cur->numcols : 0;
+    int nrec = strchr (opts, 'a') != NULL ? cur->numcols : 0;
+    int keys = 0, status;
+    ub4 count, r;
+
+    luaL_argcheck (L, n > 0, 2, LUASQL_PREFIX"positive number expected");
+    if (n > LUASQL_OCI_ARRAYMAX)
+        n = LUASQL_OCI_ARRAYMAX;
+
+    status = next_batch (L, cur, (ub4) n);
+    if (status <= 0)
+        return status < 0 ? 2 : 1;
+    count = (ub4) status;
+
+    if (nrec) {
+        pushkeys (L, cur);
+        keys = lua_gettop (L);
+    }
+    lua_createtable (L, count, 0);
+    for (r = 1; r <= count; r++) {
+        lua_createtable (L, narr, nrec);
+        fillrow (L, cur, cur->row++, lua_gettop (L), narr, keys);
+        lua_rawseti (L, -2, r);
+    }
+    return 1;
+}
+
+
+/*
+** Get up to n rows of the given cursor as a table of columns: an array
+** of values for each column name, with nil for NULL values.
+** Return the table and the number of rows.
+*/
+static int
+cur_fetchcolumns (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    lua_Integer n = luaL_optinteger (L, 2, cur->arraysize);
+    int keys, status, i;
+    ub4 count, r;
+
+    luaL_argcheck (L, n > 0, 2, LUASQL_PREFIX"positive number expected");
+    if (n > LUASQL_OCI_ARRAYMAX)
+        n = LUASQL_OCI_ARRAYMAX;
+
+    status = next_batch (L, cur, (ub4) n);
+    if (status <= 0)
+        return status < 0 ? 2 : 1;
+    count = (ub4) status;
+
+    pushkeys (L, cur);
+    keys = lua_gettop (L);
+    lua_createtable (L, 0, cur->numcols);
+    for (i = 1; i <= cur->numcols; i++) {
+        column_data *col = &(cur->cols[i-1]);
+        lua_rawgeti (L, keys, i);
+        lua_createtable (L, count, 0);
+        for (r = 0; r < count; r++)
+            if (!col->null[cur->row + r]) {
+                pushvalue (L, cur, i, cur->row + r);
+                lua_rawseti (L, -2, r + 1);
+            }
+        lua_rawset (L, -3);
+    }
+    cur->row += count;
+
+    lua_pushinteger (L, count);
+    return 2;
+}
+
+
+/*
+** Set the number of rows fetched by one call.
+*/
+static int
+cur_setarraysize (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    lua_Integer n = luaL_checkinteger (L, 2);
+    luaL_argcheck (L, n > 0 && n <= LUASQL_OCI_ARRAYMAX, 2,
+        LUASQL_PREFIX"invalid number of rows");
+    if ((ub4) n != cur->arraysize)
+        set_arraysize (L, cur, (ub4) n);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Switch the non-blocking mode of the connection.
+** Setting OCI_ATTR_NONBLOCKING_MODE toggles the current mode.
+*/
+static sword
+toggle_nonblocking (conn_data *conn) {
+    return OCIAttrSet ((dvoid *) conn->srvhp, (ub4) OCI_HTYPE_SERVER,
+        (dvoid *) 0, (ub4) 0, (ub4) OCI_ATTR_NONBLOCKING_MODE, conn->errhp);
+}
+
+
+/* state of cur:export, kept in a userdata */
+typedef struct {
+    cur_data     *cur;
+    int           fd;
+    int           csv;                /* RFC 4180 quoting, else TSV escapes */
+    char          sep;
+    int           header;
+    ub4           batch;              /* rows fetched by one call */
+    const char   *null;               /* text of NULL values */
+    size_t        nulllen;
+    lua_Integer   rows;
+    uint64_t      bytes;
+    size_t        n;                  /* bytes pending in buf */
+    int           inlob;              /* a LOB read is polling */
+    int           werrno;             /* write error inside a LOB read */
+    char          buf[LUASQL_OCI_EXPORTBUF];
+    char          lob[LUASQL_OCI_LOBCHUNK];
+} export_data;
+
+
+static void
+export_flush (lua_State *L, export_data *ex) {
+    size_t off = 0;
+    while (off < ex->n && ex->werrno == 0) {
+        ssize_t w = write (ex->fd, ex->buf + off, ex->n - off);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            ex->n = 0;
+            if (ex->inlob) {
+                /* raised by export_lob once the read is aborted */
+                ex->werrno = errno;
+                return;
+            }
+            luaL_error (L, LUASQL_PREFIX"write error: %s", strerror (errno));
+        }
+        off += (size_t) w;
+    }
+    ex->n = 0;
+}
+
+
+static void
+export_put (lua_State *L, export_data *ex, const char *s, size_t len) {
+    ex->bytes += len;
+    while (len > 0) {
+        size_t room = sizeof(ex->buf) - ex->n;
+        if (room == 0) {
+            export_flush (L, ex);
+            room = sizeof(ex->buf);
+        }
+        if (room > len)
+            room = len;
+        memcpy (ex->buf + ex->n, s, room);
+        ex->n += room;
+        s += room;
+        len -= room;
+    }
+}
+
+
+/*
+** Write text with the quotes of CSV doubled, or with the tabs, line
+** breaks and backslashes of TSV escaped.
+*/
+static void
+export_escape (lua_State *L, export_data *ex, const char *s, size_t len) {
+    size_t i, start = 0;
+    for (i = 0; i < len; i++) {
+        const char *esc = NULL;
+        if (ex->csv) {
+            if (s[i] == '"')
+                esc = "\"\"";
+        }
+        else switch (s[i]) {
+            case '\t': esc = "\\t"; break;
+            case '\n': esc = "\\n"; break;
+            case '\r': esc = "\\r"; break;
+            case '\\': esc = "\\\\"; break;
+        }
+        if (esc) {
+            export_put (L, ex, s + start, i - start);
+            export_put (L, ex, esc, 2);
+            start = i + 1;
+        }
+    }
+    export_put (L, ex, s + start, len - start);
+}
+
+
+/*
+** Write a text field, quoted in CSV when it holds a separator, a quote
+** or a line break.
+*/
+static void
+export_text (lua_State *L, export_data *ex, const char *s, size_t len) {
+    size_t i;
+    if (!ex->csv) {
+        export_escape (L, ex, s, len);
+        return;
+    }
+    for (i = 0; i < len; i++)
+        if (s[i] == ex->sep || s[i] == '"' || s[i] == '\r' || s[i] == '\n')
+            break;
+    if (i == len) {
+        export_put (L, ex, s, len);
+        return;
+    }
+    export_put (L, ex, "\"", 1);
+    export_escape (L, ex, s, len);
+    export_put (L, ex, "\"", 1);
+}
+
+
+/*
+** Write binary data in hexadecimal, as Oracle converts RAW to text.
+*/
+static void
+export_hex (lua_State *L, export_data *ex, const ub1 *p, size_t len) {
+    static const char digits[] = "0123456789ABCDEF";
+    char hex[256];
+    size_t i, k = 0;
+    for (i = 0; i < len; i++) {
+        hex[k++] = digits[p[i] >> 4];
+        hex[k++] = digits[p[i] & 15];
+        if (k == sizeof(hex)) {
+            export_put (L, ex, hex, k);
+            k = 0;
+        }
+    }
+    export_put (L, ex, hex, k);
+}
+
+
+/*
+** Stream a LOB to the output in pieces; CLOBs are always quoted in CSV.
+*/
+static void
+export_lob (lua_State *L, export_data *ex, OCILobLocator *locp, int binary) {
+    cur_data *cur = ex->cur;
+    ub1 piece = OCI_FIRST_PIECE;
+    sword status;
+    ub4 amount;
+
+    if (!binary && ex->csv)
+        export_put (L, ex, "\"", 1);
+    ex->inlob = 1;
+    do {
+        status = lob_piece (cur->conn, cur->errhp, locp,
+            binary ? 0 : SQLCS_IMPLICIT, piece, ex->lob, sizeof(ex->lob), &amount);
+        if (status != OCI_NEED_DATA && !OCI_OK (status))
+            break;
+        if (binary)
+            export_hex (L, ex, (const ub1 *) ex->lob, amount);
+        else
+            export_escape (L, ex, ex->lob, amount);
+        piece = OCI_NEXT_PIECE;
+    } while (status == OCI_NEED_DATA && ex->werrno == 0);
+    ex->inlob = 0;
+    if (status == OCI_NEED_DATA)
+        lob_abort (cur->conn, cur->errhp);
+    if (ex->werrno)
+        luaL_error (L, LUASQL_PREFIX"write error: %s", strerror (ex->werrno));
+    ASSERT_OCI (L, status, cur->errhp);
+    if (!binary && ex->csv)
+        export_put (L, ex, "\"", 1);
+}
+
+
+/*
+** Write the value of a column of the buffers as text.
+*/
+static void
+export_value (lua_State *L, export_data *ex, column_data *col, ub4 row) {
+    char buf[NUMBER_TEXT_SIZE];
+    int n;
+
+    if (col->null[row]) {
+        export_put (L, ex, ex->null, ex->nulllen);
+        return;
+    }
+
+    switch (col->dtype) {
+        case SQLT_INT:
+            n = snprintf (buf, sizeof(buf), "%" PRId64, ((int64_t *)col->buf)[row]);
+            export_put (L, ex, buf, n);
+            break;
+
+        case SQLT_UIN:
+            n = snprintf (buf, sizeof(buf), "%" PRIu64, ((uint64_t *)col->buf)[row]);
+            export_put (L, ex, buf, n);
+            break;
+
+        case SQLT_VNU:
+            n = number_text ((const ub1 *) &((OCINumber *)col->buf)[row], buf);
+            if (n == 0)
+                /* infinities */
+                n = snprintf (buf, sizeof(buf), "%.17g", col->nums[row].v.dbl);
+            export_put (L, ex, buf, n);
+            break;
+
+        case SQLT_FLT:
+            n = snprintf (buf, sizeof(buf), "%.17g", ((double *)col->buf)[row]);
+            export_put (L, ex, buf, n);
+            break;
+
+        case SQLT_CHR:
+            export_text (L, ex, (char *)col->buf + row * col->size, col->len[row]);
+            break;
+
+        case SQLT_DAT:
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ: {
+            datetime_parts dt;
+            ASSERT_OCI (L, datetime_get (ex->cur, col, row, &dt), ex->cur->errhp);
+            export_put (L, ex, buf, datetime_iso (buf, sizeof(buf), &dt));
+            break;
+        }
+
+        case SQLT_BIN:
+        case SQLT_LBI:
+            export_hex (L, ex, (const ub1 *)col->buf + row * col->size, col->len[row]);
+            break;
+
+        case SQLT_CLOB:
+        case SQLT_BLOB:
+            export_lob (L, ex, ((OCILobLocator **)col->buf)[row],
+                col->dtype == SQLT_BLOB);
+            break;
+
+        default:
+            luaL_error (L, LUASQL_PREFIX"unexpected error");
+    }
+}
+
+
+/*
+** Write the rest of the result set; run protected by cur_export.
+*/
+static int
+export_run (lua_State *L) {
+    export_data *ex = (export_data *) lua_touserdata (L, 1);
+    cur_data *cur = ex->cur;
+    const char *eol = ex->csv ? "\r\n" : "\n";
+    size_t eollen = strlen (eol);
+    int i;
+
+    if (ex->header) {
+        for (i = 0; i < cur->numcols; i++) {
+            if (i > 0)
+                export_put (L, ex, &ex->sep, 1);
+            export_text (L, ex, (char *) cur->cols[i].name, cur->cols[i].namelen);
+        }
+        export_put (L, ex, eol, eollen);
+    }
+
+    for (;;) {
+        if (cur->row >= cur->nrows) {
+            int status;
+            /* the buffers of a pending fetch are resized at the next one */
+            if (ex->batch != cur->arraysize && !cur->fetching)
+                set_arraysize (L, cur, ex->batch);
+            /* export blocks: wait for calls still executing */
+            while ((status = cur_refill (L, cur)) < 0)
+                job_settle (cur->conn);
+            if (status == 0)
+                break;
+        }
+        for (; cur->row < cur->nrows; cur->row++) {
+            for (i = 0; i < cur->numcols; i++) {
+                if (i > 0)
+                    export_put (L, ex, &ex->sep, 1);
+                export_value (L, ex, &(cur->cols[i]), cur->row);
+            }
+            export_put (L, ex, eol, eollen);
+            ex->rows++;
+        }
+    }
+    export_flush (L, ex);
+    return 0;
+}
+
+
+/*
+** Write the rest of the result set to a file descriptor or a new file
+** as CSV or TSV, without creating Lua values. The options are format
+** ('csv' or 'tsv'), header (column names, true by default), batch (rows
+** by fetch call) and null (text of NULL values, empty in CSV and \N in
+** TSV). NUMBER values keep all their digits, dates are ISO 8601 strings
+** and binary values hexadecimal. A non-blocking connection blocks for
+** the export. The cursor is closed at the end.
+** Return the number of rows and bytes written.
+*/
+static int
+cur_export (lua_State *L) {
+    static const char *const formats[] = { "csv", "tsv", NULL };
+    cur_data *cur = getcursor (L);
+    conn_data *conn = cur->conn;
+    const char *path = NULL, *null = NULL;
+    size_t nulllen = 0;
+    int format = 0, header = 1, fd = -1, status;
+    ub4 batch = cur->arraysize;
+    export_data *ex;
+
+    if (lua_type (L, 2) == LUA_TNUMBER)
+        fd = (int) lua_tointeger (L, 2);
+    else
+        path = luaL_checkstring (L, 2);
+
+    if (lua_istable (L, 3)) {
+        format = getoptionfield (L, 3, "format", format, formats);
+
+        lua_getfield (L, 3, "header");
+        if (lua_isboolean (L, -1))
+            header = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 3, "batch");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0)
+            batch = lua_tointeger (L, -1) < LUASQL_OCI_ARRAYMAX
+                ? (ub4) lua_tointeger (L, -1) : LUASQL_OCI_ARRAYMAX;
+        lua_pop (L, 1);
+
+        /* the string is kept by the options table */
+        lua_getfield (L, 3, "null");
+        if (lua_type (L, -1) == LUA_TSTRING)
+            null = lua_tolstring (L, -1, &nulllen);
+        lua_pop (L, 1);
+    }
+    if (null == NULL) {
+        null = format == 0 ? "" : "\\N";
+        nulllen = strlen (null);
+    }
+
+    ex = (export_data *) lua_newuserdata (L, sizeof(export_data));
+    ex->cur = cur;
+    ex->csv = format == 0;
+    ex->sep = ex->csv ? ',' : '\t';
+    ex->header = header;
+    ex->batch = batch;
+    ex->null = null;
+    ex->nulllen = nulllen;
+    ex->rows = 0;
+    ex->bytes = 0;
+    ex->n = 0;
+    ex->inlob = 0;
+    ex->werrno = 0;
+
+    if (conn->nonblocking && cur->fetching)
+        return luaL_error (L, LUASQL_PREFIX"another call is in progress");
+
+    if (path) {
+        fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return luaL_error (L, LUASQL_PREFIX"cannot open %s: %s", path,
+                strerror (errno));
+    }
+    ex->fd = fd;
+
+    /* the export blocks, as executemany does */
+    if (conn->nonblocking && toggle_nonblocking (conn) != OCI_SUCCESS) {
+        char errbuf[512];
+        oci_error_message (OCI_ERROR, conn->errhp, errbuf, sizeof(errbuf));
+        if (path)
+            close (fd);
+        return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+    }
+
+    lua_pushcfunction (L, export_run);
+    lua_pushvalue (L, -2);
+    status = lua_pcall (L, 1, 0, 0);
+    if (conn->nonblocking && toggle_nonblocking (conn) != OCI_SUCCESS)
+        /* the connection is left in blocking mode */
+        conn->nonblocking = 0;
+    if (path && close (fd) < 0 && status == 0) {
+        lua_pushfstring (L, LUASQL_PREFIX"write error: %s", strerror (errno));
+        status = 1;
+    }
+    if (status != 0)
+        return lua_error (L);
+
+    /* No more rows */
+    cur_close (L);
+    lua_pushinteger (L, ex->rows);
+    lua_pushnumber (L, (lua_Number) ex->bytes);
+    return 2;
+}
+
+
+/*
+** Create a reader of a LOB column of the current batch of fetched rows.
+** The row is the position in the batch of the last fetch, the last
+** returned row by default.
+** The reader returns the content in chunks of the given size and works
+** as an iterator of a generic for; closing the connection closes it.
+*/
+static int
+cur_lob (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    lua_Integer i = luaL_checkinteger (L, 2);
+    lua_Integer chunk = luaL_optinteger (L, 3, LUASQL_OCI_LOBCHUNK);
+    lua_Integer r = luaL_optinteger (L, 4, (lua_Integer) cur->row);
+    conn_data *conn = cur->conn;
+    column_data *col;
+    lob_data *lob;
+    ub4 row;
+
+    luaL_argcheck (L, i >= 1 && i <= cur->numcols, 2, LUASQL_PREFIX"invalid column");
+    luaL_argcheck (L, chunk > 0, 3, LUASQL_PREFIX"positive number expected");
+    col = &(cur->cols[i-1]);
+    luaL_argcheck (L, col->type == SQLT_CLOB || col->type == SQLT_BLOB, 2,
+        LUASQL_PREFIX"LOB column expected");
+    if (cur->nrows == 0)
+        return luaL_error (L, LUASQL_PREFIX"no fetched row");
+    luaL_argcheck (L, r >= 1 && r <= (lua_Integer) cur->nrows, 4,
+        LUASQL_PREFIX"row out of the fetched batch");
+
+    row = (ub4) r - 1;
+    if (col->null[row]) {
+        lua_pushnil (L);
+        return 1;
+    }
+
+    lob = (lob_data *) lua_newuserdata (L, sizeof(lob_data));
+    luasql_setmeta (L, LUASQL_LOB_OCI8);
+
+    /* fill in structure */
+    lob->closed = 0;
+    lob->state = LOB_START;
+    lob->conn = conn;
+    lob->errhp = NULL;
+    lob->locp = NULL;
+    lob->csfrm = col->type == SQLT_CLOB ? SQLCS_IMPLICIT : 0;
+    lob->chunk = (ub4) chunk;
+    lob->buf = NULL;
+    lob->next = conn->lobs;
+    conn->lobs = lob;
+
+    lob->buf = (char *) malloc (lob->chunk);
+    ASSERT_PTR (L, lob->buf);
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(lob->errhp), (ub4) OCI_HTYPE_ERROR, (size_t) 0,
+        (dvoid **) 0), cur->errhp);
+    /* the define buffers are reused by the next fetch */
+    ASSERT_OCI (L, OCIDescriptorAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(lob->locp), (ub4) OCI_DTYPE_LOB, (size_t) 0,
+        (dvoid **) 0), lob->errhp);
+    ASSERT_OCI (L, OCILobLocatorAssign (conn->svchp, lob->errhp,
+        ((OCILobLocator **)col->buf)[row], &lob->locp), lob->errhp);
+
+    return 1;
+}
+
+
+/*
+** Return the next chunk of the LOB or nil at the end.
+*/
+static int
+lob_read (lua_State *L) {
+    lob_data *lob = getlob (L);
+    sword status;
+    ub4 amount;
+
+    if (lob->state == LOB_DONE) {
+        lua_pushnil (L);
+        return 1;
+    }
+
+    status = lob_piece (lob->conn, lob->errhp, lob->locp, lob->csfrm,
+        lob->state == LOB_START ? OCI_FIRST_PIECE : OCI_NEXT_PIECE,
+        lob->buf, lob->chunk, &amount);
+    if (status == OCI_NEED_DATA)
+        lob->state = LOB_READING;
+    else {
+        if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO
+                && lob->state == LOB_READING)
+            lob_abort (lob->conn, lob->errhp);
+        lob->state = LOB_DONE;
+        ASSERT_OCI (L, status, lob->errhp);
+    }
+
+    if (amount == 0)
+        lua_pushnil (L);
+    else
+        lua_pushlstring (L, lob->buf, amount);
+    return 1;
+}
+
+
+/*
+** Release the resources of a LOB reader and detach it from its
+** connection.
+** An unfinished polling read must be drained before the connection can
+** run other calls.
+*/
+static void
+lob_free (lob_data *lob) {
+    lob_data **p;
+
+    if (lob->state == LOB_READING) {
+        ub4 amount;
+        sword status;
+        while ((status = lob_piece (lob->conn, lob->errhp, lob->locp,
+                lob->csfrm, OCI_NEXT_PIECE, lob->buf, lob->chunk,
+                &amount)) == OCI_NEED_DATA)
+            ;
+        if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO)
+            lob_abort (lob->conn, lob->errhp);
+    }
+
+    if (lob->locp)
+        OCIDescriptorFree ((dvoid *)lob->locp, OCI_DTYPE_LOB);
+    if (lob->errhp)
+        OCIHandleFree ((dvoid *)lob->errhp, OCI_HTYPE_ERROR);
+    if (lob->buf)
+        free (lob->buf);
+
+    for (p = &lob->conn->lobs; *p != NULL; p = &(*p)->next)
+        if (*p == lob) {
+            *p = lob->next;
+            break;
+        }
+
+    /* Nullify structure fields. */
+    lob->closed = 1;
+    lob->state = LOB_DONE;
+    lob->locp = NULL;
+    lob->errhp = NULL;
+    lob->buf = NULL;
+    lob->next = NULL;
+}
+
+
+/*
+** Close the LOB reader.
+*/
+static int
+lob_close (lua_State *L) {
+    lob_data *lob = (lob_data *)luaL_checkudata (L, 1, LUASQL_LOB_OCI8);
+    luaL_argcheck (L, lob != NULL, 1, LUASQL_PREFIX"LOB reader expected");
+    if (lob->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+
+    lob_free (lob);
+
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Return the FFI view of the cursor as a light userdata, to be cast to
+** 'luasql_oci_batch *'. Rows left in the buffers by fetch are exposed.
+** The view anchors the cursor, which is not collected before it is
+** closed.
+*/
+static int
+cur_ffi (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    luaL_argcheck (L, !cur->conn->threaded, 1,
+        LUASQL_PREFIX"not available on threaded connections");
+    if (cur->ffiref == LUA_NOREF) {
+        lua_pushvalue (L, 1);
+        cur->ffiref = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+    update_views (cur);
+    lua_pushlightuserdata (L, &cur->batch);
+    return 1;
+}
+
+
+/*
+** Fill the buffers of the batch with the next rows, without Lua.
+** Rows not read by fetch are returned first. Return the number of rows,
+** 0 at the end of the result set or -1 with batch->errmsg set; in
+** non-blocking mode -1 with an empty message means still executing.
+*/
+LUASQL_API int
+luasql_oci_fetch (luasql_oci_batch *batch) {
+    cur_data *cur = (cur_data *) batch->cursor;
+    sword status;
+
+    batch->errmsg[0] = 0;
+    if (cur == NULL || cur->closed) {
+        snprintf (batch->errmsg, sizeof(batch->errmsg), "cursor is closed");
+        return -1;
+    }
+
+    if (cur->truncated) {
+        fetch_error (cur, OCI_ERROR, batch->errmsg, sizeof(batch->errmsg));
+        return -1;
+    }
+
+    if (cur->row >= cur->nrows) {
+        cur->row = 0;
+        cur->nrows = 0;
+        if (cur->replay && !cur->eof)
+            replay_rows (cur);
+        else if (!cur->eof) {
+            uint64_t start = cur->prefetch.autotune || cur->stats
+                || TRACING (cur->conn->env) ? now_us () : 0;
+            status = OCIStmtFetch2 (cur->stmthp, cur->errhp, cur->arraysize,
+                OCI_FETCH_NEXT, (sb4) 0, OCI_DEFAULT);
+            cur->fetching = status == OCI_STILL_EXECUTING;
+            if (cur->fetching)
+                return -1;
+            status = fetch_done (cur, status, start);
+            if (!OCI_OK (status)) {
+                fetch_error (cur, status, batch->errmsg,
+                    sizeof(batch->errmsg));
+                return -1;
+            }
+        }
+    }
+
+    /* the rows are consumed by the caller */
+    update_views (cur);
+    cur->row = cur->nrows;
+    return (int) batch->rows;
+}
+
+
+/*
+** Set the representation of DATE and TIMESTAMP values:
+** 'table', 'epoch' or 'iso'.
+*/
+static int
+cur_setdateformat (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    cur->datetime = luaL_checkoption (L, 2, NULL, datetime_formats);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Return the list of field names as a table on top of the stack.
+*/
+static int
+cur_getcolnames (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    if (cur->colnames != LUA_NOREF)
+        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->colnames);
+    else {
+        int i;
+        lua_newtable (L);
+        for (i = 1; i <= cur->numcols; i++) {
+            column_data *col = &(cur->cols[i-1]);
+            lua_pushlstring (L, (char *) col->name, col->namelen);
+            lua_rawseti (L, -2, i);
+        }
+        lua_pushvalue (L, -1);
+        cur->colnames = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+    return 1;
+}
+
+
+/*
+**
+*/
+static char *
+getcolumntype (column_data *col) {
+    switch (col->type) {
+        case SQLT_CHR:
+        case SQLT_STR:
+        case SQLT_VCS:
+        case SQLT_AFC:
+        case SQLT_AVC:
+            return "string";
+
+#ifdef _WITH_INT64
+        case SQLT_FLT:
+            return "double";
+
+        case SQLT_INT:
+            return "integer";
+
+        case SQLT_UIN:
+            return "unsigned integer";
+
+        case SQLT_NUM:
+        case SQLT_VNU:
+            return "number";
+#else
+        case SQLT_FLT:
+        case SQLT_INT:
+        case SQLT_UIN:
+        case SQLT_NUM:
+        case SQLT_VNU:
+            return "number";
+#endif
+
+        case SQLT_DAT:
+            return "datetime";
+
+        case SQLT_TIMESTAMP:
+        case SQLT_TIMESTAMP_TZ:
+        case SQLT_TIMESTAMP_LTZ:
+            return "timestamp";
+
+        case SQLT_CLOB:
+            return "string";
+
+        case SQLT_BIN:
+        case SQLT_LBI:
+        case SQLT_BLOB:
+            return "binary";
+
+        default:
+            return "unknown";
+    }
+}
+
+
+/*
+** Return the list of field types as a table on top of the stack.
+*/
+static int
+cur_getcoltypes (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    if (cur->coltypes != LUA_NOREF)
+        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->coltypes);
+    else {
+        int i;
+        lua_newtable (L);
+        for (i = 1; i <= cur->numcols; i++) {
+            column_data *col = &(cur->cols[i-1]);
+            lua_pushnumber (L, i);
+            lua_pushstring (L, getcolumntype (col));
+            lua_rawset (L, -3);
+        }
+        lua_pushvalue (L, -1);
+        cur->coltypes = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+    return 1;
+}
+
+
+/*
+** Return the map by field names with description.
+*/
+static int
+cur_getcolumns (lua_State *L) {
+    cur_data *cur = getcursor (L);
+    if (cur->columns != LUA_NOREF)
+        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->columns);
+    else {
+        int i;
+        lua_createtable(L, 0, cur->numcols);
+        for (i = 1; i <= cur->numcols; i++) {
+            column_data *col = &(cur->cols[i-1]);
+
+            lua_pushlstring (L, (char *) col->name, col->namelen);
+
+            lua_createtable(L, 0, 2);
+
+            lua_pushliteral (L, "type");
+            lua_pushstring (L, getcolumntype (col));
+            lua_rawset(L, -3);
+
+            lua_pushliteral (L, "maxsize");
+            lua_pushinteger (L, col->max);
+            lua_rawset(L, -3);
+
+            lua_rawset(L, -3);
+        }
+        lua_pushvalue (L, -1);
+        cur->columns = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+    return 1;
+}
+
+
+/*
+** Push the number of rows.
+*/
+static int
+cur_numrows (lua_State *L) {
+    return luaL_error(L, LUASQL_PREFIX"unimplemented");
+}
+
+
+/*
+** Give up the pending connect of a connection.
+** A running connect is released by its worker when it finishes.
+*/
+static void
+connect_abandon (conn_data *conn) {
+    workers_data *w = &conn->env->connectors;
+    connect_data *c = conn->connect;
+    int done;
+
+    workers_lock (w);
+    done = c->job.state == JOB_DONE;
+    c->job.abandoned = 1;
+    pthread_mutex_unlock (&w->lock);
+    if (done)
+        connect_free (c);
+
+    conn->connect = NULL;
+    conn->env->conn_counter--;
+}
+
+
+/*
+** Close a Connection object.
+*/
+static int
+conn_close (lua_State *L) {
+    conn_data *conn = (conn_data *)luaL_checkudata (L, 1, LUASQL_CONNECTION_OCI8);
+    luaL_argcheck (L, conn != NULL, 1, LUASQL_PREFIX"connection expected");
+    if (conn->connect)
+        connect_abandon (conn);
+    if (conn->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+    if (conn->cur_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are open cursors");
+    if (conn->stmt_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are open statements");
+
+    while (conn->lobs != NULL)
+        lob_free (conn->lobs);
+    job_free (conn);
+
+    if (conn->pool) {
+        /* the session goes back to the pool without open transaction */
+        if (conn_intransaction (conn))
+            OCITransRollback (conn->svchp, conn->errhp, OCI_DEFAULT);
+        OCISessionRelease (conn->svchp, conn->errhp, (OraText *)0, (ub4)0,
+            OCI_DEFAULT);
+        if (conn->errhp)
+            OCIHandleFree((dvoid *) conn->errhp, (ub4) OCI_HTYPE_ERROR);
+
+        conn->closed = 1;
+        conn->srvhp = NULL;
+        conn->svchp = NULL;
+        conn->authp = NULL;
+        conn->errhp = NULL;
+
+        conn->pool->conn_counter--;
+        conn->pool->released++;
+        luaL_unref (L, LUA_REGISTRYINDEX, conn->poolref);
+        conn->poolref = LUA_NOREF;
+
+        lua_pushboolean (L, 1);
+        return 1;
+    }
+
+    OCISessionEnd(conn->svchp, conn->errhp, conn->authp, (ub4) 0);
+    OCIServerDetach(conn->srvhp, conn->errhp, (ub4) OCI_DEFAULT);
+
+    if (conn->srvhp)
+        OCIHandleFree((dvoid *) conn->srvhp, (ub4) OCI_HTYPE_SERVER);
+    if (conn->svchp)
+        OCIHandleFree((dvoid *) conn->svchp, (ub4) OCI_HTYPE_SVCCTX);
+    if (conn->authp)
+        OCIHandleFree((dvoid *) conn->authp, (ub4) OCI_HTYPE_SESSION);
+    if (conn->errhp)
+        OCIHandleFree((dvoid *) conn->errhp, (ub4) OCI_HTYPE_ERROR);
+
+    /* Nullify structure fields. */
+    conn->closed = 1;
+    conn->srvhp = NULL;
+    conn->svchp = NULL;
+    conn->authp = NULL;
+    conn->errhp = NULL;
+
+    conn->env->conn_counter--;
+
+    lua_pushboolean (L, 1);
+
+    return 1;
+}
+
+/*
+** Abort current operation.
+*/
+static int
+conn_abort (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    ASSERT_OCI (L, OCIBreak(conn->srvhp, conn->errhp), conn->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+/*
+** Reset connection state.
+*/
+static int
+conn_reset (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    ASSERT_OCI (L, OCIReset(conn->srvhp, conn->errhp), conn->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Read the prefetch options of the table at the given index.
+** The 'prefetch' field is a number of rows or 'auto'.
+*/
+static void
+prefetch_options (lua_State *L, int t, prefetch_opts *pf) {
+    lua_getfield (L, t, "prefetch");
+    if (lua_type (L, -1) == LUA_TSTRING && strcmp (lua_tostring (L, -1), "auto") == 0)
+        pf->autotune = 1;
+    else if (lua_isnumber (L, -1) && lua_tointeger (L, -1) >= 0) {
+        pf->rows = (ub4) lua_tointeger (L, -1);
+        pf->autotune = 0;
+    }
+    lua_pop (L, 1);
+
+    lua_getfield (L, t, "prefetch_memory");
+    if (lua_isnumber (L, -1) && lua_tointeger (L, -1) >= 0)
+        pf->memory = (ub4) lua_tointeger (L, -1);
+    lua_pop (L, 1);
+}
+
+
+/*
+** Set the prefetch attributes of the statement.
+*/
+static sword
+set_prefetch (OCIStmt *stmthp, OCIError *errhp, prefetch_opts *pf) {
+    ub4 memory = pf->memory;
+    sword status;
+
+    if (pf->autotune && memory == 0)
+        memory = LUASQL_OCI_PREFETCH_BUDGET;
+
+    status = OCIAttrSet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+        (dvoid *)&pf->rows, (ub4)0, (ub4)OCI_ATTR_PREFETCH_ROWS, errhp);
+    if (status == OCI_SUCCESS)
+        status = OCIAttrSet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&memory, (ub4)0, (ub4)OCI_ATTR_PREFETCH_MEMORY, errhp);
+    return status;
+}
+
+
+/*
+** Bound the prefetch of an autotuned cursor by the memory budget
+** divided by the width of the described row.
+*/
+static int
+tune_prefetch (lua_State *L, cur_data *cur) {
+    ub4 width = 0, budget;
+    int i;
+
+    for (i = 0; i < cur->numcols; i++)
+        width += cur->cols[i].size + sizeof(sb2) + sizeof(ub2);
+
+    budget = cur->prefetch.memory ? cur->prefetch.memory : LUASQL_OCI_PREFETCH_BUDGET;
+    cur->prefetch_max = width ? budget / width : LUASQL_OCI_PREFETCH_MAX;
+    if (cur->prefetch_max > LUASQL_OCI_PREFETCH_MAX)
+        cur->prefetch_max = LUASQL_OCI_PREFETCH_MAX;
+    if (cur->prefetch_max < 1)
+        cur->prefetch_max = 1;
+
+    if (cur->prefetch.rows > cur->prefetch_max || cur->prefetch.rows == 0) {
+        cur->prefetch.rows = cur->prefetch_max;
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *)cur->stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&cur->prefetch.rows, (ub4)0, (ub4)OCI_ATTR_PREFETCH_ROWS,
+            cur->errhp), cur->errhp);
+    }
+    return 0;
+}
+
+
+/*
+** Describe a column of a cached result.
+*/
+static int
+replay_column (lua_State *L, cur_data *cur, int i) {
+    column_data *col = &(cur->cols[i-1]);
+    cache_column *cc = &(cur->replay->cols[i-1]);
+    col->name = (text *) strndup (cc->name, cc->namelen);
+    ASSERT_PTR (L, col->name);
+    col->namelen = cc->namelen;
+    col->type = cc->type;
+    col->max = cc->max;
+    define_type (col);
+    return 0;
+}
+
+
+/*
+** Create a new Cursor object and push it on top of the stack.
+** If owner is not 0, it is the stack index of the prepared statement
+** which keeps the statement handle. A cursor replaying a cached result
+** has no statement handle.
+*/
+static int
+create_cursor (lua_State *L, conn_data *conn, OCIStmt *stmt, const char *text,
+        int owner, prefetch_opts *pf, cache_entry *replay) {
+    int i;
+    cur_data *cur = (cur_data *) lua_newuserdata(L, sizeof(cur_data));
+    luasql_setmeta (L, LUASQL_CURSOR_OCI8);
+
+    /* fill in structure */
+    cur->conn = conn;
+    cur->stmt = NULL;
+    cur->stmtref = LUA_NOREF;
+    cur->closed = 0;
+    cur->eof = 0;
+    cur->failed = 0;
+    cur->fetching = 0;
+    cur->truncated = 0;
+    cur->numcols = 0;
+    cur->arraysize = conn->arraysize;
+    cur->datetime = conn->datetime;
+    cur->nrows = 0;
+    cur->row = 0;
+    cur->prefetch = *pf;
+    cur->prefetch_max = 0;
+    cur->colnames = LUA_NOREF;
+    cur->coltypes = LUA_NOREF;
+    cur->columns = LUA_NOREF;
+    cur->keys = LUA_NOREF;
+    cur->ffiref = LUA_NOREF;
+    cur->stmthp = stmt;
+    cur->errhp = NULL;
+    cur->cols = NULL;
+    cur->arena = NULL;
+    cur->views = NULL;
+    memset (&cur->batch, 0, sizeof(luasql_oci_batch));
+    cur->replay = NULL;
+    cur->replay_off = 0;
+    cur->replay_row = 0;
+    cur->fill = NULL;
+    cur->stats = NULL;
+    cur->text = strdup (text);
+    ASSERT_PTR (L, cur->text);
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(cur->errhp), (ub4) OCI_HTYPE_ERROR, (size_t) 0,
+        (dvoid **) 0), conn->errhp);
+    /* get number of columns */
+    if (replay) {
+        cur->replay = replay;
+        replay->refs++;
+        cur->numcols = replay->numcols;
+    } else
+        ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmt, (ub4)OCI_HTYPE_STMT,
+            (dvoid *) &cur->numcols, (ub4 *)0, (ub4)OCI_ATTR_PARAM_COUNT,
+            cur->errhp), cur->errhp);
+
+    cur->cols = (column_data *)calloc (cur->numcols, sizeof(column_data));
+    ASSERT_PTR (L, cur->cols);
+    cur->views = (luasql_oci_column *)calloc (cur->numcols, sizeof(luasql_oci_column));
+    ASSERT_PTR (L, cur->views);
+
+    /* define output variables */
+    /* Oracle and Lua column indices ranges from 1 to numcols */
+    /* C array indices ranges from 0 to numcols-1 */
+    for (i = 1; i <= cur->numcols; i++)
+        if (replay)
+            replay_column (L, cur, i);
+        else
+            describe_column (L, cur, i);
+    alloc_buffers (L, cur);
+
+    if (pf->autotune && !replay)
+        tune_prefetch (L, cur);
+
+    if (owner) {
+        cur->stmt = (stmt_data *) lua_touserdata (L, owner);
+        cur->stmt->cur_counter++;
+        lua_pushvalue (L, owner);
+        cur->stmtref = luaL_ref (L, LUA_REGISTRYINDEX);
+    }
+
+    conn->cur_counter++;
+
+    return 1;
+}
+
+
+/*
+** Drop the statement of a failed execute from the statement cache and
+** raise the error of the connection.
+*/
+static int
+execute_failed (lua_State *L, conn_data *conn, OCIStmt *stmthp,
+        sword status) {
+    char errbuf[512];
+    oci_error_message (status, conn->errhp, errbuf, sizeof(errbuf));
+    if (stmthp)
+        stmt_release (stmthp, conn->errhp, 1);
+    return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+}
+
+
+/*
+** Execute an SQL statement.
+** With the option cache, the rows of a query are served from the
+** result cache of the environment when present.
+** Return a Cursor object if the statement is a query, otherwise
+** return the number of tuples affected by the statement.
+*/
+static int
+conn_execute (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    const char *statement = luaL_checkstring (L, 2);
+    prefetch_opts pf = conn->prefetch;
+    uint64_t ttl = cache_option (L, conn);
+    stats_entry *st = stats_lookup (conn->env, statement);
+    uint64_t start;
+    sword status;
+    ub4 iters;
+    ub4 mode;
+    ub2 type;
+    int key = 0, polling = 0;
+    OCIStmt *stmthp = NULL;
+
+    if (lua_istable (L, 3))
+        prefetch_options (L, 3, &pf);
+
+    /* statement handle */
+    if (lua_gettop(L) >= 3 && lua_isuserdata (L, -1)) {
+        stmthp = (OCIStmt *) lua_touserdata(L, -1);
+        polling = stmthp == conn->exec_stmthp;
+    } else {
+        if (ttl) {
+            cache_entry *e;
+            key = cache_key (L, conn, statement, NULL);
+            if ((e = cache_get (L, conn->env, key)) != NULL)
+                return create_cursor (L, conn, NULL, statement, 0, &pf, e);
+        }
+        /* the statement cache is keyed by the SQL text */
+        start = now_us ();
+        status = OCIStmtPrepare2 (conn->svchp, &stmthp, conn->errhp,
+            (text *)statement, (ub4) strlen(statement), (OraText *)0, (ub4)0,
+            (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+        trace_add (conn->env, "OCIStmtPrepare2", st, start, now_us (), status,
+            conn->lane);
+        if (OCI_OK (status)) {
+            if (st)
+                latency_add (&st->prepare, now_us () - start);
+            status = set_prefetch (stmthp, conn->errhp, &pf);
+        }
+        if (!OCI_OK (status))
+            return execute_failed (L, conn, stmthp, status);
+    }
+
+    /* statement type */
+    status = OCIAttrGet ((dvoid *)stmthp, (ub4) OCI_HTYPE_STMT,
+        (dvoid *)&type, (ub4 *)0, (ub4)OCI_ATTR_STMT_TYPE, conn->errhp);
+    if (!OCI_OK (status))
+        return execute_failed (L, conn, stmthp, status);
+
+    iters = type == OCI_STMT_SELECT ? 0 : 1;
+    mode = conn->auto_commit ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+
+    /* execute statement, timed from its first poll */
+    start = polling ? conn->exec_start : now_us ();
+    if (conn->threaded)
+        status = job_call (L, conn, JOB_EXECUTE, stmthp, conn->errhp, iters, mode);
+    else
+        status = OCIStmtExecute (conn->svchp, stmthp, conn->errhp, iters,
+            (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, mode);
+    if (status == OCI_STILL_EXECUTING) {
+        conn->exec_stmthp = stmthp;
+        conn->exec_start = start;
+        lua_pushlightuserdata (L, (void *) stmthp);
+        lua_pushnumber (L, OCI_STILL_EXECUTING);
+        return 2;
+    }
+    conn->exec_stmthp = NULL;
+    trace_call (conn, "OCIStmtExecute", st, start, status);
+    stats_execute (st, call_time (conn, start), status);
+    if (status && (status != OCI_NO_DATA))
+        return execute_failed (L, conn, stmthp, status);
+    if (type == OCI_STMT_SELECT) {
+        /* create cursor */
+        create_cursor (L, conn, stmthp, statement, 0, &pf, NULL);
+        ((cur_data *) lua_touserdata (L, -1))->stats = st;
+        if (ttl) {
+            int cur = lua_gettop (L);
+            if (key == 0)
+                key = cache_key (L, conn, statement, NULL);
+            cache_fill (L, cur, key, ttl);
+        }
+        return 1;
+    } else {
+        /* return number of rows */
+        int rows_affected;
+        ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&rows_affected, (ub4 *)0,
+            (ub4)OCI_ATTR_ROW_COUNT, conn->errhp), conn->errhp);
+        stmt_release (stmthp, conn->errhp, 0);
+        if (st)
+            st->rows += rows_affected;
+        lua_pushnumber (L, rows_affected);
+        return 1;
+    }
+}
+
+
+/*
+** Make room for n more bytes of values.
+*/
+static void
+loader_reserve (lua_State *L, loader_data *ld, size_t n) {
+    char *data;
+    size_t size = ld->size;
+    if (ld->used + n <= size)
+        return;
+    while (ld->used + n > size)
+        size *= 2;
+    data = (char *) realloc (ld->data, size);
+    ASSERT_PTR (L, data);
+    ld->data = data;
+    ld->size = size;
+}
+
+
+/*
+** Convert the waiting rows to stream buffers and load them.
+** On failure the waiting rows and the partial stream are dropped, so
+** that the loader can go on with new rows or be finished.
+*/
+static void
+loader_flush (lua_State *L, loader_data *ld) {
+    ub4 r, rowoff = 0;
+    ub2 c;
+    sword status;
+    int more;
+    char errbuf[512];
+
+    if (ld->nrows == 0)
+        return;
+
+    /* the values do not move any more */
+    for (r = 0; r < ld->nrows; r++)
+        for (c = 0; c < ld->ncols; c++) {
+            size_t k = (size_t) r * ld->ncols + c;
+            status = OCIDirPathColArrayEntrySet (ld->dpca, ld->errhp, r, c,
+                (ub1 *) ld->data + ld->off[k], ld->len[k], ld->flg[k]);
+            if (!OCI_OK (status))
+                goto failed;
+        }
+
+    /* a full stream buffer is loaded and reused */
+    do {
+        ub4 count = 0;
+        status = OCIDirPathColArrayToStream (ld->dpca, ld->dpctx, ld->dpstr,
+            ld->errhp, ld->nrows, rowoff);
+        more = status == OCI_CONTINUE;
+        if (!more && !OCI_OK (status))
+            goto failed;
+        status = OCIAttrGet ((dvoid *)ld->dpca,
+            (ub4)OCI_HTYPE_DIRPATH_COLUMN_ARRAY, (dvoid *)&count, (ub4 *)0,
+            (ub4)OCI_ATTR_ROW_COUNT, ld->errhp);
+        if (!OCI_OK (status))
+            goto failed;
+        status = OCIDirPathLoadStream (ld->dpctx, ld->dpstr, ld->errhp);
+        if (!OCI_OK (status))
+            goto failed;
+        status = OCIDirPathStreamReset (ld->dpstr, ld->errhp);
+        if (!OCI_OK (status))
+            goto failed;
+        rowoff += count;
+    } while (more);
+
+    status = OCIDirPathColArrayReset (ld->dpca, ld->errhp);
+    if (!OCI_OK (status))
+        goto failed;
+    ld->loaded += ld->nrows;
+    ld->nrows = 0;
+    ld->used = 0;
+    return;
+
+failed:
+    oci_error_message (status, ld->errhp, errbuf, sizeof(errbuf));
+    OCIDirPathStreamReset (ld->dpstr, ld->errhp);
+    OCIDirPathColArrayReset (ld->dpca, ld->errhp);
+    ld->nrows = 0;
+    ld->used = 0;
+    luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+}
+
+
+/*
+** Start a value of the current row; its text follows in data.
+*/
+static void
+loader_value (loader_data *ld, ub2 c) {
+    size_t k = (size_t) ld->nrows * ld->ncols + c;
+    ld->off[k] = (ub4) ld->used;
+    ld->len[k] = 0;
+    ld->flg[k] = OCI_DIRPATH_COL_COMPLETE;
+}
+
+
+/*
+** End the value of column c of the current row.
+*/
+static void
+loader_endvalue (loader_data *ld, ub2 c, int null) {
+    size_t k = (size_t) ld->nrows * ld->ncols + c;
+    ld->len[k] = (ub4) (ld->used - ld->off[k]);
+    if (null)
+        ld->flg[k] = OCI_DIRPATH_COL_NULL;
+}
+
+
+/*
+** End the current row, loading the rows when the column array is full.
+*/
+static void
+loader_endrow (lua_State *L, loader_data *ld) {
+    if (++ld->nrows == ld->maxrows)
+        loader_flush (L, ld);
+}
+
+
+/*
+** Add an array of rows, each an array of values in the order of the
+** columns; nil is NULL, numbers are converted by Lua. Rows are sent
+** when the column array is full.
+** Return the number of added rows.
+*/
+static int
+loader_load (lua_State *L) {
+    loader_data *ld = getloader (L);
+    lua_Integer n, i;
+    ub2 c;
+
+    luaL_checktype (L, 2, LUA_TTABLE);
+    n = (lua_Integer) lua_rawlen (L, 2);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti (L, 2, i);
+        if (!lua_istable (L, -1))
+            return luaL_error (L, LUASQL_PREFIX"row #%d is not a table", (int) i);
+        for (c = 0; c < ld->ncols; c++) {
+            size_t len = 0;
+            const char *s = NULL;
+            lua_rawgeti (L, -1, c + 1);
+            if (!lua_isnil (L, -1)) {
+                s = lua_tolstring (L, -1, &len);
+                if (s == NULL)
+                    return luaL_error (L, LUASQL_PREFIX"row #%d, column #%d: "
+                        "%s value", (int) i, c + 1, luaL_typename (L, -1));
+            }
+            loader_reserve (L, ld, len);
+            loader_value (ld, c);
+            if (len > 0)
+                memcpy (ld->data + ld->used, s, len);
+            ld->used += len;
+            loader_endvalue (ld, c, s == NULL);
+            lua_pop (L, 1);
+        }
+        lua_pop (L, 1);
+        loader_endrow (L, ld);
+    }
+    lua_pushinteger (L, n);
+    return 1;
+}
+
+
+typedef struct {
+    loader_data  *ld;
+    FILE         *f;
+    int           sep;
+    int           header;
+    lua_Integer   rows;
+} csv_data;
+
+
+/*
+** Parse an RFC 4180 file into rows of the loader; run protected by
+** loader_loadcsv. An empty field without quotes is NULL; empty lines
+** are skipped.
+*/
+static int
+csv_run (lua_State *L) {
+    csv_data *csv = (csv_data *) lua_touserdata (L, 1);
+    loader_data *ld = csv->ld;
+    int c, inquotes = 0, started = 0;
+    ub2 col = 0;
+    lua_Integer line = 1;
+
+    if (csv->header) {
+        while ((c = getc (csv->f)) != EOF && c != '\n')
+            ;
+        line++;
+    }
+
+    for (;;) {
+        c = getc (csv->f);
+        if (inquotes) {
+            if (c == EOF)
+                return luaL_error (L, LUASQL_PREFIX"line %d: unterminated quote",
+                    (int) line);
+            if (c == '"') {
+                c = getc (csv->f);
+                if (c != '"') {
+                    inquotes = 0;
+                    ungetc (c, csv->f);
+                    continue;
+                }
+            }
+            else if (c == '\n')
+                line++;
+        }
+        else if (c == '\r')
+            continue;
+        else if (c == csv->sep || c == '\n' || c == EOF) {
+            if (c != csv->sep && !started && col == 0) {
+                /* empty line */
+                if (c == EOF)
+                    break;
+                line++;
+                continue;
+            }
+            if (col >= ld->ncols)
+                return luaL_error (L, LUASQL_PREFIX"line %d: more than %d fields",
+                    (int) line, ld->ncols);
+            if (!started)
+                loader_value (ld, col);
+            loader_endvalue (ld, col, !started);
+            started = 0;
+            if (c == csv->sep) {
+                col++;
+                continue;
+            }
+            if (col + 1 != ld->ncols)
+                return luaL_error (L, LUASQL_PREFIX"line %d: %d fields, %d expected",
+                    (int) line, col + 1, ld->ncols);
+            col = 0;
+            loader_endrow (L, ld);
+            csv->rows++;
+            if (c == EOF)
+                break;
+            line++;
+            continue;
+        }
+        else if (c == '"' && !started) {
+            if (col >= ld->ncols)
+                return luaL_error (L, LUASQL_PREFIX"line %d: more than %d fields",
+                    (int) line, ld->ncols);
+            loader_value (ld, col);
+            started = inquotes = 1;
+            continue;
+        }
+
+        if (!started) {
+            if (col >= ld->ncols)
+                return luaL_error (L, LUASQL_PREFIX"line %d: more than %d fields",
+                    (int) line, ld->ncols);
+            loader_value (ld, col);
+            started = 1;
+        }
+        if (ld->used == ld->size)
+            loader_reserve (L, ld, 1);
+        ld->data[ld->used++] = (char) c;
+    }
+
+    if (ferror (csv->f))
+        return luaL_error (L, LUASQL_PREFIX"read error");
+    return 0;
+}
+
+
+/*
+** Add the rows of a CSV file, parsed in C. The options are header (skip
+** the first line) and sep (the field separator, ',' by default).
+** Return the number of added rows.
+*/
+static int
+loader_loadcsv (lua_State *L) {
+    loader_data *ld = getloader (L);
+    const char *path = luaL_checkstring (L, 2);
+    csv_data *csv;
+    int status;
+
+    csv = (csv_data *) lua_newuserdata (L, sizeof(csv_data));
+    csv->ld = ld;
+    csv->f = NULL;
+    csv->sep = ',';
+    csv->header = 0;
+    csv->rows = 0;
+
+    if (lua_istable (L, 3)) {
+        lua_getfield (L, 3, "header");
+        if (lua_isboolean (L, -1))
+            csv->header = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 3, "sep");
+        if (lua_type (L, -1) == LUA_TSTRING && lua_rawlen (L, -1) == 1)
+            csv->sep = (unsigned char) *lua_tostring (L, -1);
+        lua_pop (L, 1);
+    }
+
+    csv->f = fopen (path, "rb");
+    if (csv->f == NULL)
+        return luaL_error (L, LUASQL_PREFIX"cannot open %s: %s", path,
+            strerror (errno));
+
+    lua_pushcfunction (L, csv_run);
+    lua_pushvalue (L, -2);
+    status = lua_pcall (L, 1, 0, 0);
+    fclose (csv->f);
+    if (status != 0)
+        /* the values of the failed line are dropped with its row */
+        return lua_error (L);
+
+    lua_pushinteger (L, csv->rows);
+    return 1;
+}
+
+
+/*
+** Load the waiting rows and finish the load, which commits it.
+** Return the number of loaded rows.
+*/
+static int
+loader_finish (lua_State *L) {
+    loader_data *ld = getloader (L);
+    loader_flush (L, ld);
+    ASSERT_OCI (L, OCIDirPathFinish (ld->dpctx, ld->errhp), ld->errhp);
+    ld->finished = 1;
+    lua_pushnumber (L, (lua_Number) ld->loaded);
+    return 1;
+}
+
+
+/*
+** Abort the load; nothing is saved.
+*/
+static int
+loader_abort (lua_State *L) {
+    loader_data *ld = getloader (L);
+    ld->finished = 1;
+    ASSERT_OCI (L, OCIDirPathAbort (ld->dpctx, ld->errhp), ld->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Close the loader, aborting an unfinished load.
+*/
+static int
+loader_close (lua_State *L) {
+    loader_data *ld = (loader_data *)luaL_checkudata (L, 1, LUASQL_LOADER_OCI8);
+    luaL_argcheck (L, ld != NULL, 1, LUASQL_PREFIX"loader expected");
+    if (ld->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+
+    if (!ld->finished && ld->dpctx && ld->errhp)
+        OCIDirPathAbort (ld->dpctx, ld->errhp);
+
+    if (ld->dpstr)
+        OCIHandleFree ((dvoid *)ld->dpstr, OCI_HTYPE_DIRPATH_STREAM);
+    if (ld->dpca)
+        OCIHandleFree ((dvoid *)ld->dpca, OCI_HTYPE_DIRPATH_COLUMN_ARRAY);
+    if (ld->dpctx)
+        OCIHandleFree ((dvoid *)ld->dpctx, OCI_HTYPE_DIRPATH_CTX);
+    if (ld->errhp)
+        OCIHandleFree ((dvoid *)ld->errhp, OCI_HTYPE_ERROR);
+    if (ld->data)
+        free (ld->data);
+    if (ld->off)
+        free (ld->off);
+    if (ld->len)
+        free (ld->len);
+    if (ld->flg)
+        free (ld->flg);
+
+    /* Nullify structure fields. */
+    ld->closed = 1;
+    ld->dpstr = NULL;
+    ld->dpca = NULL;
+    ld->dpctx = NULL;
+    ld->errhp = NULL;
+    ld->data = NULL;
+    ld->off = NULL;
+    ld->len = NULL;
+    ld->flg = NULL;
+
+    ld->conn->stmt_counter--;
+
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Create a direct path loader of the given columns of a table, named
+** as 'table' or 'schema.table'. The values are given as text and
+** converted by the server. The options are bufsize (bytes of a stream
+** buffer), rows (rows of the column array), dateformat (format of DATE
+** values) and sizes (longest text of the values by column name, 4000
+** by default). The connection must be neither threaded nor non-blocking.
+** Return a Loader object.
+*/
+static int
+conn_loader (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    const char *table = luaL_checkstring (L, 2);
+    const char *dot = strchr (table, '.');
+    const char *dateformat = NULL;
+    ub4 bufsize = LUASQL_OCI_LOADBUF, rows = conn->arraysize;
+    OCIParam *collist;
+    loader_data *ld;
+    lua_Integer n;
+    ub2 c;
+
+    luaL_checktype (L, 3, LUA_TTABLE);
+    n = (lua_Integer) lua_rawlen (L, 3);
+    luaL_argcheck (L, n > 0 && n <= 0xFFFF, 3, LUASQL_PREFIX"column names expected");
+    lua_settop (L, 4);
+
+    /* direct path calls are blocking and run on the calling thread */
+    if (conn->threaded || conn->nonblocking)
+        return luaL_error (L, LUASQL_PREFIX"loaders need a blocking connection");
+
+    if (lua_istable (L, 4)) {
+        lua_getfield (L, 4, "bufsize");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0)
+            bufsize = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 4, "rows");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0)
+            rows = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        /* the string is kept by the options table */
+        lua_getfield (L, 4, "dateformat");
+        if (lua_type (L, -1) == LUA_TSTRING)
+            dateformat = lua_tostring (L, -1);
+        lua_pop (L, 1);
+    }
+
+    ld = (loader_data *) lua_newuserdata (L, sizeof(loader_data));
+    luasql_setmeta (L, LUASQL_LOADER_OCI8);
+
+    /* fill in structure */
+    ld->closed = 0;
+    ld->finished = 0;
+    ld->conn = conn;
+    ld->errhp = NULL;
+    ld->dpctx = NULL;
+    ld->dpca = NULL;
+    ld->dpstr = NULL;
+    ld->ncols = (ub2) n;
+    ld->maxrows = 0;
+    ld->nrows = 0;
+    ld->loaded = 0;
+    ld->data = NULL;
+    ld->size = 0;
+    ld->used = 0;
+    ld->off = NULL;
+    ld->len = NULL;
+    ld->flg = NULL;
+    conn->stmt_counter++;
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(ld->errhp), (ub4) OCI_HTYPE_ERROR, (size_t) 0,
+        (dvoid **) 0), conn->errhp);
+
+    /* direct path context */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(ld->dpctx), (ub4) OCI_HTYPE_DIRPATH_CTX, (size_t) 0,
+        (dvoid **) 0), ld->errhp);
+    if (dot) {
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+            (dvoid *)table, (ub4)(dot - table), (ub4)OCI_ATTR_SCHEMA_NAME,
+            ld->errhp), ld->errhp);
+        table = dot + 1;
+    }
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+        (dvoid *)table, (ub4)strlen (table), (ub4)OCI_ATTR_NAME,
+        ld->errhp), ld->errhp);
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+        (dvoid *)&bufsize, (ub4)0, (ub4)OCI_ATTR_BUF_SIZE,
+        ld->errhp), ld->errhp);
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+        (dvoid *)&rows, (ub4)0, (ub4)OCI_ATTR_NUM_ROWS,
+        ld->errhp), ld->errhp);
+    if (dateformat)
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+            (dvoid *)dateformat, (ub4)strlen (dateformat), (ub4)OCI_ATTR_DATEFORMAT,
+            ld->errhp), ld->errhp);
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+        (dvoid *)&ld->ncols, (ub4)0, (ub4)OCI_ATTR_NUM_COLS,
+        ld->errhp), ld->errhp);
+
+    /* every column is given as text */
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *)ld->dpctx, (ub4)OCI_HTYPE_DIRPATH_CTX,
+        (dvoid *)&collist, (ub4 *)0, (ub4)OCI_ATTR_LIST_COLUMNS,
+        ld->errhp), ld->errhp);
+    for (c = 0; c < ld->ncols; c++) {
+        OCIParam *param;
+        const char *name;
+        ub2 type = SQLT_CHR;
+        ub4 size = LUASQL_OCI_LOADFIELD;
+        sword status;
+
+        lua_rawgeti (L, 3, c + 1);
+        name = lua_tostring (L, -1);
+        if (name == NULL)
+            return luaL_error (L, LUASQL_PREFIX"column #%d: name expected", c + 1);
+        if (lua_istable (L, 4)) {
+            lua_getfield (L, 4, "sizes");
+            if (lua_istable (L, -1)) {
+                lua_getfield (L, -1, name);
+                if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0)
+                    size = (ub4) lua_tointeger (L, -1);
+                lua_pop (L, 1);
+            }
+            lua_pop (L, 1);
+        }
+
+        ASSERT_OCI (L, OCIParamGet ((dvoid *)collist, (ub4)OCI_DTYPE_PARAM,
+            ld->errhp, (dvoid **)&param, (ub4)(c + 1)), ld->errhp);
+        status = OCIAttrSet ((dvoid *)param, (ub4)OCI_DTYPE_PARAM,
+            (dvoid *)name, (ub4)strlen (name), (ub4)OCI_ATTR_NAME, ld->errhp);
+        if (status == OCI_SUCCESS)
+            status = OCIAttrSet ((dvoid *)param, (ub4)OCI_DTYPE_PARAM,
+                (dvoid *)&type, (ub4)0, (ub4)OCI_ATTR_DATA_TYPE, ld->errhp);
+        if (status == OCI_SUCCESS)
+            status = OCIAttrSet ((dvoid *)param, (ub4)OCI_DTYPE_PARAM,
+                (dvoid *)&size, (ub4)0, (ub4)OCI_ATTR_DATA_SIZE, ld->errhp);
+        OCIDescriptorFree ((dvoid *)param, OCI_DTYPE_PARAM);
+        ASSERT_OCI (L, status, ld->errhp);
+        lua_pop (L, 1);
+    }
+
+    ASSERT_OCI (L, OCIDirPathPrepare (ld->dpctx, conn->svchp, ld->errhp),
+        ld->errhp);
+
+    /* column array and stream belong to the context */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) ld->dpctx,
+        (dvoid **) &(ld->dpca), (ub4) OCI_HTYPE_DIRPATH_COLUMN_ARRAY, (size_t) 0,
+        (dvoid **) 0), ld->errhp);
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) ld->dpctx,
+        (dvoid **) &(ld->dpstr), (ub4) OCI_HTYPE_DIRPATH_STREAM, (size_t) 0,
+        (dvoid **) 0), ld->errhp);
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *)ld->dpca,
+        (ub4)OCI_HTYPE_DIRPATH_COLUMN_ARRAY, (dvoid *)&ld->maxrows, (ub4 *)0,
+        (ub4)OCI_ATTR_NUM_ROWS, ld->errhp), ld->errhp);
+    if (ld->maxrows == 0)
+        ld->maxrows = 1;
+
+    ld->size = LUASQL_OCI_LOBCHUNK;
+    ld->data = (char *) malloc (ld->size);
+    ASSERT_PTR (L, ld->data);
+    ld->off = (ub4 *) malloc ((size_t) ld->maxrows * ld->ncols * sizeof(ub4));
+    ASSERT_PTR (L, ld->off);
+    ld->len = (ub4 *) malloc ((size_t) ld->maxrows * ld->ncols * sizeof(ub4));
+    ASSERT_PTR (L, ld->len);
+    ld->flg = (ub1 *) malloc ((size_t) ld->maxrows * ld->ncols);
+    ASSERT_PTR (L, ld->flg);
+
+    return 1;
+}
+
+
+/*
+** Find the bind slot of a position or a placeholder name.
+** The slot is created on first use.
+*/
+static bind_data *
+getbind (lua_State *L, stmt_data *stmt, ub4 pos, const char *name) {
+    bind_data *b, **binds;
+    int i;
+
+    for (i = 0; i < stmt->nbinds; i++) {
+        b = stmt->binds[i];
+        if (name ? (b->name && strcmp (b->name + 1, name) == 0)
+                 : (!b->name && b->pos == pos))
+            return b;
+    }
+
+    binds = (bind_data **)realloc (stmt->binds, (stmt->nbinds + 1) * sizeof(bind_data *));
+    ASSERT_PTR (L, binds);
+    stmt->binds = binds;
+
+    b = (bind_data *)calloc (1, sizeof(bind_data));
+    ASSERT_PTR (L, b);
+    stmt->binds[stmt->nbinds++] = b;
+
+    b->pos = pos;
+    b->null = -1;
+    if (name) {
+        /* keep the placeholder with the leading colon */
+        b->name = malloc (strlen (name) + 2);
+        ASSERT_PTR (L, b->name);
+        b->name[0] = ':';
+        strcpy (b->name + 1, name);
+    }
+    return b;
+}
+
+
+/*
+** Read an integer field of the table at the given index.
+*/
+static int
+getintfield (lua_State *L, int t, const char *k, int d) {
+    int v;
+    lua_getfield (L, t, k);
+    v = lua_isnumber (L, -1) ? (int) lua_tointeger (L, -1) : d;
+    lua_pop (L, 1);
+    return v;
+}
+
+
+/*
+** Copy the Lua value at the given index to the bind slot.
+** The slot is rebound only if its buffer, size or type has changed.
+*/
+static int
+bind_value (lua_State *L, stmt_data *stmt, bind_data *b, int idx) {
+    ub2 type = b->type;
+    void *ptr = b->ptr;
+    sb4 size = b->size;
+    ub2 *alen = NULL;
+
+    b->null = 0;
+
+    switch (lua_type (L, idx)) {
+        case LUA_TNIL:
+            b->null = -1;
+            if (ptr)
+                /* keep the previous binding */
+                return 0;
+            type = SQLT_CHR;
+            ptr = &b->val;
+            size = sizeof(b->val);
+            b->len = 0;
+            alen = &b->len;
+            break;
+
+        case LUA_TNUMBER: {
+            lua_Number n = lua_tonumber (L, idx);
+            if (n >= -9223372036854775808.0 && n < 9223372036854775808.0
+                    && (lua_Number)(int64_t) n == n) {
+                b->val.i64 = (int64_t) n;
+                type = SQLT_INT;
+            } else {
+                b->val.dbl = n;
+                type = SQLT_FLT;
+            }
+            ptr = &b->val;
+            size = sizeof(b->val);
+            break;
+        }
+
+        case LUA_TSTRING: {
+            size_t len;
+            const char *str = lua_tolstring (L, idx, &len);
+            if (len > (size_t) b->cap || !b->text) {
+                char *text = realloc (b->text, len + 1);
+                ASSERT_PTR (L, text);
+                b->text = text;
+                b->cap = (sb4) len + 1;
+            }
+            memcpy (b->text, str, len);
+            ptr = b->text;
+            if (len <= 0xFFFF) {
+                type = SQLT_CHR;
+                size = b->cap;
+                b->len = (ub2) len;
+                alen = &b->len;
+            } else {
+                type = SQLT_LNG;
+                size = (sb4) len;
+            }
+            break;
+        }
+
+        case LUA_TTABLE: {
+            /* the same fields as in fetched timestamps */
+            if (!b->date)
+                ASSERT_OCI (L, OCIDescriptorAlloc (stmt->conn->env->envhp,
+                    (dvoid **)&b->date, OCI_DTYPE_TIMESTAMP, (size_t)0,
+                    (dvoid **)0), stmt->errhp);
+            ASSERT_OCI (L, OCIDateTimeConstruct (stmt->conn->env->envhp,
+                stmt->errhp, b->date,
+                (sb2) getintfield (L, idx, "year", 1970),
+                (ub1) getintfield (L, idx, "month", 1),
+                (ub1) getintfield (L, idx, "day", 1),
+                (ub1) getintfield (L, idx, "hour", 0),
+                (ub1) getintfield (L, idx, "min", 0),
+                (ub1) getintfield (L, idx, "sec", 0),
+                (ub4) getintfield (L, idx, "fsec", 0),
+                (OraText *)0, (size_t)0), stmt->errhp);
+            type = SQLT_TIMESTAMP;
+            ptr = &b->date;
+            size = sizeof(OCIDateTime *);
+            break;
+        }
+
+#ifdef _WITH_INT64
+
+        case LUA_TUSERDATA:
+            if (lua_isinteger64 (L, idx)) {
+                b->val.i64 = lua_tointeger64 (L, idx);
+                type = SQLT_INT;
+            } else if (lua_isunsigned64 (L, idx)) {
+                b->val.u64 = lua_tounsigned64 (L, idx);
+                type = SQLT_UIN;
+            } else
+                return luaL_error (L, LUASQL_PREFIX"unsupported bind value (%s)",
+                    luaL_typename (L, idx));
+            ptr = &b->val;
+            size = sizeof(b->val);
+            break;
+
+#endif
+
+        default:
+            return luaL_error (L, LUASQL_PREFIX"unsupported bind value (%s)",
+                luaL_typename (L, idx));
+    }
+
+    if (type == b->type && ptr == b->ptr && size == b->size)
+        return 0;
+
+    if (b->name)
+        ASSERT_OCI (L, OCIBindByName (stmt->stmthp, &b->bind, stmt->errhp,
+            (text *)b->name, (sb4)strlen (b->name), ptr, size, type,
+            (dvoid *)&b->null, alen, (ub2 *)0, (ub4)0, (ub4 *)0,
+            OCI_DEFAULT), stmt->errhp);
+    else
+        ASSERT_OCI (L, OCIBindByPos (stmt->stmthp, &b->bind, stmt->errhp,
+            b->pos, ptr, size, type, (dvoid *)&b->null, alen, (ub2 *)0,
+            (ub4)0, (ub4 *)0, OCI_DEFAULT), stmt->errhp);
+
+    b->type = type;
+    b->ptr = ptr;
+    b->size = size;
+    return 0;
+}
+
+
+/*
+** Bind the values of the table at the given index.
+** Integer keys are positions, string keys are placeholder names with
+** or without the leading colon. Bind slots missing from the table are
+** set to NULL.
+*/
+static int
+bind_params (lua_State *L, stmt_data *stmt, int t) {
+    int i;
+    for (i = 0; i < stmt->nbinds; i++)
+        stmt->binds[i]->null = -1;
+
+    lua_pushnil (L);
+    while (lua_next (L, t) != 0) {
+        bind_data *b;
+        if (lua_type (L, -2) == LUA_TNUMBER) {
+            lua_Number pos = lua_tonumber (L, -2);
+            if (pos < 1 || pos != (lua_Number)(ub4) pos)
+                return luaL_error (L, LUASQL_PREFIX"invalid bind position");
+            b = getbind (L, stmt, (ub4) pos, NULL);
+        } else if (lua_type (L, -2) == LUA_TSTRING) {
+            const char *name = lua_tostring (L, -2);
+            b = getbind (L, stmt, 0, name[0] == ':' ? name + 1 : name);
+        } else
+            return luaL_error (L, LUASQL_PREFIX"invalid bind key");
+        bind_value (L, stmt, b, lua_gettop (L));
+        lua_pop (L, 1);
+    }
+    return 0;
+}
+
+
+/*
+** Execute a prepared statement with optional binds.
+** With the option cache, the rows of a query are served from the
+** result cache of the environment when present.
+** Return a Cursor object if the statement is a query, otherwise
+** return the number of tuples affected by the statement.
+*/
+static int
+stmt_execute (lua_State *L) {
+    stmt_data *stmt = getstatement (L);
+    conn_data *conn = stmt->conn;
+    prefetch_opts pf = stmt->prefetch;
+    uint64_t ttl = 0, start;
+    sword status;
+    ub4 iters;
+    ub4 mode;
+    int key = 0;
+
+    if (stmt->cur_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are open cursors");
+
+    if (lua_istable (L, 3))
+        prefetch_options (L, 3, &pf);
+
+    /* binds are already in place when polling a non-blocking execute */
+    if (!stmt->executing) {
+        if (lua_istable (L, 2))
+            bind_params (L, stmt, 2);
+        if (stmt->type == OCI_STMT_SELECT)
+            ttl = cache_option (L, conn);
+        if (ttl && (key = cache_key (L, conn, stmt->text, stmt)) != 0) {
+            cache_entry *e = cache_get (L, conn->env, key);
+            if (e)
+                return create_cursor (L, conn, NULL, stmt->text, 1, &pf, e);
+        }
+        if (stmt->type == OCI_STMT_SELECT)
+            ASSERT_OCI (L, set_prefetch (stmt->stmthp, stmt->errhp, &pf), stmt->errhp);
+    }
+    else if (stmt->type == OCI_STMT_SELECT)
+        ttl = cache_option (L, conn);
+
+    iters = stmt->type == OCI_STMT_SELECT ? 0 : 1;
+    mode = conn->auto_commit ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+
+    /* execute statement, timed from its first poll */
+    start = stmt->executing ? stmt->started : now_us ();
+    if (conn->threaded)
+        status = job_call (L, conn, JOB_EXECUTE, stmt->stmthp, stmt->errhp,
+            iters, mode);
+    else
+        status = OCIStmtExecute (conn->svchp, stmt->stmthp, stmt->errhp, iters,
+            (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, mode);
+    if (status == OCI_STILL_EXECUTING) {
+        stmt->started = start;
+        stmt->executing = 1;
+        lua_pushnil (L);
+        lua_pushinteger (L, OCI_STILL_EXECUTING);
+        return 2;
+    }
+    stmt->executing = 0;
+    trace_call (conn, "OCIStmtExecute", stmt->stats, start, status);
+    stats_execute (stmt->stats, call_time (conn, start), status);
+    if (status && (status != OCI_NO_DATA)) {
+        stmt->failed = 1;
+        ASSERT_OCI (L, status, stmt->errhp);
+    }
+
+    if (stmt->type == OCI_STMT_SELECT) {
+        /* create cursor */
+        create_cursor (L, conn, stmt->stmthp, stmt->text, 1, &pf, NULL);
+        ((cur_data *) lua_touserdata (L, -1))->stats = stmt->stats;
+        if (ttl) {
+            int cur = lua_gettop (L);
+            if (key == 0)
+                key = cache_key (L, conn, stmt->text, stmt);
+            cache_fill (L, cur, key, ttl);
+        }
+        return 1;
+    } else {
+        /* return number of rows */
+        ub4 rows_affected;
+        ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmt->stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&rows_affected, (ub4 *)0,
+            (ub4)OCI_ATTR_ROW_COUNT, stmt->errhp), stmt->errhp);
+        if (stmt->stats)
+            stmt->stats->rows += rows_affected;
+        lua_pushnumber (L, rows_affected);
+        return 1;
+    }
+}
+
+
+/*
+** Close a Statement object.
+*/
+static int
+stmt_close (lua_State *L) {
+    int i;
+    stmt_data *stmt = (stmt_data *)luaL_checkudata (L, 1, LUASQL_STATEMENT_OCI8);
+    luaL_argcheck (L, stmt != NULL, 1, LUASQL_PREFIX"statement expected");
+    if (stmt->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+    if (stmt->cur_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are open cursors");
+
+    /* an execute may still use the binds */
+    if (stmt->stmthp)
+        job_wait (stmt->conn, stmt->stmthp);
+
+    for (i = 0; i < stmt->nbinds; i++) {
+        bind_data *b = stmt->binds[i];
+        if (b->name)
+            free (b->name);
+        if (b->text)
+            free (b->text);
+        if (b->date)
+            OCIDescriptorFree (b->date, OCI_DTYPE_TIMESTAMP);
+        free (b);
+    }
+    if (stmt->binds)
+        free (stmt->binds);
+    if (stmt->text)
+        free (stmt->text);
+
+    /* Nullify structure fields. */
+    if (stmt->stmthp)
+        stmt_release (stmt->stmthp, stmt->errhp, stmt->failed);
+    if (stmt->errhp)
+        OCIHandleFree ((dvoid *)stmt->errhp, OCI_HTYPE_ERROR);
+
+    stmt->closed = 1;
+    stmt->nbinds = 0;
+    stmt->binds = NULL;
+    stmt->text = NULL;
+    stmt->stmthp = NULL;
+    stmt->errhp = NULL;
+
+    stmt->conn->stmt_counter--;
+
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Prepare an SQL statement for repeated execution.
+** Return a Statement object.
+*/
+static int
+conn_prepare (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    const char *statement = luaL_checkstring (L, 2);
+    stmt_data *stmt = (stmt_data *) lua_newuserdata(L, sizeof(stmt_data));
+    uint64_t start;
+    sword status;
+    luasql_setmeta (L, LUASQL_STATEMENT_OCI8);
+
+    /* fill in structure */
+    stmt->conn = conn;
+    stmt->closed = 0;
+    stmt->executing = 0;
+    stmt->failed = 0;
+    stmt->cur_counter = 0;
+    stmt->type = 0;
+    stmt->prefetch = conn->prefetch;
+    stmt->stmthp = NULL;
+    stmt->errhp = NULL;
+    stmt->nbinds = 0;
+    stmt->binds = NULL;
+    stmt->text = NULL;
+    stmt->stats = stats_lookup (conn->env, statement);
+
+    conn->stmt_counter++;
+
+    if (lua_istable (L, 3))
+        prefetch_options (L, 3, &stmt->prefetch);
+
+    stmt->text = strdup (statement);
+    ASSERT_PTR (L, stmt->text);
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
+        (dvoid **) &(stmt->errhp), (ub4) OCI_HTYPE_ERROR, (size_t) 0,
+        (dvoid **) 0), conn->errhp);
+
+    /* statement handle */
+    start = now_us ();
+    status = OCIStmtPrepare2 (conn->svchp, &stmt->stmthp, stmt->errhp,
+        (text *)statement, (ub4) strlen(statement), (OraText *)0, (ub4)0,
+        (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+    trace_add (conn->env, "OCIStmtPrepare2", stmt->stats, start, now_us (),
+        status, conn->lane);
+    if (!OCI_OK (status))
+        stmt->failed = 1;
+    ASSERT_OCI (L, status, stmt->errhp);
+    if (stmt->stats)
+        latency_add (&stmt->stats->prepare, now_us () - start);
+
+    /* statement type */
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmt->stmthp, (ub4) OCI_HTYPE_STMT,
+        (dvoid *)&stmt->type, (ub4 *)0, (ub4)OCI_ATTR_STMT_TYPE, stmt->errhp),
+        stmt->errhp);
+
+    return 1;
+}
+
+
+typedef struct {
+    const char   *name;    /* placeholder name, NULL for positional binds */
+    char         *placeholder; /* name with the leading colon */
+    int           ltype;   /* Lua type of the column values */
+    ub2           type;    /* bound SQLT type */
+    sb4           size;    /* size of one element */
+    char         *buf;     /* one element per row */
+    sb2          *null;    /* indicators, one per row */
+    ub2          *len;     /* actual lengths, one per row */
+    OCIBind      *bind;    /* bind handle */
+} array_bind;
+
+
+/*
+** Push the value of column j of the table on top of the stack.
+*/
+static void
+getcolvalue (lua_State *L, array_bind *col, ub4 j) {
+    if (col->name) {
+        lua_pushstring (L, col->name);
+        lua_rawget (L, -2);
+    } else
+        lua_rawgeti (L, -1, j);
+}
+
+
+/*
+** Choose the bind type and element size of column j from its values.
+*/
+static int
+describe_array_bind (lua_State *L, array_bind *col, ub4 j, ub4 n) {
+    ub4 r;
+    col->type = SQLT_CHR;
+    col->size = 1;
+    for (r = 1; r <= n; r++) {
+        int ltype;
+        lua_rawgeti (L, 3, r);
+        getcolvalue (L, col, j);
+        ltype = lua_type (L, -1);
+        if (ltype != LUA_TNIL) {
+            if (col->ltype == LUA_TNIL)
+                col->ltype = ltype;
+            else if (col->ltype != ltype)
+                return luaL_error (L, LUASQL_PREFIX"mixed value types in bind #%d", j);
+        }
+        switch (ltype) {
+            case LUA_TNIL:
+                break;
+
+            case LUA_TNUMBER: {
+                lua_Number v = lua_tonumber (L, -1);
+                if (col->type != SQLT_FLT)
+                    col->type = (v >= -9223372036854775808.0 && v < 9223372036854775808.0
+                        && (lua_Number)(int64_t) v == v) ? SQLT_INT : SQLT_FLT;
+                col->size = sizeof(int64_t);
+                break;
+            }
+
+            case LUA_TSTRING: {
+                size_t len;
+                lua_tolstring (L, -1, &len);
+                if (len > 0xFFFF)
+                    return luaL_error (L, LUASQL_PREFIX"value too long in bind #%d", j);
+                if ((sb4) len > col->size)
+                    col->size = (sb4) len;
+                break;
+            }
+
+            case LUA_TTABLE:
+                col->type = SQLT_TIMESTAMP;
+                col->size = sizeof(OCIDateTime *);
+                break;
+
+#ifdef _WITH_INT64
+
+            case LUA_TUSERDATA:
+                if (lua_isinteger64 (L, -1)) {
+                    if (col->type == SQLT_UIN)
+                        return luaL_error (L, LUASQL_PREFIX"mixed value types in bind #%d", j);
+                    col->type = SQLT_INT;
+                } else if (lua_isunsigned64 (L, -1)) {
+                    if (col->type == SQLT_INT)
+                        return luaL_error (L, LUASQL_PREFIX"mixed value types in bind #%d", j);
+                    col->type = SQLT_UIN;
+                } else
+                    return luaL_error (L, LUASQL_PREFIX"unsupported bind value (%s)",
+                        luaL_typename (L, -1));
+                col->size = sizeof(int64_t);
+                break;
+
+#endif
+
+            default:
+                return luaL_error (L, LUASQL_PREFIX"unsupported bind value (%s)",
+                    luaL_typename (L, -1));
+        }
+        lua_pop (L, 2);
+    }
+    return 0;
+}
+
+
+/*
+** Copy the value on top of the stack to element r of the column.
+*/
+static sword
+set_array_value (lua_State *L, conn_data *conn, array_bind *col, ub4 r) {
+    void *p = col->buf + (size_t) r * col->size;
+
+    col->null[r] = 0;
+    if (col->len)
+        col->len[r] = 0;
+
+    switch (lua_type (L, -1)) {
+        case LUA_TNIL:
+            col->null[r] = -1;
+            break;
+
+        case LUA_TNUMBER:
+            if (col->type == SQLT_INT)
+                *(int64_t *)p = (int64_t) lua_tonumber (L, -1);
+            else
+                *(double *)p = lua_tonumber (L, -1);
+            break;
+
+        case LUA_TSTRING: {
+            size_t len;
+            const char *str = lua_tolstring (L, -1, &len);
+            memcpy (p, str, len);
+            col->len[r] = (ub2) len;
+            break;
+        }
+
+        case LUA_TTABLE: {
+            int t = lua_gettop (L);
+            return OCIDateTimeConstruct (conn->env->envhp, conn->errhp,
+                *(OCIDateTime **)p,
+                (sb2) getintfield (L, t, "year", 1970),
+                (ub1) getintfield (L, t, "month", 1),
+                (ub1) getintfield (L, t, "day", 1),
+                (ub1) getintfield (L, t, "hour", 0),
+                (ub1) getintfield (L, t, "min", 0),
+                (ub1) getintfield (L, t, "sec", 0),
+                (ub4) getintfield (L, t, "fsec", 0),
+                (OraText *)0, (size_t)0);
+        }
+
+#ifdef _WITH_INT64
+
+        case LUA_TUSERDATA:
+            if (col->type == SQLT_INT)
+                *(int64_t *)p = lua_tointeger64 (L, -1);
+            else
+                *(uint64_t *)p = lua_tounsigned64 (L, -1);
+            break;
+
+#endif
+
+        default:
+            break;
+    }
+    return OCI_SUCCESS;
+}
+
+
+/*
+** Execute a DML statement once for every row of a table in a single
+** call, binding each column as an array.
+** Rows are tables of positional values or of values keyed by
+** placeholder names. With batch errors (the default) failing rows do
+** not abort the others.
+** Return the number of rows affected, an array of the failed rows
+** {row = i, code = n, message = s} and, if requested with the
+** 'rowcounts' option, an array with the rows affected by each row.
+*/
+static int
+conn_executemany (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    const char *statement = luaL_checkstring (L, 2);
+    int batcherrors = 1, rowcounts = 0;
+    ub4 n, ncols = 0, j, r;
+    ub4 mode;
+    ub2 type;
+    size_t total = 0;
+    char *mem;
+    char errbuf[512] = "";
+    sword status;
+    OCIStmt *stmthp = NULL;
+    OCIError *rowerrhp = NULL;
+    array_bind *cols;
+    stats_entry *st = stats_lookup (conn->env, statement);
+    uint64_t start;
+
+    luaL_checktype (L, 3, LUA_TTABLE);
+    if (lua_istable (L, 4)) {
+        lua_getfield (L, 4, "batcherrors");
+        if (lua_isboolean (L, -1))
+            batcherrors = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+        lua_getfield (L, 4, "rowcounts");
+        if (lua_isboolean (L, -1))
+            rowcounts = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+    }
+    lua_settop (L, 3);
+
+    /* the connection must not be in use by an asynchronous call */
+    if (job_pending (conn))
+        return luaL_error (L, LUASQL_PREFIX"another call is in progress");
+
+    n = (ub4) lua_rawlen (L, 3);
+    if (n == 0) {
+        lua_pushnumber (L, 0);
+        lua_newtable (L);
+        return 2;
+    }
+
+    /* positional binds if the rows have an array part, named otherwise */
+    for (r = 1; r <= n; r++) {
+        lua_rawgeti (L, 3, r);
+        if (!lua_istable (L, -1))
+            return luaL_error (L, LUASQL_PREFIX"row #%d is not a table", r);
+        if (lua_rawlen (L, -1) > ncols)
+            ncols = (ub4) lua_rawlen (L, -1);
+        lua_pop (L, 1);
+    }
+
+    lua_rawgeti (L, 3, 1);                                  /* 4: first row */
+    if (ncols == 0) {
+        lua_pushnil (L);
+        while (lua_next (L, 4) != 0) {
+            lua_pop (L, 1);
+            if (lua_type (L, -1) == LUA_TSTRING)
+                ncols++;
+        }
+    }
+    if (ncols == 0)
+        return luaL_error (L, LUASQL_PREFIX"no bind values");
+
+    /* plain memory lives in userdata, so errors cannot leak it */
+    cols = (array_bind *) lua_newuserdata (L, ncols * sizeof(array_bind));   /* 5 */
+    memset (cols, 0, ncols * sizeof(array_bind));
+
+    if (lua_rawlen (L, 4) == 0) {
+        /* placeholder names are anchored by the first row */
+        j = 0;
+        lua_pushnil (L);
+        while (lua_next (L, 4) != 0) {
+            lua_pop (L, 1);
+            if (lua_type (L, -1) == LUA_TSTRING)
+                cols[j++].name = lua_tostring (L, -1);
+        }
+    }
+
+    for (j = 0; j < ncols; j++) {
+        describe_array_bind (L, &cols[j], j + 1, n);
+        /* keep the elements of every column aligned */
+        total += ((size_t) n * cols[j].size + 7) & ~(size_t)7;
+        total += n * (sizeof(sb2) + sizeof(ub2));
+        if (cols[j].name)
+            total += strlen (cols[j].name) + 2;
+        total = (total + 7) & ~(size_t)7;
+    }
+
+    mem = (char *) lua_newuserdata (L, total);                               /* 6 */
+    memset (mem, 0, total);
+    for (j = 0; j < ncols; j++) {
+        array_bind *col = &cols[j];
+        col->buf = mem;
+        mem += ((size_t) n * col->size + 7) & ~(size_t)7;
+        col->null = (sb2 *) mem;
+        mem += n * sizeof(sb2);
+        if (col->type == SQLT_CHR)
+            col->len = (ub2 *) mem;
+        mem += n * sizeof(ub2);
+        if (col->name) {
+            /* keep the placeholder with the leading colon, as getbind */
+            col->placeholder = mem;
+            col->placeholder[0] = ':';
+            strcpy (col->placeholder + 1, col->name);
+            mem += strlen (col->name) + 2;
+        }
+        mem = (char *)(((size_t) mem + 7) & ~(size_t)7);
+    }
+
+    start = now_us ();
+    status = OCIStmtPrepare2 (conn->svchp, &stmthp, conn->errhp,
+        (text *)statement, (ub4) strlen(statement), (OraText *)0, (ub4)0,
+        (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+    trace_add (conn->env, "OCIStmtPrepare2", st, start, now_us (), status,
+        conn->lane);
+    if (!OCI_OK (status))
+        return execute_failed (L, conn, stmthp, status);
+    if (st)
+        latency_add (&st->prepare, now_us () - start);
+
+    /* no Lua errors below until the OCI resources are released */
+    status = OCIAttrGet ((dvoid *)stmthp, (ub4) OCI_HTYPE_STMT,
+        (dvoid *)&type, (ub4 *)0, (ub4)OCI_ATTR_STMT_TYPE, conn->errhp);
+    if (status)
+        goto done;
+    if (type == OCI_STMT_SELECT) {
+        strcpy (errbuf, "queries are not allowed");
+        goto done;
+    }
+
+    for (j = 0; j < ncols; j++)
+        if (cols[j].type == SQLT_TIMESTAMP) {
+            status = OCIArrayDescriptorAlloc (conn->env->envhp,
+                (dvoid **) cols[j].buf, OCI_DTYPE_TIMESTAMP, n, (size_t)0,
+                (dvoid **)0);
+            if (status)
+                goto done;
+        }
+
+    for (r = 1; r <= n; r++) {
+        lua_rawgeti (L, 3, r);
+        for (j = 0; j < ncols; j++) {
+            getcolvalue (L, &cols[j], j + 1);
+            status = set_array_value (L, conn, &cols[j], r - 1);
+            lua_pop (L, 1);
+            if (status)
+                goto done;
+        }
+        lua_pop (L, 1);
+    }
+
+    for (j = 0; j < ncols; j++) {
+        array_bind *col = &cols[j];
+        if (col->name)
+            status = OCIBindByName (stmthp, &col->bind, conn->errhp,
+                (text *)col->placeholder, (sb4)strlen (col->placeholder), col->buf,
+                col->size, col->type, (dvoid *)col->null, col->len,
+                (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+        else
+            status = OCIBindByPos (stmthp, &col->bind, conn->errhp,
+                j + 1, col->buf, col->size, col->type, (dvoid *)col->null,
+                col->len, (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+        if (status)
+            goto done;
+    }
+
+    mode = conn->auto_commit ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
+    if (batcherrors)
+        mode |= OCI_BATCH_ERRORS;
+    if (rowcounts)
+        mode |= OCI_RETURN_ROW_COUNT_ARRAY;
+
+    /* array execution is always blocking */
+    if (conn->nonblocking) {
+        status = toggle_nonblocking (conn);
+        if (status)
+            goto done;
+    }
+    start = now_us ();
+    if (conn->threaded)
+        status = job_sync (conn, stmthp, n, mode);
+    else
+        status = OCIStmtExecute (conn->svchp, stmthp, conn->errhp, n,
+            (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, mode);
+    trace_call (conn, "OCIStmtExecute", st, start, status);
+    stats_execute (st, now_us () - start, status);
+    if (conn->nonblocking) {
+        sword restored;
+        if (!OCI_OK (status))
+            oci_error_message (status, conn->errhp, errbuf, sizeof(errbuf));
+        restored = toggle_nonblocking (conn);
+        if (restored != OCI_SUCCESS) {
+            /* the connection is left in blocking mode */
+            conn->nonblocking = 0;
+            if (OCI_OK (status))
+                status = restored;
+        }
+    }
+    if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO)
+        goto done;
+
+    {
+        ub4 rows_affected = 0, nerrors = 0, k;
+        status = OCIAttrGet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+            (dvoid *)&rows_affected, (ub4 *)0, (ub4)OCI_ATTR_ROW_COUNT,
+            conn->errhp);
+        if (status)
+            goto done;
+        if (st)
+            st->rows += rows_affected;
+        lua_pushnumber (L, rows_affected);
+
+        if (batcherrors) {
+            status = OCIAttrGet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+                (dvoid *)&nerrors, (ub4 *)0, (ub4)OCI_ATTR_NUM_DML_ERRORS,
+                conn->errhp);
+            if (status)
+                goto done;
+        }
+        if (nerrors > 0) {
+            status = OCIHandleAlloc ((dvoid *) conn->env->envhp,
+                (dvoid **) &rowerrhp, (ub4) OCI_HTYPE_ERROR, (size_t) 0,
+                (dvoid **) 0);
+            if (status)
+                goto done;
+        }
+        lua_createtable (L, nerrors, 0);
+        for (k = 0; k < nerrors; k++) {
+            ub4 offset = 0;
+            sb4 errcode = 0;
+            text msg[512];
+            status = OCIParamGet (conn->errhp, OCI_HTYPE_ERROR, conn->errhp,
+                (dvoid **)&rowerrhp, k);
+            if (status)
+                goto done;
+            OCIAttrGet ((dvoid *)rowerrhp, (ub4)OCI_HTYPE_ERROR, (dvoid *)&offset,
+                (ub4 *)0, (ub4)OCI_ATTR_DML_ROW_OFFSET, conn->errhp);
+            OCIErrorGet (rowerrhp, (ub4) 1, (text *) NULL, &errcode,
+                msg, (ub4) sizeof (msg), OCI_HTYPE_ERROR);
+
+            lua_createtable (L, 0, 3);
+            lua_pushliteral (L, "row");
+            lua_pushnumber (L, offset + 1);
+            lua_rawset (L, -3);
+            lua_pushliteral (L, "code");
+            lua_pushnumber (L, errcode);
+            lua_rawset (L, -3);
+            lua_pushliteral (L, "message");
+            lua_pushstring (L, (char *) msg);
+            lua_rawset (L, -3);
+            lua_rawseti (L, -2, k + 1);
+        }
+
+        if (rowcounts) {
+            ub8 *counts = NULL;
+            ub4 ncounts = 0;
+            status = OCIAttrGet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
+                (dvoid *)&counts, (ub4 *)&ncounts,
+                (ub4)OCI_ATTR_DML_ROW_COUNT_ARRAY, conn->errhp);
+            if (status)
+                goto done;
+            lua_createtable (L, ncounts, 0);
+            for (k = 0; k < ncounts; k++) {
+                lua_pushnumber (L, (lua_Number) counts[k]);
+                lua_rawseti (L, -2, k + 1);
+            }
+        }
+    }
+
+done:
+    if (status != OCI_SUCCESS && status != OCI_SUCCESS_WITH_INFO && !errbuf[0])
+        oci_error_message (status, conn->errhp, errbuf, sizeof(errbuf));
+
+    for (j = 0; j < ncols; j++)
+        if (cols[j].type == SQLT_TIMESTAMP && *(OCIDateTime **)cols[j].buf)
+            OCIArrayDescriptorFree ((dvoid **) cols[j].buf, OCI_DTYPE_TIMESTAMP);
+    if (rowerrhp)
+        OCIHandleFree ((dvoid *) rowerrhp, OCI_HTYPE_ERROR);
+    stmt_release (stmthp, conn->errhp, !OCI_OK (status));
+
+    if (errbuf[0])
+        return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+
+    return rowcounts ? 3 : 2;
+}
+
+
+/*
+** Commit the current transaction.
+*/
+static int
+conn_commit (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    uint64_t start = now_us ();
+    sword status = conn->threaded
+        ? job_call (L, conn, JOB_COMMIT, NULL, conn->errhp, 0, OCI_DEFAULT)
+        : OCITransCommit (conn->svchp, conn->errhp, OCI_DEFAULT);
+    stats_entry *st;
+    if (status == OCI_STILL_EXECUTING) {
+        lua_pushnil (L);
+        lua_pushinteger (L, OCI_STILL_EXECUTING);
+        return 2;
+    }
+    st = stats_lookup (conn->env, "commit");
+    trace_call (conn, "OCITransCommit", st, start, status);
+    stats_execute (st, call_time (conn, start), status);
+    ASSERT_OCI (L, status, conn->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Rollback the current transaction.
+*/
+static int
+conn_rollback (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    uint64_t start = now_us ();
+    sword status = conn->threaded
+        ? job_call (L, conn, JOB_ROLLBACK, NULL, conn->errhp, 0, OCI_DEFAULT)
+        : OCITransRollback (conn->svchp, conn->errhp, OCI_DEFAULT);
+    stats_entry *st;
+    if (status == OCI_STILL_EXECUTING) {
+        lua_pushnil (L);
+        lua_pushinteger (L, OCI_STILL_EXECUTING);
+        return 2;
+    }
+    st = stats_lookup (conn->env, "rollback");
+    trace_call (conn, "OCITransRollback", st, start, status);
+    stats_execute (st, call_time (conn, start), status);
+    ASSERT_OCI (L, status, conn->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
+
+
+/*
+** Set "auto commit" property of the connection.
+** If 'true', then rollback current transaction.
+** If 'false', then start a new transaction.
+*/
+static int
+conn_setautocommit (lua_State *L) {
+    conn_data *conn = getconnection (L);
+    if (lua_toboolean (L, 2)) {
+        conn->auto_commit = 1;
+        /* Undo active transaction. */
+        ASSERT_OCI (L, OCITransRollback (conn->svchp, conn->errhp,
+            OCI_DEFAULT), conn->errhp);
+    }
+    else {
+        conn->auto_commit = 0;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+
+/*
+** Read the options table of connect and connect_async.
+*/
+static void
+conn_options (lua_State *L, conn_data *conn) {
+    if (lua_gettop (L) > 4 && lua_istable (L, 5)) {
+        lua_getfield (L, 5, "utf8");
+        if (lua_isboolean (L, -1))
+            conn->utf8 = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+
+        conn->datetime = getoptionfield (L, 5, "datetime", conn->datetime,
+            datetime_formats);
+
+        lua_getfield (L, 5, "arraysize");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0
+                && lua_tointeger (L, -1) <= LUASQL_OCI_ARRAYMAX)
+            conn->arraysize = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        prefetch_options (L, 5, &conn->prefetch);
+
+        lua_getfield (L, 5, "stmtcache");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) >= 0)
+            conn->stmtcache = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 5, "lobprefetch");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) >= 0)
+            conn->lobprefetch = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 5, "longsize");
+        if (lua_isnumber (L, -1) && lua_tointeger (L, -1) > 0
+                && lua_tointeger (L, -1) <= LUASQL_OCI_LONGSIZE)
+            conn->longsize = (ub4) lua_tointeger (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 5, "threaded");
+        if (lua_isboolean (L, -1))
+            conn->threaded = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+    }
+}
+
+
+/*
+** Push the file descriptor signalled when an async connect or a call
+** of a threaded connection completes, or nil for other connections.
+*/
+static int
+conn_getfd (lua_State *L) {
+    conn_data *conn = (conn_data *)luaL_checkudata (L, 1, LUASQL_CONNECTION_OCI8);
+    luaL_argcheck (L, conn != NULL, 1, LUASQL_PREFIX"connection expected");
+    if (conn->connect)
+        lua_pushinteger (L, conn->connect->job.fd[0]);
+    else if (!conn->closed && conn->threaded)
+        lua_pushinteger (L, conn->job.fd[0]);
+    else
+        lua_pushnil (L);
+    return 1;
+}
+
+
+/*
+** Connects to a data source.
+*/
+static int
+env_connect (lua_State *L) {
+    env_data *env = getenvironment (L);
+    uint64_t start;
+    sword status;
+
+    const char *sourcename = luaL_checkstring(L, 2);
+    const char *username = luaL_checkstring(L, 3);
+    const char *password = luaL_checkstring(L, 4);
+
+    /* Alloc connection object */
+    conn_data *conn = (conn_data *)lua_newuserdata(L, sizeof(conn_data));
+
+    /* fill in structure */
+    luasql_setmeta (L, LUASQL_CONNECTION_OCI8);
+    conn->env = env;
+    conn->utf8 = 0;
+    conn->datetime = DATETIME_TABLE;
+    conn->arraysize = LUASQL_OCI_ARRAYSIZE;
+    conn->prefetch.rows = LUASQL_OCI_PREFETCH;
+    conn->prefetch.memory = 0;
+    conn->prefetch.autotune = 0;
+    conn->stmtcache = LUASQL_OCI_STMTCACHE;
+    conn->lobprefetch = LUASQL_OCI_LOBPREFETCH;
+    conn->longsize = LUASQL_OCI_LONGSIZE;
+    conn->nonblocking = 0;
+    conn->exec_stmthp = NULL;
+    conn->threaded = 0;
+    conn->pool = NULL;
+    conn->poolref = LUA_NOREF;
+    conn->lobs = NULL;
+    conn->connect = NULL;
+    conn->closed = 1;
+    conn->auto_commit = 0;
+    conn->cur_counter = 0;
+    conn->stmt_counter = 0;
+    conn->srvhp = NULL;
+    conn->svchp = NULL;
+    conn->errhp = NULL;
+    conn->authp = NULL;
+    conn->lane = ++env->trace.lanes;
+
+    strncpy(conn->sourcename, sourcename, sizeof(conn->sourcename));
+    strncpy(conn->username, username, sizeof(conn->username));
+    strncpy(conn->password, password, sizeof(conn->password));
+
+    conn_options (L, conn);
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) env->envhp,
+        (dvoid **) &(conn->errhp),
+        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0), env->errhp);
+    /* login */
+    start = now_us ();
+    status = OCILogon2(env->envhp, conn->errhp, &(conn->svchp),
+        (CONST text*) username, strlen(username),
+        (CONST text*) password, strlen(password),
+        (CONST text*) sourcename, strlen(sourcename),
+        conn->stmtcache ? OCI_LOGON2_STMTCACHE : OCI_DEFAULT);
+    trace_add (env, "OCILogon2", NULL, start, now_us (), status, conn->lane);
+    ASSERT_OCI (L, status, conn->errhp);
+
+    if (conn->stmtcache)
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *) conn->svchp, OCI_HTYPE_SVCCTX,
+            (dvoid *) &conn->stmtcache, (ub4)0, OCI_ATTR_STMTCACHESIZE,
+            conn->errhp), conn->errhp);
+
+    conn->closed = 0;
+    env->conn_counter++;
+
+    if (job_init (&conn->job, conn->threaded) < 0)
+        return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
+
+    return 1;
+}
+
+
+/*
+** Connects to a data source asynchronous.
+** The logon runs on the connect workers of the environment; the call
+** returns the connection and OCI_STILL_EXECUTING until it is finished.
+** The 'timeout' option, in seconds, limits the wait for the logon and
+** bounds the attach and the logon roundtrips of the worker.
+*/
+static int
+env_connect_async (lua_State *L) {
+    env_data *env = getenvironment (L);
+
+    const char *sourcename = luaL_checkstring(L, 2);
+    const char *username = luaL_checkstring(L, 3);
+    const char *password = luaL_checkstring(L, 4);
+
+    char errbuf[512];
+    connect_data *c;
+    sword status;
+    int state;
+
+    /* Alloc connection object */
+    conn_data *conn;
+
+    if (lua_gettop(L) > 1 && lua_isuserdata(L, -1)) {
+        conn = (conn_data *)luaL_checkudata (L, -1, LUASQL_CONNECTION_OCI8);
+        if (conn == NULL) {
+            return luaL_error (L, LUASQL_PREFIX"connection handle expected");
+        }
+    } else {
+        double timeout = 0;
+
+        conn = (conn_data *)lua_newuserdata(L, sizeof(conn_data));
+
+        /* fill in structure */
+        luasql_setmeta (L, LUASQL_CONNECTION_OCI8);
+        conn->env = env;
+        conn->utf8 = 0;
+        conn->datetime = DATETIME_TABLE;
+        conn->arraysize = LUASQL_OCI_ARRAYSIZE;
+        conn->prefetch.rows = LUASQL_OCI_PREFETCH;
+        conn->prefetch.memory = 0;
+        conn->prefetch.autotune = 0;
+        conn->stmtcache = LUASQL_OCI_STMTCACHE;
+        conn->lobprefetch = LUASQL_OCI_LOBPREFETCH;
+        conn->longsize = LUASQL_OCI_LONGSIZE;
+        conn->nonblocking = 0;
+        conn->exec_stmthp = NULL;
+        conn->threaded = 0;
+        conn->pool = NULL;
+        conn->poolref = LUA_NOREF;
+        conn->lobs = NULL;
+        conn->connect = NULL;
+        conn->closed = 1;
+        conn->auto_commit = 0;
+        conn->cur_counter = 0;
+        conn->stmt_counter = 0;
+        conn->srvhp = NULL;
+        conn->svchp = NULL;
+        conn->errhp = NULL;
+        conn->authp = NULL;
+        conn->lane = ++env->trace.lanes;
+        job_init (&conn->job, 0);
+
+        strncpy(conn->sourcename, sourcename, sizeof(conn->sourcename));
+        strncpy(conn->username, username, sizeof(conn->username));
+        strncpy(conn->password, password, sizeof(conn->password));
+
+        conn_options (L, conn);
+        if (lua_gettop (L) > 4 && lua_istable (L, 5)) {
+            lua_getfield (L, 5, "timeout");
+            timeout = lua_tonumber (L, -1);
+            lua_pop (L, 1);
+        }
+
+        c = (connect_data *) calloc (1, sizeof(connect_data));
+        ASSERT_PTR (L, c);
+        if (job_init (&c->job, 1) < 0) {
+            free (c);
+            return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
+        }
+        c->job.op = JOB_CONNECT;
+        c->envhp = env->envhp;
+        c->stmtcache = conn->stmtcache;
+        /* non-blocking mode unless the calls run on worker threads */
+        c->nonblocking = !conn->threaded;
+        c->timeout = timeout > 0 ? (uint64_t) (timeout * 1e6) : 0;
+        c->deadline = c->timeout ? now_us () + c->timeout : 0;
+        memcpy (c->sourcename, conn->sourcename, sizeof(c->sourcename));
+        memcpy (c->username, conn->username, sizeof(c->username));
+        memcpy (c->password, conn->password, sizeof(c->password));
+
+        if (job_submit (&env->connectors, &c->job) < 0) {
+            connect_free (c);
+            return luaL_error (L, LUASQL_PREFIX"couldn't start connect threads");
+        }
+        conn->connect = c;
+        env->conn_counter++;
+
+        lua_pushinteger (L, OCI_STILL_EXECUTING);
+
+        return 2;
+    }
+
+    c = conn->connect;
+    if (c == NULL)
+        return luaL_error (L, LUASQL_PREFIX"connection is not connecting");
+
+    workers_lock (&env->connectors);
+    state = c->job.state;
+    pthread_mutex_unlock (&env->connectors.lock);
+
+    if (state != JOB_DONE) {
+        if (c->deadline && now_us () > c->deadline) {
+            connect_abandon (conn);
+            return luaL_error (L, LUASQL_PREFIX"connect timeout");
+        }
+        lua_pushvalue (L, -1);
+        lua_pushinteger (L, OCI_STILL_EXECUTING);
+        return 2;
+    }
+
+    conn->connect = NULL;
+    status = c->job.status;
+    trace_add (env, "OCISessionBegin", NULL, c->job.started,
+        c->job.started + c->job.elapsed, status, conn->lane);
+    if (!OCI_OK (status)) {
+        oci_error_message (status, c->errhp, errbuf, sizeof (errbuf));
+        connect_free (c);
+        env->conn_counter--;
+        return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+    }
+
+    /* the connection takes over the session */
+    conn->errhp = c->errhp;
+    conn->srvhp = c->srvhp;
+    conn->svchp = c->svchp;
+    conn->authp = c->authp;
+    conn->nonblocking = c->nonblocking;
+    c->errhp = NULL;
+    c->srvhp = NULL;
+    c->svchp = NULL;
+    c->authp = NULL;
+    c->began = c->attached = 0;
+    connect_free (c);
+
+    conn->closed = 0;
+
+    if (job_init (&conn->job, conn->threaded) < 0)
+        return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
+
+    lua_pushvalue (L, -1);
+
+    return 1;
+}
 
-    switch (col->type) {
-        case SQLT_FLT:
-        case SQLT_NUM:
-        case SQLT_VNU:
-        case SQLT_UIN:
-        case SQLT_INT:
-            break;
 
-        case SQLT_CHR:
-        case SQLT_STR:
-        case SQLT_VCS:
-        case SQLT_AFC:
-        case SQLT_AVC:
-            if (col->val.text)
-                free(col->val.text);
-            break;
+/*
+** Create a session pool.
+*/
+static int
+env_pool (lua_State *L) {
+    env_data *env = getenvironment (L);
+    ub4 min = 1, max = 10, incr = 1, timeout = 0;
+    ub1 getmode = OCI_SPOOL_ATTRVAL_WAIT;
 
-        case SQLT_DAT:
-        case SQLT_TIMESTAMP:
-        case SQLT_TIMESTAMP_TZ:
-        case SQLT_TIMESTAMP_LTZ:
-            if (col->val.date)
-                OCIDescriptorFree (col->val.date, OCI_DTYPE_TIMESTAMP);
-            break;
-        case SQLT_CLOB:
-            if (col->val.text)
-                OCIDescriptorFree (col->val.text, OCI_DTYPE_LOB);
-            break;
-        default:
-            break;
+    const char *sourcename = luaL_checkstring(L, 2);
+    const char *username = luaL_checkstring(L, 3);
+    const char *password = luaL_checkstring(L, 4);
+
+    if (lua_gettop (L) > 4 && lua_istable (L, 5)) {
+        min = (ub4) getintfield (L, 5, "min", (int) min);
+        max = (ub4) getintfield (L, 5, "max", (int) max);
+        incr = (ub4) getintfield (L, 5, "incr", (int) incr);
+        timeout = (ub4) getintfield (L, 5, "timeout", (int) timeout);
+        lua_getfield (L, 5, "nowait");
+        if (lua_toboolean (L, -1))
+            getmode = OCI_SPOOL_ATTRVAL_NOWAIT;
+        lua_pop (L, 1);
     }
-    return 0;
+    luaL_argcheck (L, max > 0 && min <= max, 5, LUASQL_PREFIX"invalid pool size");
+
+    /* Alloc pool object */
+    pool_data *pool = (pool_data *)lua_newuserdata(L, sizeof(pool_data));
+
+    /* fill in structure */
+    luasql_setmeta (L, LUASQL_POOL_OCI8);
+    memset (pool, 0, sizeof(pool_data));
+    pool->env = env;
+    pool->min = min;
+    pool->max = max;
+
+    /* options of the pooled connections */
+    pool->conf.env = env;
+    pool->conf.closed = 1;
+    pool->conf.poolref = LUA_NOREF;
+    pool->conf.arraysize = LUASQL_OCI_ARRAYSIZE;
+    pool->conf.prefetch.rows = LUASQL_OCI_PREFETCH;
+    pool->conf.stmtcache = LUASQL_OCI_STMTCACHE;
+    pool->conf.lobprefetch = LUASQL_OCI_LOBPREFETCH;
+    pool->conf.longsize = LUASQL_OCI_LONGSIZE;
+    strncpy(pool->conf.sourcename, sourcename, sizeof(pool->conf.sourcename));
+    strncpy(pool->conf.username, username, sizeof(pool->conf.username));
+    conn_options (L, &pool->conf);
+
+    pool->closed = 0;
+    env->conn_counter++;
+
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) env->envhp,
+        (dvoid **) &(pool->errhp),
+        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0), env->errhp);
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) env->envhp,
+        (dvoid **) &(pool->spoolhp),
+        (ub4) OCI_HTYPE_SPOOL, (size_t) 0, (dvoid **) 0), pool->errhp);
+
+    if (pool->conf.stmtcache)
+        ASSERT_OCI (L, OCIAttrSet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL,
+            (dvoid *) &pool->conf.stmtcache, (ub4)0, OCI_ATTR_SPOOL_STMTCACHESIZE,
+            pool->errhp), pool->errhp);
+
+    ASSERT_OCI (L, OCISessionPoolCreate(env->envhp, pool->errhp, pool->spoolhp,
+        &pool->name, &pool->namelen,
+        (CONST OraText *) sourcename, (ub4) strlen(sourcename),
+        min, max, incr,
+        (OraText *) username, (ub4) strlen(username),
+        (OraText *) password, (ub4) strlen(password),
+        OCI_SPC_HOMOGENEOUS | (pool->conf.stmtcache ? OCI_SPC_STMTCACHE : 0)),
+        pool->errhp);
+
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL,
+        (dvoid *) &timeout, (ub4)0, OCI_ATTR_SPOOL_TIMEOUT, pool->errhp), pool->errhp);
+    ASSERT_OCI (L, OCIAttrSet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL,
+        (dvoid *) &getmode, (ub4)0, OCI_ATTR_SPOOL_GETMODE, pool->errhp), pool->errhp);
+
+    return 1;
 }
 
+
 /*
-** Push a value on top of the stack.
+** Return the number of sessions the pool can still hand out without
+** waiting. Sessions checked out by the caller never come back to an
+** acquire blocked on them.
 */
 static int
-pushvalue (lua_State *L, cur_data *cur, int i) {
-    /* column index ranges from 1 to numcols */
-    /* C array index ranges from 0 to numcols-1 */
-    column_data *col = &(cur->cols[i-1]);
-    if (col->null) {
-        /* Oracle NULL => Lua nil */
-        lua_pushnil (L);
-        return 1;
-    }
+pool_available (pool_data *pool) {
+    ub4 busy = 0;
+
+    OCIAttrGet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL, (dvoid *) &busy,
+        (ub4 *)0, OCI_ATTR_SPOOL_BUSY_COUNT, pool->errhp);
+    if (busy < (ub4) pool->conn_counter)
+        busy = (ub4) pool->conn_counter;
+    return busy < pool->max ? (int) (pool->max - busy) : 0;
+}
 
-    switch (col->type) {
 
-#ifdef _WITH_INT64
+/*
+** Check out a session of the pool as a connection object.
+*/
+static int
+pool_acquire (lua_State *L) {
+    pool_data *pool = getpool (L);
+    ub4 busy = 0, open = 0;
+    boolean found;
+    uint64_t start;
+    sword status;
 
-        case SQLT_INT:
-            lua_pushinteger64(L, col->val.i64);
-            break;
+    /* Alloc connection object */
+    conn_data *conn = (conn_data *)lua_newuserdata(L, sizeof(conn_data));
 
-        case SQLT_UIN:
-            lua_pushunsigned64(L, col->val.u64);
-            break;
+    /* fill in structure */
+    luasql_setmeta (L, LUASQL_CONNECTION_OCI8);
+    *conn = pool->conf;
+    conn->pool = pool;
+    conn->lane = ++pool->env->trace.lanes;
+    job_init (&conn->job, 0);
 
-        case SQLT_NUM:
-        case SQLT_VNU: {
-            static int64_t z = 0;
-            OCINumber zero;
-            boolean isint;
-            sword flag;
-            ASSERT_OCI (L, OCINumberIsInt(cur->errhp, &col->val.ociNumber, &isint), cur->errhp);
-            if (isint) {
-                ASSERT_OCI (L, OCINumberFromInt(cur->errhp, &z, sizeof(z), OCI_NUMBER_SIGNED, &zero), cur->errhp);
-                ASSERT_OCI (L, OCINumberCmp(cur->errhp, &col->val.ociNumber, &zero, &flag), cur->errhp);
-                if (flag >= 0) {
-                    ASSERT_OCI (L, OCINumberToInt(cur->errhp,
-                        &col->val.ociNumber, sizeof(uint64_t), OCI_NUMBER_UNSIGNED, &col->val.u64), cur->errhp);
-                    lua_pushunsigned64(L, col->val.u64);
-                } else {
-                    ASSERT_OCI (L, OCINumberToInt(cur->errhp,
-                        &col->val.ociNumber, sizeof(int64_t), OCI_NUMBER_SIGNED, &col->val.i64), cur->errhp);
-                    lua_pushinteger64(L, col->val.i64);
-                }
-            } else {
-                ASSERT_OCI (L, OCINumberToReal(cur->errhp, &col->val.ociNumber, sizeof(double), &col->val.dbl), cur->errhp);
-                lua_pushnumber(L, col->val.dbl);
-            }
-            break;
-        }
+    /* error handler */
+    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) pool->env->envhp,
+        (dvoid **) &(conn->errhp),
+        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0), pool->errhp);
+
+    /* all sessions are busy and the pool cannot grow */
+    OCIAttrGet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL, (dvoid *) &busy,
+        (ub4 *)0, OCI_ATTR_SPOOL_BUSY_COUNT, pool->errhp);
+    OCIAttrGet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL, (dvoid *) &open,
+        (ub4 *)0, OCI_ATTR_SPOOL_OPEN_COUNT, pool->errhp);
+    if (busy >= open && open >= pool->max)
+        pool->waits++;
+
+    start = now_us ();
+    status = OCISessionGet(pool->env->envhp, conn->errhp, &conn->svchp,
+        (OCIAuthInfo *)0, pool->name, pool->namelen,
+        (CONST OraText *)0, (ub4)0, (OraText **)0, (ub4 *)0, &found,
+        OCI_SESSGET_SPOOL);
+    trace_add (pool->env, "OCISessionGet", NULL, start, now_us (), status,
+        conn->lane);
+    if (!OCI_OK (status)) {
+        /* the connection is not open: its __gc releases nothing */
+        char errbuf[512];
+        oci_error_message (status, conn->errhp, errbuf, sizeof(errbuf));
+        OCIHandleFree ((dvoid *) conn->errhp, (ub4) OCI_HTYPE_ERROR);
+        conn->errhp = NULL;
+        return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+    }
+    pool->waittime += now_us () - start;
 
-#else
+    /* the pool lives as long as its connections */
+    lua_pushvalue (L, 1);
+    conn->poolref = luaL_ref (L, LUA_REGISTRYINDEX);
+    conn->closed = 0;
+    pool->conn_counter++;
+    pool->acquired++;
 
-        case SQLT_INT:
-            lua_pushnumber(L, col->val.i64);
-            break;
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *) conn->svchp, OCI_HTYPE_SVCCTX,
+        (dvoid *) &conn->srvhp, (ub4 *)0, OCI_ATTR_SERVER, conn->errhp), conn->errhp);
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *) conn->svchp, OCI_HTYPE_SVCCTX,
+        (dvoid *) &conn->authp, (ub4 *)0, OCI_ATTR_SESSION, conn->errhp), conn->errhp);
 
-        case SQLT_UIN:
-            lua_pushnumber(L, col->val.u64);
-            break;
+    if (job_init (&conn->job, conn->threaded) < 0)
+        return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
 
-        case SQLT_NUM:
-        case SQLT_VNU:
-            ASSERT_OCI (L, OCINumberToReal(cur->errhp, &col->val.ociNumber, sizeof(double), &col->val.dbl), cur->errhp);
-            lua_pushnumber(L, col->val.dbl);
-            break;
+    return 1;
+}
 
-#endif
 
-        case SQLT_FLT:
-            lua_pushnumber (L, col->val.dbl);
-            break;
+/*
+** Return a connection to its pool.
+*/
+static int
+pool_release (lua_State *L) {
+    pool_data *pool = getpool (L);
+    conn_data *conn = (conn_data *)luaL_checkudata (L, 2, LUASQL_CONNECTION_OCI8);
+    luaL_argcheck (L, conn != NULL && conn->pool == pool, 2,
+        LUASQL_PREFIX"connection of the pool expected");
+    lua_settop (L, 2);
+    lua_remove (L, 1);
+    return conn_close (L);
+}
 
-        case SQLT_CHR:
-        case SQLT_STR:
-        case SQLT_VCS:
-        case SQLT_AFC:
-        case SQLT_AVC:
-            lua_pushstring (L, (char *)(col->val.text));
-            break;
 
-        case SQLT_DAT:
-        case SQLT_TIMESTAMP:
-        case SQLT_TIMESTAMP_TZ:
-        case SQLT_TIMESTAMP_LTZ: {
-            sb2 year;
-            ub1 month, day, hour, min, sec;
-            ub4 fsec;
-            ASSERT_OCI (L, OCIDateTimeGetDate(cur->conn->env->envhp, cur->errhp,
-                col->val.date, &year, &month, &day), cur->errhp);
-            ASSERT_OCI (L, OCIDateTimeGetTime(cur->conn->env->envhp, cur->errhp,
-                col->val.date, &hour, &min, &sec, &fsec), cur->errhp);
+/*
+** Return the statistics of the pool.
+*/
+static int
+pool_stats (lua_State *L) {
+    pool_data *pool = getpool (L);
+    ub4 busy = 0, open = 0;
 
-            lua_createtable(L, 0, 7);
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL,
+        (dvoid *) &busy, (ub4 *)0, OCI_ATTR_SPOOL_BUSY_COUNT, pool->errhp),
+        pool->errhp);
+    ASSERT_OCI (L, OCIAttrGet ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL,
+        (dvoid *) &open, (ub4 *)0, OCI_ATTR_SPOOL_OPEN_COUNT, pool->errhp),
+        pool->errhp);
 
-            lua_pushliteral(L, "year");
-            lua_pushnumber(L, year);
-            lua_rawset(L, -3);
+    lua_createtable (L, 0, 8);
 
-            lua_pushliteral(L, "month");
-            lua_pushnumber(L, month);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "busy");
+    lua_pushnumber (L, busy);
+    lua_rawset (L, -3);
 
-            lua_pushliteral(L, "day");
-            lua_pushnumber(L, day);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "open");
+    lua_pushnumber (L, open);
+    lua_rawset (L, -3);
 
-            lua_pushliteral(L, "hour");
-            lua_pushnumber(L, hour);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "min");
+    lua_pushnumber (L, pool->min);
+    lua_rawset (L, -3);
 
-            lua_pushliteral(L, "min");
-            lua_pushnumber(L, min);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "max");
+    lua_pushnumber (L, pool->max);
+    lua_rawset (L, -3);
 
-            lua_pushliteral(L, "sec");
-            lua_pushnumber(L, sec);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "acquired");
+    lua_pushnumber (L, pool->acquired);
+    lua_rawset (L, -3);
 
-            lua_pushliteral(L, "fsec");
-            lua_pushnumber(L, fsec);
-            lua_rawset(L, -3);
+    lua_pushliteral (L, "released");
+    lua_pushnumber (L, pool->released);
+    lua_rawset (L, -3);
 
-            break;
-        }
+    lua_pushliteral (L, "waits");
+    lua_pushnumber (L, pool->waits);
+    lua_rawset (L, -3);
+
+    /* microseconds spent in OCISessionGet */
+    lua_pushliteral (L, "waittime");
+    lua_pushnumber (L, pool->waittime);
+    lua_rawset (L, -3);
 
-        case SQLT_CLOB: {
-            ub4 lob_len;
-            ASSERT_OCI (L, OCILobGetLength (cur->conn->svchp, cur->errhp,
-                (OCILobLocator *)col->val.text, &lob_len), cur->errhp);
-            if (lob_len > 0) {
-                char *lob_buffer = malloc(lob_len);
-                ASSERT_PTR (L, lob_buffer);
-                ub4 amount = lob_len;
-                ASSERT_OCI (L, OCILobRead(cur->conn->svchp, cur->errhp,
-                    (OCILobLocator *) col->val.text, &amount, (ub4) 1,
-                    (dvoid *) lob_buffer, (ub4) lob_len, (dvoid *)0,
-                    (sb4 (*) (dvoid *, CONST dvoid *, ub4, ub1)) 0,
-                    (ub2) 0, (ub1) SQLCS_IMPLICIT), cur->errhp);
-                lua_pushlstring (L, lob_buffer, amount);
-                free(lob_buffer);
-            } else
-                lua_pushstring (L, "");
-            break;
-        }
-        default:
-            luaL_error (L, LUASQL_PREFIX"unexpected error");
-    }
     return 1;
 }
 
 
 /*
-** Close the cursor on top of the stack.
-** Return 1
+** Destroy the session pool.
 */
 static int
-cur_close (lua_State *L) {
-    int i;
-    cur_data *cur = (cur_data *)luaL_checkudata (L, 1, LUASQL_CURSOR_OCI8);
-    luaL_argcheck (L, cur != NULL, 1, LUASQL_PREFIX"cursor expected");
-    if (cur->closed) {
+pool_close (lua_State *L) {
+    pool_data *pool = (pool_data *)luaL_checkudata (L, 1, LUASQL_POOL_OCI8);
+    luaL_argcheck (L, pool != NULL, 1, LUASQL_PREFIX"session pool expected");
+    if (pool->closed) {
         lua_pushboolean (L, 0);
         return 1;
     }
+    if (pool->conn_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are acquired connections");
 
-    /* Deallocate buffers. */
-    for (i = 1; i <= cur->numcols; i++)
-        free_column_buffers (L, cur, i);
-    if (cur->cols)
-        free (cur->cols);
-    if (cur->text)
-        free (cur->text);
+    if (pool->name)
+        OCISessionPoolDestroy (pool->spoolhp, pool->errhp, OCI_DEFAULT);
+    if (pool->spoolhp)
+        OCIHandleFree ((dvoid *) pool->spoolhp, OCI_HTYPE_SPOOL);
+    if (pool->errhp)
+        OCIHandleFree ((dvoid *) pool->errhp, OCI_HTYPE_ERROR);
 
     /* Nullify structure fields. */
-    if (cur->stmthp)
-        OCIHandleFree ((dvoid *)cur->stmthp, OCI_HTYPE_STMT);
-    if (cur->errhp)
-        OCIHandleFree ((dvoid *)cur->errhp, OCI_HTYPE_ERROR);
-
-    luaL_unref (L, LUA_REGISTRYINDEX, cur->colnames);
-    luaL_unref (L, LUA_REGISTRYINDEX, cur->coltypes);
-    luaL_unref (L, LUA_REGISTRYINDEX, cur->columns);
+    pool->closed = 1;
+    pool->spoolhp = NULL;
+    pool->errhp = NULL;
+    pool->name = NULL;
 
-    cur->closed = 1;
-    cur->colnames = LUA_NOREF;
-    cur->coltypes = LUA_NOREF;
-    cur->columns = LUA_NOREF;
+    pool->env->conn_counter--;
 
     lua_pushboolean (L, 1);
-
-    /* Decrement cursor counter on connection object */
-    cur->conn->cur_counter--;
-
     return 1;
 }
 
 
-/*
-** Get another row of the given cursor.
-*/
-static int
-cur_fetch (lua_State *L) {
-    cur_data *cur = getcursor (L);
-    sword status = OCIStmtFetch (cur->stmthp, cur->errhp, 1,
-        OCI_FETCH_NEXT, OCI_DEFAULT);
+/* rowid range of every extent of a table */
+#define PLAN_EXTENTS \
+    "select dbms_rowid.rowid_create (1, o.data_object_id, e.relative_fno," \
+    " e.block_id, 0), dbms_rowid.rowid_create (1, o.data_object_id," \
+    " e.relative_fno, e.block_id + e.blocks - 1, 32767)" \
+    " from user_extents e, user_objects o" \
+    " where e.segment_name = :t and o.object_name = e.segment_name" \
+    " and o.object_type like 'TABLE%'" \
+    " and nvl (o.subobject_name, ' ') = nvl (e.partition_name, ' ')" \
+    " order by e.blocks desc"
 
-    if (status == OCI_STILL_EXECUTING) {
-        lua_pushnil(L);
-        lua_pushinteger(L, OCI_STILL_EXECUTING);
-        return 2;
-    }
+/* every partition of a table */
+#define PLAN_PARTITIONS \
+    "select partition_name, null from user_tab_partitions" \
+    " where table_name = :t order by partition_position"
 
-    if (status == OCI_NO_DATA) {
-        /* No more rows */
-        cur_close (L);
-        lua_pop (L, 1);
-        lua_pushnil (L);
-        return 1;
-    } else if (status != OCI_SUCCESS) {
-        /* Error */
-        ASSERT_OCI (L, status, cur->errhp);
-    }
+/* size of the values read by the plan queries */
+#define PLAN_TEXT   132
 
-    if (lua_istable (L, 2)) {
-        int i;
-        const char *opts = luaL_optstring (L, 3, "n");
-        if (strchr (opts, 'n') != NULL)
-            /* Copy values to numerical indices */
-            for (i = 1; i <= cur->numcols; i++) {
-                int ret = pushvalue (L, cur, i);
-                if (ret != 1)
-                    return ret;
-                lua_rawseti (L, 2, i);
-            }
-        if (strchr (opts, 'a') != NULL)
-            /* Copy values to alphanumerical indices */
-            for (i = 1; i <= cur->numcols; i++) {
-                column_data *col = &(cur->cols[i-1]);
-                int ret;
-                lua_pushlstring (L, (char *) col->name, col->namelen);
-                if ((ret = pushvalue (L, cur, i)) != 1)
-                    return ret;
-                lua_rawset (L, 2);
-            }
-        lua_pushvalue(L, 2);
-        return 1; /* return table */
-    }
-    else {
-        int i;
-        luaL_checkstack (L, cur->numcols, LUASQL_PREFIX"too many columns");
-        for (i = 1; i <= cur->numcols; i++) {
-            int ret = pushvalue (L, cur, i);
-            if (ret != 1)
-                return ret;
-        }
-        return cur->numcols; /* return #numcols values */
+
+/*
+** Append an empty range to the parallel query.
+** Return NULL without memory.
+*/
+static range_data *
+parallel_range (parallel_data *pq) {
+    if (pq->nranges >= 16 && (pq->nranges & (pq->nranges - 1)) == 0) {
+        /* grow at powers of 2 */
+        range_data *ranges = (range_data *) realloc (pq->ranges,
+            pq->nranges * 2 * sizeof(range_data));
+        if (ranges == NULL)
+            return NULL;
+        pq->ranges = ranges;
     }
+    else if (pq->ranges == NULL
+            && (pq->ranges = (range_data *) malloc (16 * sizeof(range_data))) == NULL)
+        return NULL;
+    memset (&pq->ranges[pq->nranges], 0, sizeof(range_data));
+    return &pq->ranges[pq->nranges++];
 }
 
 
 /*
-** Return the list of field names as a table on top of the stack.
+** Set the value of the bind :lo (k = 0) or :hi (k = 1) of a range
+** from the Lua value at the given index.
 */
-static int
-cur_getcolnames (lua_State *L) {
-    cur_data *cur = getcursor (L);
-    if (cur->colnames != LUA_NOREF)
-        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->colnames);
-    else {
-        int i;
-        lua_newtable (L);
-        for (i = 1; i <= cur->numcols; i++) {
-            column_data *col = &(cur->cols[i-1]);
-            lua_pushlstring (L, (char *) col->name, col->namelen);
-            lua_rawseti (L, -2, i);
-        }
-        lua_pushvalue (L, -1);
-        cur->colnames = luaL_ref (L, LUA_REGISTRYINDEX);
-    }
-    return 1;
+static void
+range_value (lua_State *L, range_data *r, int k, int idx) {
+    if (lua_type (L, idx) == LUA_TNUMBER) {
+        r->type[k] = SQLT_FLT;
+        r->num[k] = lua_tonumber (L, idx);
+    } else if (lua_type (L, idx) == LUA_TSTRING) {
+        r->type[k] = SQLT_CHR;
+        r->text[k] = strdup (lua_tostring (L, idx));
+        ASSERT_PTR (L, r->text[k]);
+    } else
+        luaL_error (L, LUASQL_PREFIX"invalid range bound, number or string expected");
 }
 
 
 /*
-**
+** Read the ranges of a table from the data dictionary on the session
+** of conn: the rowid ranges of its extents, bound to :lo and :hi, or
+** its partitions, which replace the {partition} token of the query.
 */
-static char *
-getcolumntype (column_data *col) {
-    switch (col->type) {
-        case SQLT_CHR:
-        case SQLT_STR:
-        case SQLT_VCS:
-        case SQLT_AFC:
-        case SQLT_AVC:
-            return "string";
+static void
+parallel_plan (lua_State *L, parallel_data *pq, conn_data *conn,
+        const char *table, int partitions) {
+    const char *sql = partitions ? PLAN_PARTITIONS : PLAN_EXTENTS;
+    OCIStmt *stmthp = NULL;
+    OCIDefine *define = NULL;
+    OCIBind *bind = NULL;
+    ub4 prefetch = 1000;
+    char val[2][PLAN_TEXT];
+    sb2 ind[2];
+    sword status;
+    int k;
+
+    if (partitions && strstr (pq->sql, "{partition}") == NULL)
+        luaL_error (L, LUASQL_PREFIX"query without {partition} token");
+
+    status = OCIStmtPrepare2 (conn->svchp, &stmthp, conn->errhp,
+        (text *) sql, (ub4) strlen (sql), (OraText *)0, (ub4)0,
+        (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+    if (!OCI_OK (status))
+        execute_failed (L, conn, stmthp, status);
+
+    status = OCIAttrSet ((dvoid *) stmthp, (ub4) OCI_HTYPE_STMT,
+        (dvoid *) &prefetch, (ub4)0, (ub4) OCI_ATTR_PREFETCH_ROWS, conn->errhp);
+    if (OCI_OK (status))
+        status = OCIBindByName (stmthp, &bind, conn->errhp, (text *) ":t",
+            (sb4) 2, (dvoid *) table, (sb4) strlen (table), SQLT_CHR,
+            (dvoid *)0, (ub2 *)0, (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+    for (k = 0; k < 2 && OCI_OK (status); k++)
+        status = OCIDefineByPos (stmthp, &define, conn->errhp, (ub4) k + 1,
+            (dvoid *) val[k], (sb4) PLAN_TEXT, SQLT_STR, (dvoid *) &ind[k],
+            (ub2 *)0, (ub2 *)0, (ub4) OCI_DEFAULT);
+    if (OCI_OK (status))
+        status = OCIStmtExecute (conn->svchp, stmthp, conn->errhp, (ub4)0,
+            (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, OCI_DEFAULT);
+
+    while (OCI_OK (status)) {
+        range_data *r;
+        status = OCIStmtFetch2 (stmthp, conn->errhp, (ub4)1, OCI_FETCH_NEXT,
+            (sb4)0, OCI_DEFAULT);
+        if (!OCI_OK (status) || (r = parallel_range (pq)) == NULL)
+            break;
+        if (partitions) {
+            /* quoted, dictionary names keep their case */
+            char clause[PLAN_TEXT + 16];
+            snprintf (clause, sizeof(clause), "partition (\"%s\")", val[0]);
+            luaL_gsub (L, pq->sql, "{partition}", clause);
+            r->sql = strdup (lua_tostring (L, -1));
+            lua_pop (L, 1);
+        } else
+            for (k = 0; k < 2; k++) {
+                r->type[k] = SQLT_CHR;
+                r->text[k] = strdup (val[k]);
+            }
+    }
+    if (!OCI_OK (status) && status != OCI_NO_DATA)
+        execute_failed (L, conn, stmthp, status);
+    stmt_release (stmthp, conn->errhp, 0);
+
+    if (OCI_OK (status))
+        /* no room for the range */
+        ASSERT_PTR (L, NULL);
+    for (k = 0; k < pq->nranges; k++) {
+        range_data *r = &pq->ranges[k];
+        if (partitions ? r->sql == NULL : !r->text[0] || !r->text[1])
+            ASSERT_PTR (L, NULL);
+    }
+    if (pq->nranges == 0)
+        luaL_error (L, LUASQL_PREFIX"no %s of table %s",
+            partitions ? "partitions" : "extents", table);
+}
 
-#ifdef _WITH_INT64
-        case SQLT_FLT:
-            return "double";
 
-        case SQLT_INT:
-            return "integer";
+/*
+** Start the execute of the next range on a session: the first execute
+** takes the read point, the others run on it.
+*/
+static void
+stream_execute (lua_State *L, parallel_data *pq, stream_data *s) {
+    conn_data *conn = s->conn;
+    range_data *r = &pq->ranges[pq->next++];
+    const char *sql = r->sql ? r->sql : pq->sql;
+    static const char *const names[] = { ":lo", ":hi" };
+    sword status;
+    int k;
+
+    status = OCIStmtPrepare2 (conn->svchp, &s->stmthp, conn->errhp,
+        (text *) sql, (ub4) strlen (sql), (OraText *)0, (ub4)0,
+        (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+    if (!OCI_OK (status)) {
+        OCIStmt *stmthp = s->stmthp;
+        s->stmthp = NULL;
+        execute_failed (L, conn, stmthp, status);
+    }
+    s->range = r;
+
+    status = set_prefetch (s->stmthp, conn->errhp, &conn->prefetch);
+    for (k = 0; k < 2 && OCI_OK (status); k++) {
+        OCIBind *bind = NULL;
+        if (r->type[k] == SQLT_FLT)
+            status = OCIBindByName (s->stmthp, &bind, conn->errhp,
+                (text *) names[k], (sb4) 3, (dvoid *) &r->num[k],
+                (sb4) sizeof(double), SQLT_FLT, (dvoid *)0, (ub2 *)0,
+                (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+        else if (r->type[k] == SQLT_CHR)
+            status = OCIBindByName (s->stmthp, &bind, conn->errhp,
+                (text *) names[k], (sb4) 3, (dvoid *) r->text[k],
+                (sb4) strlen (r->text[k]), SQLT_CHR, (dvoid *)0, (ub2 *)0,
+                (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+    }
+    ASSERT_OCI (L, status, conn->errhp);
 
-        case SQLT_UIN:
-            return "unsigned integer";
+    conn->job.snap_in = pq->snapshot == SNAP_TAKEN ? pq->snap : NULL;
+    conn->job.snap_out = pq->snapshot == SNAP_NONE ? pq->snap : NULL;
+    if (pq->snapshot == SNAP_NONE)
+        pq->snapshot = SNAP_TAKING;
+    s->start = now_us ();
+    job_call (L, conn, JOB_EXECUTE, s->stmthp, conn->errhp, 0, OCI_DEFAULT);
+    s->state = PQ_EXECUTING;
+}
 
-        case SQLT_NUM:
-        case SQLT_VNU:
-            return "number";
-#else
-        case SQLT_FLT:
-        case SQLT_INT:
-        case SQLT_UIN:
-        case SQLT_NUM:
-        case SQLT_VNU:
-            return "number";
-#endif
 
-        case SQLT_DAT:
-            return "datetime";
+/*
+** Close the cursor of the finished range of a session.
+*/
+static void
+stream_endrange (lua_State *L, stream_data *s) {
+    lua_pushcfunction (L, cur_close);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, s->curref);
+    lua_call (L, 1, 0);
+    luaL_unref (L, LUA_REGISTRYINDEX, s->curref);
+    s->curref = LUA_NOREF;
+    s->cur = NULL;
+    s->range = NULL;
+    s->state = PQ_IDLE;
+}
 
-        case SQLT_TIMESTAMP:
-        case SQLT_TIMESTAMP_TZ:
-        case SQLT_TIMESTAMP_LTZ:
-            return "timestamp";
 
-        case SQLT_CLOB:
-            return "string";
+/*
+** Advance a session of a parallel query without waiting.
+** Return the number of fetched rows in the buffers of its cursor, 0
+** if it has none yet.
+*/
+static int
+stream_step (lua_State *L, parallel_data *pq, stream_data *s) {
+    conn_data *conn = s->conn;
+    sword status;
+    int n;
+
+    for (;;) {
+        switch (s->state) {
+            case PQ_IDLE:
+                if (pq->next >= pq->nranges) {
+                    s->state = PQ_DONE;
+                    return 0;
+                }
+                if (pq->snapshot == SNAP_TAKING)
+                    /* wait for the read point */
+                    return 0;
+                stream_execute (L, pq, s);
+                return 0;
+
+            case PQ_EXECUTING:
+                status = job_call (L, conn, JOB_EXECUTE, s->stmthp,
+                    conn->errhp, 0, OCI_DEFAULT);
+                if (status == OCI_STILL_EXECUTING)
+                    return 0;
+                trace_call (conn, "OCIStmtExecute", pq->stats, s->start, status);
+                stats_execute (pq->stats, call_time (conn, s->start), status);
+                if (conn->job.snap_out && OCI_OK (status))
+                    pq->snapshot = SNAP_TAKEN;
+                conn->job.snap_in = conn->job.snap_out = NULL;
+                if (!OCI_OK (status)) {
+                    char errbuf[512];
+                    oci_error_message (status, conn->errhp, errbuf, sizeof (errbuf));
+                    stmt_release (s->stmthp, conn->errhp, 1);
+                    s->stmthp = NULL;
+                    s->state = PQ_DONE;
+                    pq->failed = 1;
+                    return luaL_error (L, LUASQL_PREFIX"%s", errbuf);
+                }
 
-        default:
-            return "unknown";
+                /* the cursor owns the statement from now on */
+                create_cursor (L, conn, s->stmthp, s->range->sql
+                    ? s->range->sql : pq->sql, 0, &conn->prefetch, NULL);
+                s->cur = (cur_data *) lua_touserdata (L, -1);
+                s->curref = luaL_ref (L, LUA_REGISTRYINDEX);
+                s->stmthp = NULL;
+                s->cur->stats = pq->stats;
+                s->state = PQ_FETCHING;
+                break;
+
+            case PQ_FETCHING:
+                n = cur_refill (L, s->cur);
+                if (n != 0)
+                    return n < 0 ? 0 : n;
+                stream_endrange (L, s);
+                break;
+
+            default:
+                return 0;
+        }
     }
 }
 
 
 /*
-** Return the list of field types as a table on top of the stack.
+** Wait until a session of the parallel query has finished its call.
 */
-static int
-cur_getcoltypes (lua_State *L) {
-    cur_data *cur = getcursor (L);
-    if (cur->coltypes != LUA_NOREF)
-        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->coltypes);
-    else {
-        int i;
-        lua_newtable (L);
-        for (i = 1; i <= cur->numcols; i++) {
-            column_data *col = &(cur->cols[i-1]);
-            lua_pushnumber (L, i);
-            lua_pushstring (L, getcolumntype (col));
-            lua_rawset (L, -3);
+static void
+parallel_wait (parallel_data *pq) {
+    workers_data *w = &pq->env->workers;
+    int i, queued;
+
+    workers_lock (w);
+    for (;;) {
+        queued = 0;
+        for (i = 0; i < pq->nstreams; i++) {
+            stream_data *s = &pq->streams[i];
+            if (s->state == PQ_EXECUTING || s->state == PQ_FETCHING) {
+                if (s->conn->job.state != JOB_QUEUED)
+                    break;
+                queued++;
+            }
         }
-        lua_pushvalue (L, -1);
-        cur->coltypes = luaL_ref (L, LUA_REGISTRYINDEX);
+        if (i < pq->nstreams || queued == 0)
+            break;
+        pthread_cond_wait (&w->done, &w->lock);
     }
-    return 1;
+    pthread_mutex_unlock (&w->lock);
 }
 
 
 /*
-** Return the map by field names with description.
+** Close a parallel query: wait for the calls of its sessions and
+** return them to the pool.
 */
 static int
-cur_getcolumns (lua_State *L) {
-    cur_data *cur = getcursor (L);
-    if (cur->columns != LUA_NOREF)
-        lua_rawgeti (L, LUA_REGISTRYINDEX, cur->columns);
-    else {
-        int i;
-        lua_createtable(L, 0, cur->numcols);
-        for (i = 1; i <= cur->numcols; i++) {
-            column_data *col = &(cur->cols[i-1]);
+parallel_close (lua_State *L) {
+    parallel_data *pq = (parallel_data *)luaL_checkudata (L, 1, LUASQL_PARALLEL_OCI8);
+    int i, k;
+    luaL_argcheck (L, pq != NULL, 1, LUASQL_PREFIX"parallel query expected");
+    if (pq->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
+    }
+    pq->closed = 1;
+
+    for (i = 0; i < pq->nstreams; i++) {
+        stream_data *s = &pq->streams[i];
+        if (s->conn == NULL)
+            continue;
+        job_wait (s->conn, NULL);
+        s->conn->job.snap_in = s->conn->job.snap_out = NULL;
+        if (s->stmthp)
+            stmt_release (s->stmthp, s->conn->errhp, 0);
+        if (s->curref != LUA_NOREF)
+            stream_endrange (L, s);
+        lua_pushcfunction (L, conn_close);
+        lua_rawgeti (L, LUA_REGISTRYINDEX, s->connref);
+        lua_call (L, 1, 0);
+        luaL_unref (L, LUA_REGISTRYINDEX, s->connref);
+        s->conn = NULL;
+    }
 
-            lua_pushlstring (L, (char *) col->name, col->namelen);
+    for (i = 0; i < pq->nranges; i++) {
+        range_data *r = &pq->ranges[i];
+        if (r->sql)
+            free (r->sql);
+        for (k = 0; k < 2; k++)
+            if (r->text[k])
+                free (r->text[k]);
+    }
+    if (pq->ranges)
+        free (pq->ranges);
+    if (pq->streams)
+        free (pq->streams);
+    if (pq->sql)
+        free (pq->sql);
+    if (pq->snap)
+        OCIDescriptorFree ((dvoid *) pq->snap, OCI_DTYPE_SNAP);
+    luaL_unref (L, LUA_REGISTRYINDEX, pq->poolref);
+
+    pq->ranges = NULL;
+    pq->streams = NULL;
+    pq->sql = NULL;
+    pq->snap = NULL;
+    pq->poolref = LUA_NOREF;
 
-            lua_createtable(L, 0, 2);
+    lua_pushboolean (L, 1);
+    return 1;
+}
 
-            lua_pushliteral (L, "type");
-            lua_pushstring (L, getcolumntype (col));
-            lua_rawset(L, -3);
 
-            lua_pushliteral (L, "maxsize");
-            lua_pushinteger (L, col->max);
-            lua_rawset(L, -3);
+/*
+** Run a query in ranges on sessions of a pool:
+**   env:parallel_query (sql, {pool = pool, sessions = n, split = ...})
+** The split is an array of {lo, hi} bound to :lo and :hi, "rowid" for
+** the rowid ranges of the extents of the option table, bound the same
+** way, or "partition" for the partitions of the table, which replace
+** the {partition} token of the query. The ranges run on the workers of
+** the environment and see the read point of the first execute.
+*/
+static int
+env_parallel_query (lua_State *L) {
+    env_data *env = getenvironment (L);
+    const char *sql = luaL_checkstring (L, 2);
+    const char *table = NULL;
+    parallel_data *pq;
+    pool_data *pool;
+    int sessions, avail, split, idx, i;
+
+    luaL_checktype (L, 3, LUA_TTABLE);
+    lua_settop (L, 3);
+    lua_getfield (L, 3, "pool");
+    pool = (pool_data *) luaL_checkudata (L, 4, LUASQL_POOL_OCI8);
+    luaL_argcheck (L, !pool->closed && pool->env == env, 3,
+        LUASQL_PREFIX"open session pool of the environment expected");
+    sessions = getintfield (L, 3, "sessions", LUASQL_OCI_WORKERS);
+    luaL_argcheck (L, sessions > 0, 3, LUASQL_PREFIX"invalid number of sessions");
+    /* the sessions are held until the end: take only free ones */
+    avail = pool_available (pool);
+    if (sessions > avail)
+        sessions = avail;
+    if (sessions == 0)
+        return luaL_error (L, LUASQL_PREFIX"no free session in the pool");
+    lua_getfield (L, 3, "split");
+    split = 5;
+    if (lua_type (L, split) == LUA_TSTRING) {
+        const char *kind = lua_tostring (L, split);
+        luaL_argcheck (L, strcmp (kind, "rowid") == 0
+            || strcmp (kind, "partition") == 0, 3,
+            LUASQL_PREFIX"invalid split");
+        lua_getfield (L, 3, "table");
+        table = lua_tostring (L, -1);
+        luaL_argcheck (L, table != NULL, 3, LUASQL_PREFIX"table expected");
+    }
+    else
+        luaL_argcheck (L, lua_istable (L, split), 3,
+            LUASQL_PREFIX"ranges, \"rowid\" or \"partition\" expected");
+
+    /* Alloc parallel query object */
+    pq = (parallel_data *) lua_newuserdata (L, sizeof(parallel_data));
+    luasql_setmeta (L, LUASQL_PARALLEL_OCI8);
+    memset (pq, 0, sizeof(parallel_data));
+    idx = lua_gettop (L);
+    pq->poolref = LUA_NOREF;
+    pq->env = env;
+    pq->arraysize = (ub4) getintfield (L, 3, "arraysize",
+        (int) pool->conf.arraysize);
+    luaL_argcheck (L, pq->arraysize > 0 && pq->arraysize <= LUASQL_OCI_ARRAYMAX,
+        3, LUASQL_PREFIX"invalid arraysize");
+    lua_pushvalue (L, 4);
+    pq->poolref = luaL_ref (L, LUA_REGISTRYINDEX);
+    pq->sql = strdup (sql);
+    ASSERT_PTR (L, pq->sql);
+    pq->stats = stats_lookup (env, sql);
+    ASSERT_OCI (L, OCIDescriptorAlloc ((dvoid *) env->envhp,
+        (dvoid **) &pq->snap, OCI_DTYPE_SNAP, (size_t)0, (dvoid **)0),
+        env->errhp);
+
+    if (table == NULL) {
+        int n = (int) lua_rawlen (L, split);
+        for (i = 1; i <= n; i++) {
+            range_data *r = parallel_range (pq);
+            ASSERT_PTR (L, r);
+            lua_rawgeti (L, split, i);
+            luaL_argcheck (L, lua_istable (L, -1), 3,
+                LUASQL_PREFIX"range {lo, hi} expected");
+            lua_rawgeti (L, -1, 1);
+            range_value (L, r, 0, lua_gettop (L));
+            lua_rawgeti (L, -2, 2);
+            range_value (L, r, 1, lua_gettop (L));
+            lua_pop (L, 3);
+        }
+        luaL_argcheck (L, pq->nranges > 0, 3, LUASQL_PREFIX"no ranges");
+    }
 
-            lua_rawset(L, -3);
+    /* sessions, no more than ranges */
+    pq->streams = (stream_data *) calloc (sessions, sizeof(stream_data));
+    ASSERT_PTR (L, pq->streams);
+    for (i = 0; i < sessions; i++) {
+        stream_data *s = &pq->streams[i];
+        s->connref = s->curref = LUA_NOREF;
+        lua_pushcfunction (L, pool_acquire);
+        lua_pushvalue (L, 4);
+        lua_call (L, 1, 1);
+        s->conn = (conn_data *) lua_touserdata (L, -1);
+        s->connref = luaL_ref (L, LUA_REGISTRYINDEX);
+        pq->nstreams++;
+
+        /* the ranges are read on the first session */
+        if (table != NULL && i == 0)
+            parallel_plan (L, pq, s->conn, table, *lua_tostring (L, split) == 'p');
+
+        s->conn->arraysize = pq->arraysize;
+        if (!s->conn->threaded) {
+            s->conn->threaded = 1;
+            if (job_init (&s->conn->job, 1) < 0)
+                return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
         }
-        lua_pushvalue (L, -1);
-        cur->columns = luaL_ref (L, LUA_REGISTRYINDEX);
+        if (i + 1 >= pq->nranges)
+            break;
     }
+
+    /* start the first ranges */
+    for (i = 0; i < pq->nstreams; i++)
+        stream_step (L, pq, &pq->streams[i]);
+
+    lua_pushvalue (L, idx);
     return 1;
 }
 
 
 /*
-** Push the number of rows.
+** Push the fetched rows of a session as an array of tables and start
+** the fetch of its next batch.
 */
 static int
-cur_numrows (lua_State *L) {
-    return luaL_error(L, LUASQL_PREFIX"unimplemented");
+stream_batch (lua_State *L, stream_data *s, int num, int named) {
+    cur_data *cur = s->cur;
+    ub4 count = cur->nrows - cur->row, r;
+    int keys = 0;
+
+    if (named) {
+        pushkeys (L, cur);
+        keys = lua_gettop (L);
+    }
+    lua_createtable (L, count, 0);
+    for (r = 1; r <= count; r++) {
+        lua_createtable (L, num ? cur->numcols : 0, named ? cur->numcols : 0);
+        fillrow (L, cur, cur->row++, lua_gettop (L), num, keys);
+        lua_rawseti (L, -2, r);
+    }
+
+    /* the values are read, the session fetches while they are used */
+    cur_refill (L, cur);
+    return 1;
 }
 
 
 /*
-** Close a Connection object.
+** Get the next batch of rows of any range as an array of tables, with
+** the options of cur:fetchmany. At the end return nil and release the
+** sessions. Wait for a batch unless nowait is true; then return nil
+** and OCI_STILL_EXECUTING while none is ready.
 */
 static int
-conn_close (lua_State *L) {
-    conn_data *conn = (conn_data *)luaL_checkudata (L, 1, LUASQL_CONNECTION_OCI8);
-    luaL_argcheck (L, conn != NULL, 1, LUASQL_PREFIX"connection expected");
-    if (conn->closed) {
-        lua_pushboolean (L, 0);
-        return 1;
+parallel_fetch (lua_State *L) {
+    parallel_data *pq = getparallel (L);
+    int nowait = lua_toboolean (L, 2);
+    const char *opts = luaL_optstring (L, 3, "n");
+    int num = strchr (opts, 'n') != NULL;
+    int named = strchr (opts, 'a') != NULL;
+    int i, k, active;
+
+    if (pq->failed)
+        return luaL_error (L, LUASQL_PREFIX"parallel query failed");
+    lua_settop (L, 3);
+
+    for (;;) {
+        active = 0;
+        for (k = 0; k < pq->nstreams; k++) {
+            stream_data *s;
+            i = (pq->turn + k) % pq->nstreams;
+            s = &pq->streams[i];
+            if (stream_step (L, pq, s) > 0) {
+                /* the next call starts with the following session */
+                pq->turn = i + 1;
+                return stream_batch (L, s, num, named);
+            }
+            if (s->state != PQ_DONE)
+                active++;
+        }
+        if (active == 0) {
+            /* No more rows */
+            parallel_close (L);
+            lua_pushnil (L);
+            return 1;
+        }
+        if (nowait) {
+            lua_pushnil (L);
+            lua_pushinteger (L, OCI_STILL_EXECUTING);
+            return 2;
+        }
+        parallel_wait (pq);
     }
-    if (conn->cur_counter > 0)
-        return luaL_error (L, LUASQL_PREFIX"there are open cursors");
-
-    OCISessionEnd(conn->svchp, conn->errhp, conn->authp, (ub4) 0);
-    OCIServerDetach(conn->srvhp, conn->errhp, (ub4) OCI_DEFAULT);
+}
 
-    if (conn->srvhp)
-        OCIHandleFree((dvoid *) conn->srvhp, (ub4) OCI_HTYPE_SERVER);
-    if (conn->svchp)
-        OCIHandleFree((dvoid *) conn->svchp, (ub4) OCI_HTYPE_SVCCTX);
-    if (conn->authp)
-        OCIHandleFree((dvoid *) conn->authp, (ub4) OCI_HTYPE_SESSION);
-    if (conn->errhp)
-        OCIHandleFree((dvoid *) conn->errhp, (ub4) OCI_HTYPE_ERROR);
 
-    /* Nullify structure fields. */
-    conn->closed = 1;
-    conn->srvhp = NULL;
-    conn->svchp = NULL;
-    conn->authp = NULL;
-    conn->errhp = NULL;
+/*
+** Return the session of a statement to the pool.
+*/
+static void
+gather_release (lua_State *L, gather_data *g, gather_query *q) {
+    conn_data *conn = q->conn;
+    if (conn == NULL)
+        return;
+    job_wait (conn, NULL);
+    conn->job.arg = NULL;
+    if (q->stmthp)
+        stmt_release (q->stmthp, conn->errhp, q->state == GATHER_FAILED);
+    q->stmthp = NULL;
+    if (q->curref != LUA_NOREF) {
+        if (q->state == GATHER_FAILED)
+            q->cur->failed = 1;
+        lua_pushcfunction (L, cur_close);
+        lua_rawgeti (L, LUA_REGISTRYINDEX, q->curref);
+        lua_call (L, 1, 0);
+        luaL_unref (L, LUA_REGISTRYINDEX, q->curref);
+        q->curref = LUA_NOREF;
+        q->cur = NULL;
+    }
 
-    conn->env->conn_counter--;
+    /* the event belongs to the gather */
+    conn->job.fd[0] = conn->job.fd[1] = -1;
+    lua_pushcfunction (L, conn_close);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, q->connref);
+    lua_call (L, 1, 0);
+    luaL_unref (L, LUA_REGISTRYINDEX, q->connref);
+    q->connref = LUA_NOREF;
+    q->conn = NULL;
+    g->running--;
+}
 
-    lua_pushboolean (L, 1);
 
-    return 1;
+/*
+** Keep the error of a statement for the caller and release its session.
+*/
+static void
+gather_fail (lua_State *L, gather_data *g, gather_query *q, sword status) {
+    char errbuf[512];
+    if (status == OCI_SUCCESS)
+        snprintf (errbuf, sizeof (errbuf), "no memory");
+    else if (q->cur)
+        fetch_error (q->cur, status, errbuf, sizeof (errbuf));
+    else
+        oci_error_message (status, q->conn->errhp, errbuf, sizeof (errbuf));
+    q->errmsg = strdup (errbuf);
+    q->state = GATHER_FAILED;
+    gather_release (L, g, q);
 }
 
+
 /*
-** Abort current operation.
+** Append the rows in the buffers of the cursor of a statement to its
+** result.
 */
-static int
-conn_abort (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    ASSERT_OCI (L, OCIBreak(conn->srvhp, conn->errhp), conn->errhp);
-    lua_pushboolean (L, 1);
-    return 1;
+static void
+gather_rows (lua_State *L, gather_data *g, gather_query *q) {
+    cur_data *cur = q->cur;
+    int keys = 0;
+
+    if (g->named) {
+        pushkeys (L, cur);
+        keys = lua_gettop (L);
+    }
+    lua_rawgeti (L, LUA_REGISTRYINDEX, q->result);
+    for (; cur->row < cur->nrows; cur->row++) {
+        lua_createtable (L, g->num ? cur->numcols : 0, g->named ? cur->numcols : 0);
+        fillrow (L, cur, cur->row, lua_gettop (L), g->num, keys);
+        lua_rawseti (L, -2, (int) ++q->count);
+    }
+    lua_pop (L, keys ? 2 : 1);
 }
 
+
 /*
-** Reset connection state.
+** Start a statement of a gather on a session of the pool.
 */
-static int
-conn_reset (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    ASSERT_OCI (L, OCIReset(conn->srvhp, conn->errhp), conn->errhp);
-    lua_pushboolean (L, 1);
-    return 1;
+static void
+gather_start (lua_State *L, gather_data *g, gather_query *q) {
+    conn_data *conn;
+    sword status;
+    ub4 iters, i;
+
+    /* a statement without a session fails with its index */
+    lua_pushcfunction (L, pool_acquire);
+    lua_rawgeti (L, LUA_REGISTRYINDEX, g->poolref);
+    if (lua_pcall (L, 1, 1, 0) != 0) {
+        const char *msg = lua_tostring (L, -1);
+        if (msg && strncmp (msg, LUASQL_PREFIX, strlen (LUASQL_PREFIX)) == 0)
+            msg += strlen (LUASQL_PREFIX);
+        q->errmsg = msg ? strdup (msg) : NULL;
+        q->state = GATHER_FAILED;
+        lua_pop (L, 1);
+        return;
+    }
+    /* a statement raising an error is over */
+    q->state = GATHER_RETURNED;
+    conn = (conn_data *) lua_touserdata (L, -1);
+    q->connref = luaL_ref (L, LUA_REGISTRYINDEX);
+    q->conn = conn;
+    g->running++;
+
+    /* the calls run on the workers and signal the event of the gather */
+    job_free (conn);
+    conn->threaded = 1;
+    conn->job.fd[0] = g->event.fd[0];
+    conn->job.fd[1] = g->event.fd[1];
+
+    q->stats = stats_lookup (g->env, q->sql);
+    q->start = now_us ();
+    status = OCIStmtPrepare2 (conn->svchp, &q->stmthp, conn->errhp,
+        (text *) q->sql, (ub4) strlen (q->sql), (OraText *)0, (ub4)0,
+        (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT);
+    trace_add (g->env, "OCIStmtPrepare2", q->stats, q->start, now_us (),
+        status, conn->lane);
+    /* a failed statement is dropped by gather_release */
+    if (OCI_OK (status))
+        status = OCIAttrGet ((dvoid *) q->stmthp, (ub4) OCI_HTYPE_STMT,
+            (dvoid *) &q->type, (ub4 *)0, (ub4) OCI_ATTR_STMT_TYPE, conn->errhp);
+    if (OCI_OK (status))
+        status = set_prefetch (q->stmthp, conn->errhp, &conn->prefetch);
+    for (i = 0; i < (ub4) q->nvalues && OCI_OK (status); i++) {
+        gather_value *v = &q->values[i];
+        OCIBind *bind = NULL;
+        if (v->type == SQLT_FLT)
+            status = OCIBindByPos (q->stmthp, &bind, conn->errhp, i + 1,
+                (dvoid *) &v->num, (sb4) sizeof(double), SQLT_FLT, (dvoid *)0,
+                (ub2 *)0, (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+        else
+            status = OCIBindByPos (q->stmthp, &bind, conn->errhp, i + 1,
+                (dvoid *) v->text, (sb4) strlen (v->text), SQLT_CHR,
+                (dvoid *)0, (ub2 *)0, (ub2 *)0, (ub4)0, (ub4 *)0, OCI_DEFAULT);
+    }
+    if (!OCI_OK (status)) {
+        gather_fail (L, g, q, status);
+        return;
+    }
+
+    /* statements other than queries are committed */
+    iters = q->type == OCI_STMT_SELECT ? 0 : 1;
+    q->start = now_us ();
+    job_call (L, conn, JOB_EXECUTE, q->stmthp, conn->errhp, iters,
+        iters ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT);
+    q->state = GATHER_EXECUTING;
 }
 
 
 /*
-** Create a new Cursor object and push it on top of the stack.
+** Advance a running statement of a gather without waiting.
+** Return 0 if its call is still executing.
 */
 static int
-create_cursor (lua_State *L, conn_data *conn, OCIStmt *stmt, const char *text) {
-    int i;
-    cur_data *cur = (cur_data *) lua_newuserdata(L, sizeof(cur_data));
-    luasql_setmeta (L, LUASQL_CURSOR_OCI8);
+gather_step (lua_State *L, gather_data *g, gather_query *q) {
+    conn_data *conn = q->conn;
+    cur_data *cur = q->cur;
+    OCIStmt *stmthp;
+    sword status;
+    int n;
+
+    switch (q->state) {
+        case GATHER_EXECUTING:
+            status = job_call (L, conn, JOB_EXECUTE, q->stmthp, conn->errhp,
+                q->type == OCI_STMT_SELECT ? 0 : 1,
+                q->type == OCI_STMT_SELECT ? OCI_DEFAULT : OCI_COMMIT_ON_SUCCESS);
+            if (status == OCI_STILL_EXECUTING)
+                return 0;
+            trace_call (conn, "OCIStmtExecute", q->stats, q->start, status);
+            stats_execute (q->stats, call_time (conn, q->start), status);
+            if (!OCI_OK (status) && status != OCI_NO_DATA) {
+                gather_fail (L, g, q, status);
+                return 1;
+            }
 
-    /* fill in structure */
-    cur->conn = conn;
-    cur->closed = 0;
-    cur->numcols = 0;
-    cur->colnames = LUA_NOREF;
-    cur->coltypes = LUA_NOREF;
-    cur->columns = LUA_NOREF;
-    cur->stmthp = stmt;
-    cur->errhp = NULL;
-    cur->cols = NULL;
-    cur->text = strdup (text);
-    ASSERT_PTR (L, cur->text);
+            if (q->type != OCI_STMT_SELECT) {
+                ub4 rows = 0;
+                OCIAttrGet ((dvoid *) q->stmthp, (ub4) OCI_HTYPE_STMT,
+                    (dvoid *) &rows, (ub4 *)0, (ub4) OCI_ATTR_ROW_COUNT,
+                    conn->errhp);
+                if (q->stats)
+                    q->stats->rows += rows;
+                lua_pushnumber (L, rows);
+                q->result = luaL_ref (L, LUA_REGISTRYINDEX);
+                gather_release (L, g, q);
+                q->state = GATHER_READY;
+                return 1;
+            }
 
-    /* error handler */
-    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) conn->env->envhp,
-        (dvoid **) &(cur->errhp), (ub4) OCI_HTYPE_ERROR, (size_t) 0,
-        (dvoid **) 0), conn->errhp);
-    /* get number of columns */
-    ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmt, (ub4)OCI_HTYPE_STMT,
-        (dvoid *) &cur->numcols, (ub4 *)0, (ub4)OCI_ATTR_PARAM_COUNT,
-        cur->errhp), cur->errhp);
+            /* the cursor owns the statement from now on */
+            q->state = GATHER_RETURNED;
+            stmthp = q->stmthp;
+            q->stmthp = NULL;
+            create_cursor (L, conn, stmthp, q->sql, 0, &conn->prefetch, NULL);
+            cur = q->cur = (cur_data *) lua_touserdata (L, -1);
+            q->curref = luaL_ref (L, LUA_REGISTRYINDEX);
+            lua_newtable (L);
+            q->result = luaL_ref (L, LUA_REGISTRYINDEX);
+
+            /* results without descriptors are read and encoded by a worker */
+            cur->fill = cache_begin (cur, cur->text, strlen (cur->text) + 1, 0);
+            if (cur->fill) {
+                conn->job.arg = cur;
+                q->start = now_us ();
+                job_call (L, conn, JOB_DRAIN, cur->stmthp, cur->errhp,
+                    cur->arraysize, OCI_DEFAULT);
+                q->state = GATHER_DRAINING;
+            } else {
+                cur->stats = q->stats;
+                q->state = GATHER_FETCHING;
+                cur_refill (L, cur);
+            }
+            return 1;
+
+        case GATHER_DRAINING:
+            status = job_call (L, conn, JOB_DRAIN, cur->stmthp, cur->errhp,
+                cur->arraysize, OCI_DEFAULT);
+            if (status == OCI_STILL_EXECUTING)
+                return 0;
+            trace_call (conn, "OCIStmtFetch2", q->stats, q->start, status);
+            if (status != OCI_SUCCESS || cur->fill == NULL) {
+                gather_fail (L, g, q, status);
+                return 1;
+            }
 
-    cur->cols = (column_data *)calloc (cur->numcols, sizeof(column_data));
-    ASSERT_PTR (L, cur->cols);
+            /* the cursor replays the rows encoded by the worker */
+            cur->replay = cur->fill;
+            cur->replay->refs = 1;
+            cur->fill = NULL;
+            cur->eof = 0;
+            stats_fetch (q->stats, conn->job.elapsed, cur->replay->nrows);
+            while (cur_refill (L, cur) > 0)
+                gather_rows (L, g, q);
+            gather_release (L, g, q);
+            q->state = GATHER_READY;
+            return 1;
+
+        case GATHER_FETCHING:
+            n = cur_refill (L, cur);
+            if (n < 0)
+                return 0;
+            if (n > 0)
+                gather_rows (L, g, q);
+            else {
+                gather_release (L, g, q);
+                q->state = GATHER_READY;
+            }
+            return 1;
 
-    /* define output variables */
-    /* Oracle and Lua column indices ranges from 1 to numcols */
-    /* C array indices ranges from 0 to numcols-1 */
-    for (i = 1; i <= cur->numcols; i++)
-        alloc_column_buffer (L, cur, i);
+        default:
+            return 0;
+    }
+}
 
-    conn->cur_counter++;
 
-    return 1;
+/*
+** Wait until a running statement of the gather has finished its call.
+*/
+static void
+gather_wait (gather_data *g) {
+    workers_data *w = &g->env->workers;
+    int i, queued;
+
+    workers_lock (w);
+    for (;;) {
+        queued = 0;
+        for (i = 0; i < g->nqueries; i++) {
+            gather_query *q = &g->queries[i];
+            if (q->conn != NULL) {
+                if (q->conn->job.state != JOB_QUEUED)
+                    break;
+                queued++;
+            }
+        }
+        if (i < g->nqueries || queued == 0)
+            break;
+        pthread_cond_wait (&w->done, &w->lock);
+    }
+    pthread_mutex_unlock (&w->lock);
 }
 
 
 /*
-** Execute an SQL statement.
-** Return a Cursor object if the statement is a query, otherwise
-** return the number of tuples affected by the statement.
+** Close a gather: wait for its statements and release their sessions.
 */
 static int
-conn_execute (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    const char *statement = luaL_checkstring (L, 2);
-    sword status;
-    ub4 prefetch = 500;
-    ub4 iters;
-    ub4 mode;
-    ub2 type;
-    OCIStmt *stmthp = NULL;
-
-    /* statement handle */
-    if (lua_gettop(L) >= 3 && lua_isuserdata (L, -1)) {
-        stmthp = (OCIStmt *) lua_touserdata(L, -1);
-    } else {
-        ASSERT_OCI (L, OCIHandleAlloc ((dvoid *)conn->env->envhp, (dvoid **)&stmthp,
-            OCI_HTYPE_STMT, (size_t)0, (dvoid **)0), conn->errhp);
-        ASSERT_OCI (L, OCIAttrSet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
-            (dvoid *)&prefetch, (ub4)0, (ub4)OCI_ATTR_PREFETCH_ROWS,
-            conn->errhp), conn->errhp);
-        ASSERT_OCI (L, OCIStmtPrepare (stmthp, conn->errhp, (text *)statement,
-            (ub4) strlen(statement), (ub4) OCI_NTV_SYNTAX, (ub4) OCI_DEFAULT),
-            conn->errhp);
+gather_close (lua_State *L) {
+    gather_data *g = (gather_data *)luaL_checkudata (L, 1, LUASQL_GATHER_OCI8);
+    int i, k;
+    luaL_argcheck (L, g != NULL, 1, LUASQL_PREFIX"gather expected");
+    if (g->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
     }
+    g->closed = 1;
+
+    for (i = 0; i < g->nqueries; i++) {
+        gather_query *q = &g->queries[i];
+        gather_release (L, g, q);
+        luaL_unref (L, LUA_REGISTRYINDEX, q->result);
+        q->result = LUA_NOREF;
+        for (k = 0; k < q->nvalues; k++)
+            if (q->values[k].text)
+                free (q->values[k].text);
+        if (q->values)
+            free (q->values);
+        if (q->sql)
+            free (q->sql);
+        if (q->errmsg)
+            free (q->errmsg);
+    }
+    if (g->queries)
+        free (g->queries);
+    g->queries = NULL;
+    g->nqueries = 0;
+    if (g->event.fd[0] >= 0)
+        close (g->event.fd[0]);
+    if (g->event.fd[1] >= 0 && g->event.fd[1] != g->event.fd[0])
+        close (g->event.fd[1]);
+    g->event.fd[0] = g->event.fd[1] = -1;
+    luaL_unref (L, LUA_REGISTRYINDEX, g->poolref);
+    g->poolref = LUA_NOREF;
 
-    /* statement type */
-    ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmthp, (ub4) OCI_HTYPE_STMT,
-        (dvoid *)&type, (ub4 *)0, (ub4)OCI_ATTR_STMT_TYPE, conn->errhp),
-        conn->errhp);
+    lua_pushboolean (L, 1);
+    return 1;
+}
 
-    iters = type == OCI_STMT_SELECT ? 0 : 1;
-    mode = conn->auto_commit ? OCI_COMMIT_ON_SUCCESS : OCI_DEFAULT;
 
-    /* execute statement */
-    status = OCIStmtExecute (conn->svchp, stmthp, conn->errhp, iters,
-        (ub4)0, (CONST OCISnapshot *)NULL, (OCISnapshot *)NULL, mode);
-    if (status == OCI_STILL_EXECUTING) {
-        lua_pushlightuserdata (L, (void *) stmthp);
-        lua_pushnumber (L, OCI_STILL_EXECUTING);
-        return 2;
-    }
-    if (status && (status != OCI_NO_DATA)) {
-        OCIHandleFree ((dvoid *)stmthp, OCI_HTYPE_STMT);
-        ASSERT_OCI (L, status, conn->errhp);
-        /* unreachable */
-        return 0;
-    }
-    if (type == OCI_STMT_SELECT) {
-        /* create cursor */
-        return create_cursor (L, conn, stmthp, statement);
-    } else {
-        /* return number of rows */
-        int rows_affected;
-        ASSERT_OCI (L, OCIAttrGet ((dvoid *)stmthp, (ub4)OCI_HTYPE_STMT,
-            (dvoid *)&rows_affected, (ub4 *)0,
-            (ub4)OCI_ATTR_ROW_COUNT, conn->errhp), conn->errhp);
-        OCIHandleFree ((dvoid *)stmthp, OCI_HTYPE_STMT);
-        lua_pushnumber (L, rows_affected);
-        return 1;
+/*
+** Return the index and the result of a finished statement of the
+** gather: an array of rows for queries, the number of rows affected
+** for other statements. The failure of a statement is raised, the
+** other statements go on. At the end return nil and release the
+** gather. Unless wait is true, return nil and OCI_STILL_EXECUTING
+** while no statement is finished; the descriptor of g:getfd() is then
+** readable when one is.
+*/
+static int
+gather_next (lua_State *L) {
+    gather_data *g = getgather (L);
+    int wait = lua_toboolean (L, 2);
+    int i, active, progress;
+
+    lua_settop (L, 1);
+    for (;;) {
+        /* start the statements while the pool has free sessions; with
+           none free and none running, the caller holds them all */
+        while (g->next < g->nqueries) {
+            gather_query *q = &g->queries[g->next];
+            if (pool_available (g->pool) > 0)
+                gather_start (L, g, q);
+            else if (g->running == 0) {
+                q->errmsg = strdup ("no free session in the pool");
+                q->state = GATHER_FAILED;
+            }
+            else
+                break;
+            g->next++;
+        }
+
+        /* calls finished from now on signal the event again */
+        job_drain (&g->event);
+        active = progress = 0;
+        for (i = 0; i < g->nqueries; i++) {
+            gather_query *q = &g->queries[i];
+            while (q->conn && gather_step (L, g, q))
+                progress = 1;
+            if (q->state == GATHER_READY) {
+                q->state = GATHER_RETURNED;
+                lua_pushinteger (L, i + 1);
+                lua_rawgeti (L, LUA_REGISTRYINDEX, q->result);
+                luaL_unref (L, LUA_REGISTRYINDEX, q->result);
+                q->result = LUA_NOREF;
+                return 2;
+            }
+            if (q->state == GATHER_FAILED) {
+                q->state = GATHER_RETURNED;
+                lua_pushfstring (L, LUASQL_PREFIX"statement #%d: %s", i + 1,
+                    q->errmsg ? q->errmsg : "no memory");
+                return lua_error (L);
+            }
+            if (q->state != GATHER_RETURNED)
+                active++;
+        }
+        if (active == 0) {
+            /* all results are returned */
+            gather_close (L);
+            lua_pushnil (L);
+            return 1;
+        }
+        if (progress)
+            continue;
+        if (!wait) {
+            lua_pushnil (L);
+            lua_pushinteger (L, OCI_STILL_EXECUTING);
+            return 2;
+        }
+        gather_wait (g);
     }
 }
 
 
 /*
-** Commit the current transaction.
+** Return the descriptor readable when a statement of the gather is
+** finished.
 */
 static int
-conn_commit (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    sword status = OCITransCommit (conn->svchp, conn->errhp, OCI_DEFAULT);
-    if (status == OCI_STILL_EXECUTING) {
-        lua_pushnil (L);
-        lua_pushinteger (L, OCI_STILL_EXECUTING);
-        return 2;
-    }
-    ASSERT_OCI (L, status, conn->errhp);
-    lua_pushboolean (L, 1);
+gather_getfd (lua_State *L) {
+    gather_data *g = getgather (L);
+    lua_pushinteger (L, g->event.fd[0]);
     return 1;
 }
 
 
 /*
-** Rollback the current transaction.
+** Run independent statements at once, each on its own session of the
+** pool, at most the free sessions of the pool at a time:
+**   pool:gather ({sql | {sql, value, ...}, ...} [, {rows = "na", async = true}])
+** Values are bound by position. Queries are fetched and their rows
+** encoded by the workers of the environment; the Lua thread only
+** builds the row tables, with the options of cur:fetchmany. Return the
+** results in the order of the statements, or with async a gather
+** object whose next() returns them as they finish.
 */
 static int
-conn_rollback (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    sword status = OCITransRollback (conn->svchp, conn->errhp, OCI_DEFAULT);
-    if (status == OCI_STILL_EXECUTING) {
-        lua_pushnil (L);
-        lua_pushinteger (L, OCI_STILL_EXECUTING);
-        return 2;
+pool_gather (lua_State *L) {
+    pool_data *pool = getpool (L);
+    gather_data *g;
+    const char *rows = "n";
+    int async = 0, n, i, k, idx;
+
+    luaL_checktype (L, 2, LUA_TTABLE);
+    if (lua_istable (L, 3)) {
+        lua_getfield (L, 3, "rows");
+        if (lua_isstring (L, -1))
+            rows = lua_tostring (L, -1);
+        lua_getfield (L, 3, "async");
+        async = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+    }
+    n = (int) lua_rawlen (L, 2);
+
+    /* Alloc gather object */
+    g = (gather_data *) lua_newuserdata (L, sizeof(gather_data));
+    luasql_setmeta (L, LUASQL_GATHER_OCI8);
+    memset (g, 0, sizeof(gather_data));
+    idx = lua_gettop (L);
+    g->poolref = LUA_NOREF;
+    g->env = pool->env;
+    g->pool = pool;
+    g->num = strchr (rows, 'n') != NULL;
+    g->named = strchr (rows, 'a') != NULL;
+    g->event.fd[0] = g->event.fd[1] = -1;
+    lua_pushvalue (L, 1);
+    g->poolref = luaL_ref (L, LUA_REGISTRYINDEX);
+    if (job_init (&g->event, 1) < 0)
+        return luaL_error (L, LUASQL_PREFIX"couldn't create completion event");
+
+    g->queries = (gather_query *) calloc (n ? n : 1, sizeof(gather_query));
+    ASSERT_PTR (L, g->queries);
+    for (i = 0; i < n; i++) {
+        gather_query *q = &g->queries[i];
+        q->connref = q->curref = q->result = LUA_NOREF;
+        g->nqueries++;
+
+        lua_rawgeti (L, 2, i + 1);
+        if (lua_istable (L, -1)) {
+            q->nvalues = (int) lua_rawlen (L, -1) - 1;
+            if (q->nvalues > 0) {
+                q->values = (gather_value *) calloc (q->nvalues, sizeof(gather_value));
+                ASSERT_PTR (L, q->values);
+            }
+            for (k = 0; k < q->nvalues; k++) {
+                gather_value *v = &q->values[k];
+                lua_rawgeti (L, -1, k + 2);
+                if (lua_type (L, -1) == LUA_TNUMBER) {
+                    v->type = SQLT_FLT;
+                    v->num = lua_tonumber (L, -1);
+                } else if (lua_type (L, -1) == LUA_TSTRING) {
+                    v->type = SQLT_CHR;
+                    v->text = strdup (lua_tostring (L, -1));
+                    ASSERT_PTR (L, v->text);
+                } else
+                    return luaL_error (L, LUASQL_PREFIX"statement #%d: "
+                        "number or string expected for value #%d", i + 1, k + 1);
+                lua_pop (L, 1);
+            }
+            lua_rawgeti (L, -1, 1);
+            lua_replace (L, -2);
+        }
+        if (lua_type (L, -1) != LUA_TSTRING)
+            return luaL_error (L, LUASQL_PREFIX"statement #%d: SQL text expected",
+                i + 1);
+        q->sql = strdup (lua_tostring (L, -1));
+        ASSERT_PTR (L, q->sql);
+        lua_pop (L, 1);
+    }
+
+    if (async) {
+        lua_pushvalue (L, idx);
+        return 1;
+    }
+
+    /* wait for all results, closing the gather on failure */
+    lua_createtable (L, n, 0);
+    for (;;) {
+        lua_pushcfunction (L, gather_next);
+        lua_pushvalue (L, idx);
+        lua_pushboolean (L, 1);
+        if (lua_pcall (L, 2, 2, 0) != 0) {
+            lua_pushcfunction (L, gather_close);
+            lua_pushvalue (L, idx);
+            lua_call (L, 1, 0);
+            return lua_error (L);
+        }
+        if (lua_isnil (L, -2)) {
+            lua_pop (L, 2);
+            return 1;
+        }
+        lua_rawseti (L, -3, (int) lua_tointeger (L, -2));
+        lua_pop (L, 1);
     }
-    ASSERT_OCI (L, status, conn->errhp);
-    lua_pushboolean (L, 1);
-    return 1;
 }
 
 
 /*
-** Set "auto commit" property of the connection.
-** If 'true', then rollback current transaction.
-** If 'false', then start a new transaction.
+** Release the statistics; no statement may use them any more.
 */
-static int
-conn_setautocommit (lua_State *L) {
-    conn_data *conn = getconnection (L);
-    if (lua_toboolean (L, 2)) {
-        conn->auto_commit = 1;
-        /* Undo active transaction. */
-        ASSERT_OCI (L, OCITransRollback (conn->svchp, conn->errhp,
-            OCI_DEFAULT), conn->errhp);
+static void
+stats_free (stats_data *sd) {
+    int i;
+    for (i = 0; sd->buckets && i < LUASQL_OCI_STATS_MAX; i++) {
+        stats_entry *st = sd->buckets[i];
+        while (st) {
+            stats_entry *next = st->chain;
+            free (st->text);
+            free (st);
+            st = next;
+        }
     }
-    else {
-        conn->auto_commit = 0;
+    if (sd->other) {
+        free (sd->other->text);
+        free (sd->other);
     }
-    lua_pushboolean(L, 1);
-    return 1;
+    free (sd->buckets);
+    sd->buckets = NULL;
+    sd->other = NULL;
+    sd->enabled = 0;
 }
 
 
 /*
-** Connects to a data source.
+** Close environment object.
 */
 static int
-env_connect (lua_State *L) {
-    env_data *env = getenvironment (L);
-    int utf8 = 0;
-
-    const char *sourcename = luaL_checkstring(L, 2);
-    const char *username = luaL_checkstring(L, 3);
-    const char *password = luaL_checkstring(L, 4);
+env_close (lua_State *L) {
+    env_data *env = (env_data *)luaL_checkudata (L, 1, LUASQL_ENVIRONMENT_OCI8);
+    luaL_argcheck (L, env != NULL, 1, LUASQL_PREFIX"environment expected");
 
-    if (lua_gettop (L) > 4 && lua_istable (L, 5)) {
-        lua_getfield (L, 5, "utf8");
-        if (lua_isboolean (L, -1)) {
-            utf8 = lua_toboolean (L, -1);
-            lua_pop (L, 1);
-        }
+    if (env->closed) {
+        lua_pushboolean (L, 0);
+        return 1;
     }
 
-    /* Alloc connection object */
-    conn_data *conn = (conn_data *)lua_newuserdata(L, sizeof(conn_data));
-
-    /* fill in structure */
-    luasql_setmeta (L, LUASQL_CONNECTION_OCI8);
-    conn->env = env;
-    conn->utf8 = utf8;
-    conn->connecting = 0;
-    conn->closed = 1;
-    conn->auto_commit = 0;
-    conn->cur_counter = 0;
-    conn->srvhp = NULL;
-    conn->svchp = NULL;
-    conn->errhp = NULL;
-    conn->authp = NULL;
+    if (env->conn_counter > 0)
+        return luaL_error (L, LUASQL_PREFIX"there are open connections");
 
-    strncpy(conn->sourcename, sourcename, sizeof(conn->sourcename));
-    strncpy(conn->username, username, sizeof(conn->username));
-    strncpy(conn->password, password, sizeof(conn->password));
+    env->closed = 1;
 
-    /* error handler */
-    ASSERT_OCI (L, OCIHandleAlloc((dvoid *) env->envhp,
-        (dvoid **) &(conn->errhp),
-        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0), env->errhp);
-    /* login */
-    ASSERT_OCI (L, OCILogon(env->envhp, conn->errhp, &(conn->svchp),
-        (CONST text*) username, strlen(username),
-        (CONST text*) password, strlen(password),
-        (CONST text*) sourcename, strlen(sourcename)), conn->errhp);
+    workers_stop (&env->workers);
+    workers_stop (&env->connectors);
+    workers_free (&env->workers);
+    workers_free (&env->connectors);
 
-    conn->closed = 0;
-    env->conn_counter++;
+    if (env->cache.buckets) {
+        cache_flush (&env->cache);
+        free (env->cache.buckets);
+        env->cache.buckets = NULL;
+    }
+    stats_free (&env->stats);
+    free (env->trace.ring);
+    env->trace.ring = NULL;
 
-    return 1;
-}
+    if (env->envhp)
+        OCIHandleFree ((dvoid *)env->envhp, OCI_HTYPE_ENV);
+    if (env->errhp)
+        OCIHandleFree ((dvoid *)env->errhp, OCI_HTYPE_ERROR);
 
+    lua_pushboolean (L, 1);
 
-static void
-async_completed (void *p) {
-    conn_data *conn = (conn_data *) p;
-    conn->connecting = 0;
+    return 1;
 }
 
 
-#define OCI_THR_CHECK(exp) { sword s = exp; if (s) pthread_exit((void *) s); }
-
 /*
-** Async connects to a data source.
+** Push the counters of the result cache.
 */
-static void *
-async_open (void *p) {
-    conn_data *conn = (conn_data *) p;
-    env_data *env = conn->env;
-
-    pthread_cleanup_push(async_completed, p);
-    pthread_cleanup_push(pthread_mutex_unlock, (void *) &conn->env->mtx);
-
-    pthread_mutex_lock(&conn->env->mtx);
-
-    OCI_THR_CHECK (OCIHandleAlloc((dvoid *) env->envhp,
-        (dvoid **) &(conn->errhp),
-        (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0));
-
-    OCI_THR_CHECK (OCIHandleAlloc((dvoid *) env->envhp,
-        (dvoid **) &(conn->srvhp),
-        (ub4) OCI_HTYPE_SERVER, (size_t) 0, (dvoid **) 0));
-
-    OCI_THR_CHECK (OCIHandleAlloc((dvoid *) env->envhp,
-        (dvoid **) &(conn->svchp),
-        (ub4) OCI_HTYPE_SVCCTX, (size_t) 0, (dvoid **) 0));
-
-    OCI_THR_CHECK(OCIServerAttach(conn->srvhp, conn->errhp,
-        (text *) conn->sourcename, (sb4) strlen(conn->sourcename), OCI_DEFAULT));
+static int
+env_cachestats (lua_State *L) {
+    env_data *env = getenvironment (L);
+    cache_data *c = &env->cache;
 
-    OCI_THR_CHECK (OCIAttrSet((dvoid *) conn->svchp, OCI_HTYPE_SVCCTX,
-        (dvoid *) conn->srvhp, (ub4)0, OCI_ATTR_SERVER, conn->errhp));
+    lua_createtable (L, 0, 8);
 
-    OCI_THR_CHECK (OCIHandleAlloc((dvoid *)env->envhp,
-        (dvoid **) &conn->authp, OCI_HTYPE_SESSION, 0 , (dvoid **) 0));
+    lua_pushliteral (L, "hits");
+    lua_pushnumber (L, c->hits);
+    lua_rawset (L, -3);
 
-    OCI_THR_CHECK (OCIAttrSet((dvoid *)conn->authp, OCI_HTYPE_SESSION,
-        (dvoid *) conn->username,    (ub4) strlen(conn->username), OCI_ATTR_USERNAME, conn->errhp));
+    lua_pushliteral (L, "misses");
+    lua_pushnumber (L, c->misses);
+    lua_rawset (L, -3);
 
-    OCI_THR_CHECK (OCIAttrSet((dvoid *)conn->authp, OCI_HTYPE_SESSION,
-        (dvoid *) conn->password,    (ub4) strlen(conn->password), OCI_ATTR_PASSWORD, conn->errhp));
+    lua_pushliteral (L, "evictions");
+    lua_pushnumber (L, c->evictions);
+    lua_rawset (L, -3);
 
-    OCI_THR_CHECK (OCISessionBegin(conn->svchp, conn->errhp, conn->authp,
-        OCI_CRED_RDBMS, (ub4) OCI_DEFAULT));
+    lua_pushliteral (L, "expired");
+    lua_pushnumber (L, c->expired);
+    lua_rawset (L, -3);
 
-    OCI_THR_CHECK (OCIAttrSet(conn->svchp, OCI_HTYPE_SVCCTX,
-        conn->authp, 0, OCI_ATTR_SESSION, conn->errhp));
+    lua_pushliteral (L, "entries");
+    lua_pushnumber (L, c->entries);
+    lua_rawset (L, -3);
 
-    /* set nonblocking */
-    OCI_THR_CHECK (OCIAttrSet ((dvoid *) conn->srvhp, (ub4) OCI_HTYPE_SERVER,
-        (dvoid *) 0, (ub4) 0,
-        (ub4) OCI_ATTR_NONBLOCKING_MODE, conn->errhp));
+    lua_pushliteral (L, "bytes");
+    lua_pushnumber (L, (lua_Number) c->bytes);
+    lua_rawset (L, -3);
 
-    pthread_cleanup_pop(1);
-    pthread_cleanup_pop(1);
+    lua_pushliteral (L, "budget");
+    lua_pushnumber (L, (lua_Number) c->budget);
+    lua_rawset (L, -3);
 
-    return (void *) OCI_SUCCESS;
+    return 1;
 }
 
 
 /*
-** Connects to a data source asynchronous.
+** Drop all cached results, e.g. after the cached tables changed.
 */
 static int
-env_connect_async (lua_State *L) {
+env_cacheflush (lua_State *L) {
     env_data *env = getenvironment (L);
-    int utf8 = 0;
+    if (env->cache.buckets)
+        cache_flush (&env->cache);
+    lua_pushboolean (L, 1);
+    return 1;
+}
 
-    const char *sourcename = luaL_checkstring(L, 2);
-    const char *username = luaL_checkstring(L, 3);
-    const char *password = luaL_checkstring(L, 4);
 
-    if (lua_gettop (L) > 4 && lua_istable (L, 5)) {
-        lua_getfield (L, 5, "utf8");
-        if (lua_isboolean (L, -1)) {
-            utf8 = lua_toboolean(L, -1);
-            lua_pop (L, 1);
-        }
+static void
+pushlatency (lua_State *L, const char *name, latency_stats *l) {
+    int i, n = STATS_BUCKETS;
+
+    lua_pushstring (L, name);
+    lua_createtable (L, 0, 4);
+
+    lua_pushliteral (L, "count");
+    lua_pushnumber (L, (lua_Number) l->count);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "total");
+    lua_pushnumber (L, (lua_Number) l->total);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "max");
+    lua_pushnumber (L, (lua_Number) l->max);
+    lua_rawset (L, -3);
+
+    /* empty buckets of the slowest calls are left out */
+    while (n > 0 && l->buckets[n - 1] == 0)
+        n--;
+    lua_pushliteral (L, "histogram");
+    lua_createtable (L, n, 0);
+    for (i = 0; i < n; i++) {
+        lua_pushnumber (L, (lua_Number) l->buckets[i]);
+        lua_rawseti (L, -2, i + 1);
     }
+    lua_rawset (L, -3);
 
-    sword status;
-
-    /* Alloc connection object */
-    conn_data *conn;
-
-    if (lua_gettop(L) > 1 && lua_isuserdata(L, -1)) {
-        conn = (conn_data *)luaL_checkudata (L, -1, LUASQL_CONNECTION_OCI8);
-        if (conn == NULL) {
-            return luaL_error (L, LUASQL_PREFIX"connection handle expected");
-        }
-    } else {
-        conn = (conn_data *)lua_newuserdata(L, sizeof(conn_data));
+    lua_rawset (L, -3);
+}
 
-        /* fill in structure */
-        luasql_setmeta (L, LUASQL_CONNECTION_OCI8);
-        conn->env = env;
-        conn->utf8 = utf8;
-        conn->connecting = 1;
-        conn->closed = 1;
-        conn->auto_commit = 0;
-        conn->cur_counter = 0;
-        conn->srvhp = NULL;
-        conn->svchp = NULL;
-        conn->errhp = NULL;
-        conn->authp = NULL;
 
-        strncpy(conn->sourcename, sourcename, sizeof(conn->sourcename));
-        strncpy(conn->username, username, sizeof(conn->username));
-        strncpy(conn->password, password, sizeof(conn->password));
+static void
+pushstats (lua_State *L, stats_entry *st) {
+    lua_pushlstring (L, st->text,
+        st->len < LUASQL_OCI_STATS_TEXT ? st->len : LUASQL_OCI_STATS_TEXT);
+    lua_createtable (L, 0, 8);
 
-        pthread_create(&conn->tid, NULL, async_open, conn);
+    lua_pushliteral (L, "executes");
+    lua_pushnumber (L, (lua_Number) st->executes);
+    lua_rawset (L, -3);
 
-        lua_pushinteger (L, OCI_STILL_EXECUTING);
+    lua_pushliteral (L, "errors");
+    lua_pushnumber (L, (lua_Number) st->errors);
+    lua_rawset (L, -3);
 
-        return 2;
-    }
+    lua_pushliteral (L, "rows");
+    lua_pushnumber (L, (lua_Number) st->rows);
+    lua_rawset (L, -3);
 
-    if (conn->connecting) {
-        lua_pushvalue (L, -1);
-        lua_pushinteger (L, OCI_STILL_EXECUTING);
-        return 2;
-    }
+    lua_pushliteral (L, "fetches");
+    lua_pushnumber (L, (lua_Number) st->fetches);
+    lua_rawset (L, -3);
 
-    pthread_join(conn->tid, (void **) &status);
+    lua_pushliteral (L, "roundtrips");
+    lua_pushnumber (L, (lua_Number) st->roundtrips);
+    lua_rawset (L, -3);
 
-    ASSERT_OCI (L, status, conn->errhp);
+    pushlatency (L, "prepare", &st->prepare);
+    pushlatency (L, "execute", &st->execute);
+    pushlatency (L, "fetch", &st->fetch);
 
-    conn->closed = 0;
-    conn->tid = 0;
-    env->conn_counter++;
+    lua_rawset (L, -3);
+}
 
-    lua_pushvalue (L, -1);
 
+/*
+** Push the statistics by SQL fingerprint: a table of counters and of
+** latency histograms in microseconds, whose bucket i counts the calls
+** shorter than 2^i us. With true, the counters are reset afterwards.
+*/
+static int
+env_stats (lua_State *L) {
+    env_data *env = getenvironment (L);
+    stats_data *sd = &env->stats;
+    int reset = lua_toboolean (L, 2), i;
+
+    lua_createtable (L, 0, sd->entries);
+    for (i = 0; sd->buckets && i < LUASQL_OCI_STATS_MAX; i++) {
+        stats_entry *st;
+        for (st = sd->buckets[i]; st; st = st->chain) {
+            pushstats (L, st);
+            if (reset)
+                memset (&st->executes, 0,
+                    sizeof(stats_entry) - offsetof(stats_entry, executes));
+        }
+    }
+    if (sd->other) {
+        pushstats (L, sd->other);
+        if (reset)
+            memset (&sd->other->executes, 0,
+                sizeof(stats_entry) - offsetof(stats_entry, executes));
+    }
     return 1;
 }
 
 
 /*
-** Close environment object.
+** Push the counters of a pool of workers; they are copied under its lock
+** and the table is built after, so allocations do not hold the lock.
 */
-static int
-env_close (lua_State *L) {
-    env_data *env = (env_data *)luaL_checkudata (L, 1, LUASQL_ENVIRONMENT_OCI8);
-    luaL_argcheck (L, env != NULL, 1, LUASQL_PREFIX"environment expected");
+static void
+pushworkers (lua_State *L, const char *name, workers_data *w) {
+    job_data *job;
+    struct {
+        int nthreads, size, queued;
+        uint64_t jobs, locks, contended, waited;
+    } c;
+
+    workers_lock (w);
+    c.queued = 0;
+    for (job = w->head; job; job = job->next)
+        c.queued++;
+    c.nthreads = w->nthreads;
+    c.size = w->size;
+    c.jobs = w->jobs;
+    c.locks = w->locks;
+    c.contended = w->contended;
+    c.waited = w->waited;
+    pthread_mutex_unlock (&w->lock);
+
+    lua_pushstring (L, name);
+    lua_createtable (L, 0, 7);
+
+    lua_pushliteral (L, "threads");
+    lua_pushnumber (L, c.nthreads);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "size");
+    lua_pushnumber (L, c.size);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "queued");
+    lua_pushnumber (L, c.queued);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "jobs");
+    lua_pushnumber (L, (lua_Number) c.jobs);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "locks");
+    lua_pushnumber (L, (lua_Number) c.locks);
+    lua_rawset (L, -3);
+
+    lua_pushliteral (L, "contended");
+    lua_pushnumber (L, (lua_Number) c.contended);
+    lua_rawset (L, -3);
+
+    /* microseconds waited for the lock */
+    lua_pushliteral (L, "waited");
+    lua_pushnumber (L, (lua_Number) c.waited);
+    lua_rawset (L, -3);
+
+    lua_rawset (L, -3);
+}
 
-    if (env->closed) {
-        lua_pushboolean (L, 0);
-        return 1;
-    }
 
-    if (env->conn_counter > 0)
-        return luaL_error (L, LUASQL_PREFIX"there are open connections");
+/*
+** Return the state of the worker threads of threaded connections and
+** of async connects, with the contention on the lock of each pool.
+*/
+static int
+env_workerstats (lua_State *L) {
+    env_data *env = getenvironment (L);
+    lua_createtable (L, 0, 2);
+    pushworkers (L, "workers", &env->workers);
+    pushworkers (L, "connectors", &env->connectors);
+    return 1;
+}
 
-    env->closed = 1;
 
-    if (env->envhp)
-        OCIHandleFree ((dvoid *)env->envhp, OCI_HTYPE_ENV);
-    if (env->errhp)
-        OCIHandleFree ((dvoid *)env->errhp, OCI_HTYPE_ERROR);
+/*
+** Add a JSON string to the buffer.
+*/
+static void
+addjson (luaL_Buffer *b, const char *s, size_t len) {
+    size_t i;
+    luaL_addchar (b, '"');
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) s[i];
+        if (c == '"' || c == '\\') {
+            luaL_addchar (b, '\\');
+            luaL_addchar (b, c);
+        }
+        else if (c < 0x20) {
+            char esc[8];
+            snprintf (esc, sizeof(esc), "\\u%04x", c);
+            luaL_addstring (b, esc);
+        }
+        else
+            luaL_addchar (b, c);
+    }
+    luaL_addchar (b, '"');
+}
 
-    lua_pushboolean (L, 1);
 
+/*
+** Dump the recorded OCI calls as Chrome trace events, one complete
+** event per call with the connection as thread, to the file of the
+** given path or as a string. Calls being recorded are left out.
+** Return the string, or the number of events written.
+*/
+static int
+env_trace (lua_State *L) {
+    env_data *env = getenvironment (L);
+    const char *path = luaL_optstring (L, 2, NULL);
+    trace_data *t = &env->trace;
+    uint64_t head, pos;
+    lua_Number events = 0;
+    luaL_Buffer b;
+
+    luaL_buffinit (L, &b);
+    luaL_addstring (&b, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    head = t->ring ? __atomic_load_n (&t->head, __ATOMIC_ACQUIRE) : 0;
+    for (pos = head > t->size ? head - t->size : 0; pos < head; pos++) {
+        trace_event *slot = &t->ring[pos & (t->size - 1)];
+        trace_event e;
+        char num[160];
+
+        if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            continue;
+        e = *slot;
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) != pos + 1)
+            continue;
+
+        if (events > 0)
+            luaL_addchar (&b, ',');
+        luaL_addstring (&b, "{\"name\":");
+        addjson (&b, e.name, strlen (e.name));
+        snprintf (num, sizeof(num), ",\"cat\":\"oci\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64
+            ",\"args\":{\"status\":%d", e.lane, e.begin, e.end - e.begin,
+            (int) e.status);
+        luaL_addstring (&b, num);
+        if (e.tag) {
+            luaL_addstring (&b, ",\"sql\":");
+            addjson (&b, e.tag->text, e.tag->len < LUASQL_OCI_STATS_TEXT
+                ? e.tag->len : LUASQL_OCI_STATS_TEXT);
+        }
+        luaL_addstring (&b, "}}");
+        events++;
+    }
+    luaL_addstring (&b, "]}\n");
+    luaL_pushresult (&b);
+
+    if (path) {
+        size_t len;
+        const char *json = lua_tolstring (L, -1, &len);
+        FILE *f = fopen (path, "w");
+        int ok;
+        if (f == NULL)
+            return luaL_error (L, LUASQL_PREFIX"cannot open %s: %s", path,
+                strerror (errno));
+        ok = fwrite (json, 1, len, f) == len;
+        if (fclose (f) != 0)
+            ok = 0;
+        if (!ok)
+            return luaL_error (L, LUASQL_PREFIX"write error: %s",
+                strerror (errno));
+        lua_pushnumber (L, events);
+    }
     return 1;
 }
 
 
 /*
 ** Creates an Environment and returns it.
+** The optional table sets the number of 'workers' threads which run
+** the calls of threaded connections and of 'connectors' threads which
+** run async connects. Its field 'cache', true or a table with 'bytes'
+** and 'ttl' in seconds, enables the result cache used by queries
+** executed with the option cache; 'stats' enables env:stats(). Its
+** field 'trace', true or the number of calls kept, records the OCI
+** calls for env:trace(); it implies 'stats', whose entries tag the
+** traced calls with their SQL fingerprint.
 */
 static int
 create_environment (lua_State *L) {
-    env_data *env = (env_data *)lua_newuserdata(L, sizeof(env_data));
+    int workers = LUASQL_OCI_WORKERS;
+    int connectors = LUASQL_OCI_CONNECTORS;
+    lua_Number budget = 0, ttl = LUASQL_OCI_CACHE_TTL;
+    int stats = 0;
+    lua_Number trace = 0;
+    env_data *env;
     sword status;
+
+    if (lua_istable (L, 1)) {
+        workers = getintfield (L, 1, "workers", workers);
+        connectors = getintfield (L, 1, "connectors", connectors);
+
+        lua_getfield (L, 1, "cache");
+        if (lua_istable (L, -1)) {
+            lua_getfield (L, -1, "bytes");
+            budget = lua_isnumber (L, -1) ? lua_tonumber (L, -1)
+                : LUASQL_OCI_CACHE_BYTES;
+            lua_pop (L, 1);
+            lua_getfield (L, -1, "ttl");
+            if (lua_isnumber (L, -1))
+                ttl = lua_tonumber (L, -1);
+            lua_pop (L, 1);
+        }
+        else if (lua_toboolean (L, -1))
+            budget = LUASQL_OCI_CACHE_BYTES;
+        lua_pop (L, 1);
+
+        lua_getfield (L, 1, "stats");
+        stats = lua_toboolean (L, -1);
+        lua_pop (L, 1);
+
+        lua_getfield (L, 1, "trace");
+        if (lua_isnumber (L, -1))
+            trace = lua_tonumber (L, -1);
+        else if (lua_toboolean (L, -1))
+            trace = LUASQL_OCI_TRACE_EVENTS;
+        lua_pop (L, 1);
+    }
+    luaL_argcheck (L, workers > 0 && connectors > 0, 1,
+        LUASQL_PREFIX"positive number of threads expected");
+    luaL_argcheck (L, budget >= 0 && ttl > 0, 1,
+        LUASQL_PREFIX"invalid cache options");
+    luaL_argcheck (L, trace >= 0 && trace <= (1 << 24), 1,
+        LUASQL_PREFIX"invalid number of traced calls");
+
+    env = (env_data *)lua_newuserdata(L, sizeof(env_data));
     luasql_setmeta (L, LUASQL_ENVIRONMENT_OCI8);
 
     /* fill in structure */
@@ -1236,6 +8305,38 @@ create_environment (lua_State *L) {
     env->conn_counter = 0;
     env->envhp = NULL;
     env->errhp = NULL;
+    workers_init (&env->workers, workers);
+    workers_init (&env->connectors, connectors);
+    memset (&env->cache, 0, sizeof(cache_data));
+
+    if (budget > 0) {
+        env->cache.buckets = (cache_entry **) calloc (LUASQL_OCI_CACHE_BUCKETS,
+            sizeof(cache_entry *));
+        ASSERT_PTR (L, env->cache.buckets);
+        env->cache.nbuckets = LUASQL_OCI_CACHE_BUCKETS;
+        env->cache.budget = (size_t) budget;
+        env->cache.ttl = (uint64_t) (ttl * 1e6);
+    }
+
+    memset (&env->trace, 0, sizeof(trace_data));
+    if (trace >= 1) {
+        /* rounded up to a power of 2 */
+        uint64_t size = 1;
+        while (size < (uint64_t) trace)
+            size <<= 1;
+        env->trace.ring = (trace_event *) calloc (size, sizeof(trace_event));
+        ASSERT_PTR (L, env->trace.ring);
+        env->trace.size = size;
+    }
+
+    memset (&env->stats, 0, sizeof(stats_data));
+    /* traced calls are tagged with statistics entries */
+    if (stats || env->trace.ring) {
+        env->stats.buckets = (stats_entry **) calloc (LUASQL_OCI_STATS_MAX,
+            sizeof(stats_entry *));
+        ASSERT_PTR (L, env->stats.buckets);
+        env->stats.enabled = 1;
+    }
 
     if (status = OCIEnvCreate ( &(env->envhp), (ub4)OCI_THREADED, (dvoid *)0,
             (dvoid * (*)(dvoid *, size_t)) 0,
@@ -1250,8 +8351,6 @@ create_environment (lua_State *L) {
         (dvoid **) &(env->errhp),
         (ub4) OCI_HTYPE_ERROR, (size_t) 0, (dvoid **) 0), NULL);
 
-    pthread_mutex_init(&env->mtx, NULL);
-
     return 1;
 }
 
@@ -1266,6 +8365,13 @@ create_metatables (lua_State *L) {
         {"close", env_close},
         {"connect", env_connect},
         {"connect_async", env_connect_async},
+        {"pool", env_pool},
+        {"cachestats", env_cachestats},
+        {"cacheflush", env_cacheflush},
+        {"stats", env_stats},
+        {"trace", env_trace},
+        {"workerstats", env_workerstats},
+        {"parallel_query", env_parallel_query},
         {NULL, NULL},
     };
 
@@ -1278,6 +8384,60 @@ create_metatables (lua_State *L) {
         {"commit", conn_commit},
         {"rollback", conn_rollback},
         {"setautocommit", conn_setautocommit},
+        {"prepare", conn_prepare},
+        {"executemany", conn_executemany},
+        {"loader", conn_loader},
+        {"getfd", conn_getfd},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg statement_methods[] = {
+        {"__gc", stmt_close},
+        {"close", stmt_close},
+        {"execute", stmt_execute},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg pool_methods[] = {
+        {"__gc", pool_close},
+        {"close", pool_close},
+        {"acquire", pool_acquire},
+        {"release", pool_release},
+        {"stats", pool_stats},
+        {"gather", pool_gather},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg lob_methods[] = {
+        {"__gc", lob_close},
+        {"__call", lob_read},
+        {"close", lob_close},
+        {"read", lob_read},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg loader_methods[] = {
+        {"__gc", loader_close},
+        {"close", loader_close},
+        {"load", loader_load},
+        {"loadcsv", loader_loadcsv},
+        {"finish", loader_finish},
+        {"abort", loader_abort},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg parallel_methods[] = {
+        {"__gc", parallel_close},
+        {"close", parallel_close},
+        {"fetch", parallel_fetch},
+        {NULL, NULL},
+    };
+
+    struct luaL_Reg gather_methods[] = {
+        {"__gc", gather_close},
+        {"close", gather_close},
+        {"next", gather_next},
+        {"getfd", gather_getfd},
         {NULL, NULL},
     };
 
@@ -1288,6 +8448,13 @@ create_metatables (lua_State *L) {
         {"getcoltypes", cur_getcoltypes},
         {"getcolumns", cur_getcolumns},
         {"fetch", cur_fetch},
+        {"fetchmany", cur_fetchmany},
+        {"fetchcolumns", cur_fetchcolumns},
+        {"export", cur_export},
+        {"setarraysize", cur_setarraysize},
+        {"setdateformat", cur_setdateformat},
+        {"lob", cur_lob},
+        {"ffi", cur_ffi},
         {"numrows", cur_numrows},
         {NULL, NULL},
     };
@@ -1295,7 +8462,13 @@ create_metatables (lua_State *L) {
     luasql_createmeta (L, LUASQL_ENVIRONMENT_OCI8, environment_methods);
     luasql_createmeta (L, LUASQL_CONNECTION_OCI8, connection_methods);
     luasql_createmeta (L, LUASQL_CURSOR_OCI8, cursor_methods);
-    lua_pop (L, 3);
+    luasql_createmeta (L, LUASQL_STATEMENT_OCI8, statement_methods);
+    luasql_createmeta (L, LUASQL_POOL_OCI8, pool_methods);
+    luasql_createmeta (L, LUASQL_LOB_OCI8, lob_methods);
+    luasql_createmeta (L, LUASQL_LOADER_OCI8, loader_methods);
+    luasql_createmeta (L, LUASQL_PARALLEL_OCI8, parallel_methods);
+    luasql_createmeta (L, LUASQL_GATHER_OCI8, gather_methods);
+    lua_pop (L, 9);
 }
 
 
@@ -1335,6 +8508,8 @@ luaopen_luasql_oci8 (lua_State *L) {
     create_metatables (L);
     lua_newtable (L);
     luaL_setfuncs (L, driver, 0);
+    lua_pushliteral (L, LUASQL_OCI_FFI_CDEF);
+    lua_setfield (L, -2, "ffi_cdef");
     luasql_set_info (L);
     return 1;
 }
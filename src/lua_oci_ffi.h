@@ -0,0 +1,68 @@
+/*
+** LuaSQL, Oracle driver
+** C ABI of the array-fetch buffers of a cursor, for the LuaJIT FFI.
+** See Copyright Notice in license.html
+*/
+
+#ifndef _LUA_OCI_FFI_
+#define _LUA_OCI_FFI_
+
+#include <stdint.h>
+
+/*
+** The declarations are kept in one macro so that the same text is
+** compiled here and handed to ffi.cdef as LUASQL_OCI_FFI_CDEF.
+**
+** A batch is the view of a cursor returned by cur:ffi(). After
+** luasql_oci_fetch, rows first .. first + rows - 1 of every column are
+** valid: null[r] is -1 for NULL values, len[r] is the returned length
+** of character and binary values and nums[r] is the decoded value of
+** NUMBER columns. The views stay valid until the next fetch, a change
+** of the array size or the close of the cursor. The cursor is anchored
+** by cur:ffi() and is not collected before it is closed, so close it
+** explicitly when done; the batch must not be used after that.
+*/
+#define LUASQL_OCI_FFI_DECLS \
+enum { \
+    LUASQL_OCI_NUM_SIGNED = 1, \
+    LUASQL_OCI_NUM_UNSIGNED = 2, \
+    LUASQL_OCI_NUM_REAL = 3 \
+}; \
+typedef struct luasql_oci_number { \
+    int kind; \
+    union { \
+        int64_t i64; \
+        uint64_t u64; \
+        double dbl; \
+    } v; \
+} luasql_oci_number; \
+typedef struct luasql_oci_column { \
+    const char *name; \
+    unsigned int namelen; \
+    unsigned short type; \
+    unsigned int size; \
+    void *data; \
+    const short *null; \
+    const unsigned short *len; \
+    const luasql_oci_number *nums; \
+} luasql_oci_column; \
+typedef struct luasql_oci_batch { \
+    void *cursor; \
+    int numcols; \
+    const luasql_oci_column *cols; \
+    unsigned int first; \
+    unsigned int rows; \
+    int eof; \
+    char errmsg[512]; \
+} luasql_oci_batch; \
+int luasql_oci_fetch (luasql_oci_batch *batch);
+
+#define LUASQL_OCI_FFI_STR(...) #__VA_ARGS__
+#define LUASQL_OCI_FFI_XSTR(...) LUASQL_OCI_FFI_STR(__VA_ARGS__)
+
+/* text of the declarations for ffi.cdef */
+#define LUASQL_OCI_FFI_CDEF LUASQL_OCI_FFI_XSTR(LUASQL_OCI_FFI_DECLS)
+
+LUASQL_OCI_FFI_DECLS
+
+#endif
@@ -18,6 +18,11 @@
 	lua_pushnumber(L, (lua_Number)n)
 #endif
 
+#if defined LUA_VERSION_NUM && LUA_VERSION_NUM == 501
+/* Lua 5.1 */
+#define lua_rawlen lua_objlen
+#endif
+
 #define LUASQL_PREFIX      "LuaOCI: "
 #define LUASQL_ENVIRONMENT "Each driver must have an environment metatable"
 #define LUASQL_CONNECTION  "Each driver must have a connection metatable"